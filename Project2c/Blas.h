@@ -0,0 +1,236 @@
+// Blas.h
+
+/*
+ * the level 1 BLAS kernels of iterative solvers, on valarrays and expressions
+ *
+ *     double rr = dot(r, r);
+ *     double pAp = dot(p, A * p);              // any expressions, no temporaries
+ *     axpy(alpha, p, x);                       // x += alpha p
+ *     axpy(-alpha, q, r);                      // r -= alpha q
+ *     double norm = nrm2(r);                   // sqrt(dot(r, r)) that cannot overflow
+ *     scal(1.0 / norm, r);                     // r *= 1 / norm
+ *
+ * The operands are valarrays, views or expressions (the sparse overloads
+ * of dot and axpy are in Sparse.h). dot reads the shorter length, like
+ * a * b, axpy throws std::length_error when y is shorter than x and only
+ * updates the first x.len() elements of a longer one. Leaves are read
+ * through plain pointers (source), expressions are evaluated once per
+ * element inline in the loop, nodes that compute everything at once
+ * (matmul, scans) are materialized first.
+ *
+ * dot and nrm2 keep eight running sums, elements k, k + 1, ..., k + 7 going
+ * to sums 0 .. 7, so the additions are eight independent chains that fill
+ * the vector lanes instead of one chain waiting on the previous add. axpy
+ * and scal are plain loops. Above 64k elements per thread the range is cut
+ * into one piece per thread (parallel_for), the partial sums are added in
+ * order so a given thread count always gives the same bits.
+ *
+ * nrm2 first sums the squares directly, which is exact enough whenever
+ * that sum neither overflows nor drops into the range where squares lose
+ * bits. Only then it makes a second pass: find the largest |x[k]| and sum
+ * (x[k] / largest)^2, which cannot overflow or underflow. NaN anywhere
+ * gives NaN, an infinity (and no NaN) gives infinity.
+ */
+
+#ifndef _Blas_h
+#define _Blas_h
+
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+
+#include "Parallel.h"
+#include "Valarray.h"
+#include "View.h"
+
+namespace epl {
+
+/* the result type R, when the operands are what the kernel is for */
+template <bool B, class R>
+using BlasIf = typename std::enable_if<B, R>::type;
+template <class A, class B>
+using both_vexpr = std::integral_constant<bool, is_vexpr<A>::value && is_vexpr<B>::value>;
+template <class A, class B>
+using BlasCommon = typename std::common_type<Element<A>, Element<B>>::type;
+
+const size_t blas_grain = 64 * 1024;
+
+/*
+ * the sum of f(k) for k in [lo, hi), in eight running sums (see the top of
+ * the file). Counting whole blocks keeps the loop in a shape the compiler
+ * turns into one vector of sums, rather than interleaving blocks.
+ */
+template <class R, class F>
+R blas_sum(const F& f, size_t lo, size_t hi) {
+	const size_t ways = 8;
+	R s[ways] = {};
+	size_t blocks = (hi - lo) / ways;
+	for (size_t b = 0; b < blocks; b++) {
+		for (size_t j = 0; j < ways; j++) {
+			s[j] += f(lo + b * ways + j);
+		}
+	}
+	for (size_t k = lo + blocks * ways; k < hi; k++) {
+		s[0] += f(k);
+	}
+	return ((s[0] + s[1]) + (s[2] + s[3])) + ((s[4] + s[5]) + (s[6] + s[7]));
+}
+
+/* and over [0, n), across threads when there is enough of it */
+template <class R, class F>
+R blas_sum(const F& f, size_t n) {
+	size_t p = pieces(n, blas_grain);
+	if (p <= 1) {
+		return blas_sum<R>(f, 0, n);
+	}
+	vector<R> part(p);
+	R* parts = &part[0];
+	parallel_for(n, p, [&](size_t piece, size_t lo, size_t hi) { parts[piece] = blas_sum<R>(f, lo, hi); });
+	R total = R();
+	for (size_t k = 0; k < p; k++) {
+		total += parts[k];
+	}
+	return total;
+}
+
+template <class R, class X, class Y>
+R dot_of(const X& x, const Y& y, size_t n) {
+	return blas_sum<R>([&](size_t k) { return static_cast<R>(x[k]) * static_cast<R>(y[k]); }, n);
+}
+
+/* expressions that are evaluated element by element, or materialized first */
+template <class X, class Y>
+BlasCommon<X, Y> dot_into(const X& x, const Y& y, std::false_type, std::false_type) {
+	size_t n = (x.len() < y.len()) ? x.len() : y.len();
+	if (n == 0) { return BlasCommon<X, Y>(); }
+	return dot_of<BlasCommon<X, Y>>(source(x), source(y), n);
+}
+template <class X, class Y, class B>
+BlasCommon<X, Y> dot_into(const X& x, const Y& y, std::true_type, B) {
+	valarray<Element<X>> tmp(x.len());
+	if (x.len() != 0) { x.v.materialize(tmp.data()); }
+	return dot_into(tmp, y, std::false_type(), B());
+}
+template <class X, class Y>
+BlasCommon<X, Y> dot_into(const X& x, const Y& y, std::false_type, std::true_type) {
+	valarray<Element<Y>> tmp(y.len());
+	if (y.len() != 0) { y.v.materialize(tmp.data()); }
+	return dot_into(x, tmp, std::false_type(), std::false_type());
+}
+
+/* sum of x[k] y[k] (no conjugation for complex, like dotu) */
+template <class X, class Y>
+BlasIf<both_vexpr<X, Y>::value, BlasCommon<X, Y>> dot(const X& x, const Y& y) {
+	evaluation scope_x(x), scope_y(y);
+	return dot_into(x, y, is_bulk<X>(), is_bulk<Y>());
+}
+
+/* the second nrm2 pass, see the top of the file */
+template <class T, class S>
+T nrm2_scaled(const S& x, size_t n) {
+	T largest = T();
+	for (size_t k = 0; k < n; k++) {
+		T a = std::fabs(static_cast<T>(x[k]));
+		largest = (largest < a) ? a : largest;
+	}
+	if (largest == T() || std::isinf(largest)) {
+		return largest;
+	}
+	T ss = blas_sum<T>([&](size_t k) {
+		T r = static_cast<T>(x[k]) / largest;
+		return r * r;
+	}, n);
+	return largest * std::sqrt(ss);
+}
+
+template <class T, class S>
+T nrm2_of(const S& x, size_t n) {
+	/* below this the squares of the largest elements may have lost bits */
+	const T tiny = std::numeric_limits<T>::min() / std::numeric_limits<T>::epsilon();
+	T ss = blas_sum<T>([&](size_t k) {
+		T v = static_cast<T>(x[k]);
+		return v * v;
+	}, n);
+	if (std::isnan(ss) || (ss >= tiny && ss <= std::numeric_limits<T>::max())) {
+		return std::sqrt(ss);
+	}
+	return nrm2_scaled<T>(x, n);
+}
+
+template <class E>
+Element<E> nrm2_into(const E& x, std::false_type) {
+	return nrm2_of<Element<E>>(source(x), x.len());
+}
+template <class E>
+Element<E> nrm2_into(const E& x, std::true_type) {
+	valarray<Element<E>> tmp(x.len());
+	x.v.materialize(tmp.data());
+	return nrm2_of<Element<E>>(source(tmp), x.len());
+}
+
+/* the euclidean norm of a real expression */
+template <class E>
+BlasIf<is_vexpr<E>::value && std::is_floating_point<Element<E>>::value, Element<E>> nrm2(const E& x) {
+	if (x.len() == 0) { return Element<E>(); }
+	evaluation scope(x);
+	return nrm2_into(x, is_bulk<E>());
+}
+
+/* y[k] += a x[k] for k in [0, n) over a plain pointer */
+template <typename U, class S, typename T>
+void axpy_of(const U& a, const S& x, T* y, size_t n) {
+	parallel_for(n, pieces(n, blas_grain), [&](size_t piece, size_t lo, size_t hi) {
+		for (size_t k = lo; k < hi; k++) {
+			y[k] = static_cast<T>(y[k] + a * x[k]);
+		}
+	});
+}
+
+/* x reads y out of step (or computes everything at once): evaluate x first */
+template <typename U, class E, typename T>
+void axpy_into(const U& a, const E& x, T* y, size_t n) {
+	if (n == 0) { return; }
+	evaluation scope(x);
+	if (is_bulk<E>::value || x.hazard(y, y + n, true)) {
+		valarray<Element<E>> tmp = x;
+		axpy_of(a, source(tmp), y, n);
+		return;
+	}
+	axpy_of(a, source(x), y, n);
+}
+
+/* y += a x */
+template <typename U, class E, typename T>
+BlasIf<is_vexpr<E>::value, void> axpy(const U& a, const E& x, valarray<T>& y) {
+	if (y.len() < x.len()) { throw std::length_error("axpy into a shorter valarray"); }
+	axpy_into(a, x, (y.len() == 0) ? nullptr : assume_aligned<valarray_alignment>(y.data()), x.len());
+}
+template <typename U, class E, typename T>
+BlasIf<is_vexpr<E>::value, void> axpy(const U& a, const E& x, valarray_view<T> y) {
+	if (y.len() < x.len()) { throw std::length_error("axpy into a shorter valarray_view"); }
+	axpy_into(a, x, y.data(), x.len());
+}
+
+/* y *= a */
+template <typename U, typename T>
+void scal_of(const U& a, T* y, size_t n) {
+	parallel_for(n, pieces(n, blas_grain), [&](size_t piece, size_t lo, size_t hi) {
+		for (size_t k = lo; k < hi; k++) {
+			y[k] = static_cast<T>(a * y[k]);
+		}
+	});
+}
+template <typename U, typename T>
+void scal(const U& a, valarray<T>& y) {
+	if (y.len() != 0) { scal_of(a, assume_aligned<valarray_alignment>(y.data()), y.len()); }
+}
+template <typename U, typename T>
+void scal(const U& a, valarray_view<T> y) {
+	if (y.len() != 0) { scal_of(a, y.data(), y.len()); }
+}
+
+}
+
+#endif /* _Blas_h */
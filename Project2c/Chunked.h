@@ -0,0 +1,372 @@
+// Chunked.h
+
+/*
+ * valarrays that live in a file, for data larger than memory
+ *
+ *     chunked_valarray<double> a("a.bin", n), b("b.bin");   // create n elements, open an existing file
+ *     a = b * 2.0 + 1.0;                                    // streams one chunk at a time
+ *     double s = (a * b).accumulate(std::plus<double>());
+ *     valarray<double> head = a * 1.0;                      // in memory, if it fits
+ *
+ * The file is the raw elements, nothing else, cut into chunks of a fixed
+ * number of elements. A small LRU cache keeps the most recently used chunks
+ * in memory (dirty ones are written back when they are evicted, on flush()
+ * and in the destructor). A chunked_valarray in an expression reads through
+ * a cursor that holds on to the chunk it is in, so the common case is one
+ * compare and a load. Moving into a new chunk asks the cache for it and
+ * starts reading the next few chunks in the background, so a sequential pass
+ * (assignment, accumulate) computes on one chunk while the disk delivers the
+ * next ones.
+ *
+ * Assigning an expression to a chunked_valarray goes chunk by chunk too. A
+ * chunk that is overwritten completely is never read from the disk. The
+ * length is fixed when the file is created: a longer expression is a
+ * std::length_error, a shorter one leaves the rest alone. Reading the
+ * destination out of step (a gather, a shift) would need a second file and
+ * is a std::logic_error instead.
+ *
+ * T has to be trivially copyable. The cursors are not thread safe, so an
+ * expression with a chunked_valarray is evaluated on the thread that built
+ * it: while one is being evaluated (assigned, reduced, materialized) the
+ * parallel kernels run their pieces one after another on the calling
+ * thread, and a cursor used from any other thread throws std::logic_error.
+ */
+
+#ifndef _Chunked_h
+#define _Chunked_h
+
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+#include "Parallel.h"
+#include "Valarray.h"
+
+namespace epl {
+
+/* chunk size in elements, how many chunks stay in memory, how many to read ahead */
+struct chunk_options {
+	size_t chunk = 1 << 20;
+	size_t resident = 8;
+	size_t prefetch = 2;
+};
+
+/* one chunk in memory, data is valid once loaded is ready */
+template <typename T>
+struct chunk {
+	size_t index;
+	size_t count;
+	valarray<T> data;
+	bool dirty = false;
+	std::shared_future<void> loaded;
+	chunk(size_t index, size_t count) : index(index), count(count), data(count) {}
+};
+
+/* the file and the cache of its chunks, shared by the array and its cursors */
+template <typename T>
+struct chunk_store : std::enable_shared_from_this<chunk_store<T>> {
+	using handle = std::shared_ptr<chunk<T>>;
+	std::fstream file;
+	size_t n;
+	chunk_options opt;
+	std::mutex cache_lock;
+	std::mutex io_lock;
+	std::map<size_t, handle> resident;
+	std::list<size_t> lru;	/* most recently used first */
+
+	chunk_store(const std::string& path, size_t n, const chunk_options& opt, bool create) : n(n), opt(opt) {
+		static_assert(std::is_trivially_copyable<T>::value, "chunked_valarray needs trivially copyable elements");
+		if (opt.chunk == 0 || opt.resident == 0) { throw std::invalid_argument("chunked_valarray needs chunk and resident > 0"); }
+		std::ios::openmode mode = std::ios::in | std::ios::out | std::ios::binary;
+		file.open(path, create ? mode | std::ios::trunc : mode);
+		if (!file) { throw std::runtime_error("cannot open " + path); }
+		if (create) {
+			if (n != 0) {
+				file.seekp(static_cast<std::streamoff>(n * sizeof(T) - 1));
+				file.put('\0');
+			}
+		} else {
+			file.seekg(0, std::ios::end);
+			this->n = static_cast<size_t>(file.tellg()) / sizeof(T);
+		}
+		if (!file) { throw std::runtime_error("cannot size " + path); }
+	}
+
+	~chunk_store() {
+		for (auto& r : resident) {
+			try { this->write_back(*r.second); } catch (...) {}
+		}
+	}
+
+	size_t chunks() const { return (n + opt.chunk - 1) / opt.chunk; }
+	size_t count(size_t c) const { return (c + 1 < this->chunks()) ? opt.chunk : n - c * opt.chunk; }
+
+	/*
+	 * chunk c, loaded (or, when the caller is about to overwrite all of it,
+	 * just allocated). Whoever holds the handle keeps it resident.
+	 */
+	handle acquire(size_t c, bool overwrite) {
+		handle h;
+		std::promise<void> done;
+		bool load = false;
+		{
+			std::lock_guard<std::mutex> guard(cache_lock);
+			h = this->find(c);
+			if (!h) {
+				h = this->admit(c);
+				load = !overwrite;
+				h->loaded = overwrite ? ready() : done.get_future().share();
+			}
+		}
+		if (load) { this->read(*h, done); }
+		h->loaded.get();
+		return h;
+	}
+
+	/* start reading chunks c, c + 1, ... in the background, unless they are already here */
+	void prefetch(size_t c) {
+		std::shared_ptr<chunk_store> self = this->shared_from_this();
+		for (size_t k = c; k < c + opt.prefetch && k < this->chunks(); k++) {
+			handle h;
+			{
+				std::lock_guard<std::mutex> guard(cache_lock);
+				if (resident.count(k) != 0) { continue; }
+				h = this->admit(k);
+				std::shared_ptr<std::promise<void>> done = std::make_shared<std::promise<void>>();
+				h->loaded = done->get_future().share();
+				std::thread([self, h, done]() { self->read(*h, *done); }).detach();
+			}
+		}
+	}
+
+	/* write every dirty chunk back and flush the file */
+	void flush() {
+		std::lock_guard<std::mutex> guard(cache_lock);
+		for (auto& r : resident) { this->write_back(*r.second); }
+		std::lock_guard<std::mutex> io(io_lock);
+		file.flush();
+	}
+
+private:
+	static std::shared_future<void> ready() {
+		std::promise<void> p;
+		p.set_value();
+		return p.get_future().share();
+	}
+
+	/* with cache_lock held */
+	handle find(size_t c) {
+		auto r = resident.find(c);
+		if (r == resident.end()) { return handle(); }
+		lru.remove(c);
+		lru.push_front(c);
+		return r->second;
+	}
+
+	/* with cache_lock held: a new chunk, evicting the least recently used ones nobody holds */
+	handle admit(size_t c) {
+		handle h = std::make_shared<chunk<T>>(c, this->count(c));
+		resident[c] = h;
+		lru.push_front(c);
+		for (auto k = lru.end(); resident.size() > opt.resident && k != lru.begin();) {
+			--k;
+			handle& victim = resident[*k];
+			bool loading = victim->loaded.valid()
+				&& victim->loaded.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+			if (victim.use_count() > 1 || loading) { continue; }
+			this->write_back(*victim);
+			resident.erase(*k);
+			k = lru.erase(k);
+		}
+		return h;
+	}
+
+	void read(chunk<T>& h, std::promise<void>& done) {
+		try {
+			std::lock_guard<std::mutex> io(io_lock);
+			file.clear();
+			file.seekg(static_cast<std::streamoff>(h.index * opt.chunk * sizeof(T)));
+			file.read(reinterpret_cast<char*>(h.data.data()), static_cast<std::streamsize>(h.count * sizeof(T)));
+			if (!file) { throw std::runtime_error("chunked_valarray read failed"); }
+			done.set_value();
+		} catch (...) {
+			done.set_exception(std::current_exception());
+		}
+	}
+
+	void write_back(chunk<T>& h) {
+		if (!h.dirty) { return; }
+		std::lock_guard<std::mutex> io(io_lock);
+		file.clear();
+		file.seekp(static_cast<std::streamoff>(h.index * opt.chunk * sizeof(T)));
+		file.write(reinterpret_cast<const char*>(h.data.data()), static_cast<std::streamsize>(h.count * sizeof(T)));
+		if (!file) { throw std::runtime_error("chunked_valarray write failed"); }
+		h.dirty = false;
+	}
+};
+
+template <typename T>
+struct chunked_valarray;
+
+/* how an expression reads a chunked_valarray, see the top of the file */
+template <typename T>
+struct chunk_cursor {
+	using value_type = T;
+	std::shared_ptr<chunk_store<T>> store;
+	mutable typename chunk_store<T>::handle at;
+	mutable size_t base = 0;
+	mutable size_t count = 0;
+	mutable const T* p = nullptr;
+	const std::thread::id owner = std::this_thread::get_id();
+
+	chunk_cursor(chunked_valarray<T>& a) : store(a.store) {}
+
+	const T& operator[](size_t k) const {
+		size_t j = k - base;
+		if (j < count) { return p[j]; }
+		return this->move_to(k);
+	}
+	size_t len() const { return store->n; }
+	size_t size() const { return this->len(); }
+	/*
+	 * a chunked_valarray is known by the address of its store, see
+	 * chunked_valarray::operator=, and it has to be read on one thread
+	 */
+	bool hazard(const void* lo, const void* hi, bool elementwise) const {
+		if (lo == pinned_address()) { return true; }
+		const chunk_store<T>* s = store.get();
+		std::less<const void*> before;
+		bool overlap = before(s, hi) && before(lo, s + 1);
+		return overlap && !(elementwise && s == lo);
+	}
+	bool same(const chunk_cursor& that) const { return store == that.store; }
+
+private:
+	const T& move_to(size_t k) const {
+		if (std::this_thread::get_id() != owner) {
+			throw std::logic_error("a chunked_valarray read from a thread other than the one that built the expression");
+		}
+		size_t c = k / store->opt.chunk;
+		at = typename chunk_store<T>::handle();
+		at = store->acquire(c, false);
+		store->prefetch(c + 1);
+		base = c * store->opt.chunk;
+		count = at->count;
+		p = at->data.data();
+		return p[k - base];
+	}
+};
+
+template <typename T>
+struct chunked_valarray {
+	using value_type = T;
+	std::shared_ptr<chunk_store<T>> store;
+
+	/* create (or truncate) path, n elements of zero */
+	chunked_valarray(const std::string& path, size_t n, const chunk_options& opt = chunk_options()) :
+		store(std::make_shared<chunk_store<T>>(path, n, opt, true)) {}
+	/* open an existing file, its size says how many elements there are */
+	explicit chunked_valarray(const std::string& path, const chunk_options& opt = chunk_options()) :
+		store(std::make_shared<chunk_store<T>>(path, 0, opt, false)) {}
+	chunked_valarray(const chunked_valarray&) = delete;
+	chunked_valarray(chunked_valarray&&) = default;
+	~chunked_valarray() {
+		if (store) {
+			try { store->flush(); } catch (...) {}
+		}
+	}
+
+	size_t len() const { return store->n; }
+	size_t size() const { return this->len(); }
+	size_t chunk_size() const { return store->opt.chunk; }
+	size_t chunks() const { return store->chunks(); }
+	void flush() { store->flush(); }
+	/* like the cursors it is read through */
+	bool hazard(const void* lo, const void* hi, bool elementwise) const {
+		return chunk_cursor<T>(const_cast<chunked_valarray&>(*this)).hazard(lo, hi, elementwise);
+	}
+
+	/* one element, through the cache (fine now and then, expressions are the fast way) */
+	T operator[](size_t k) const {
+		if (k >= this->len()) { throw std::out_of_range("subscript out of range"); }
+		return store->acquire(k / this->chunk_size(), false)->data.data()[k % this->chunk_size()];
+	}
+	void set(size_t k, const T& x) {
+		if (k >= this->len()) { throw std::out_of_range("subscript out of range"); }
+		typename chunk_store<T>::handle h = store->acquire(k / this->chunk_size(), false);
+		h->dirty = true;
+		h->data.data()[k % this->chunk_size()] = x;
+	}
+
+	/* element by element (and chunk by chunk), like valarray but never growing */
+	chunked_valarray& operator=(const chunked_valarray& that) { return this->operator=<chunked_valarray>(that); }
+
+	template <typename U, typename = is_easy_vexpr<U>>
+	chunked_valarray& operator=(const U& e) {
+		const Ref<U> v(const_cast<U&>(e));
+		evaluation pinned(v);
+		size_t n = (v.len() == SIZE_MAX) ? this->len() : v.len();
+		if (n > this->len()) { throw std::length_error("expression longer than the chunked_valarray assigned to"); }
+		if (v.hazard(store.get(), store.get() + 1, true)) {
+			throw std::logic_error("a chunked_valarray cannot be assigned from an out of step read of itself");
+		}
+		/* a chunk the expression reads has to come from the disk even when all of it is overwritten */
+		bool reads = v.hazard(store.get(), store.get() + 1, false);
+		size_t c = 0;
+		for (size_t base = 0; base < n; base += this->chunk_size(), c++) {
+			size_t m = (n - base < store->count(c)) ? n - base : store->count(c);
+			typename chunk_store<T>::handle h = store->acquire(c, !reads && m == store->count(c));
+			h->dirty = true;
+			T* d = h->data.data();
+			for (size_t j = 0; j < m; j++) {
+				d[j] = v[base + j];
+			}
+		}
+		return *this;
+	}
+	chunked_valarray& operator=(const T& x) {
+		for (size_t c = 0; c < this->chunks(); c++) {
+			typename chunk_store<T>::handle h = store->acquire(c, true);
+			h->dirty = true;
+			T* d = h->data.data();
+			for (size_t j = 0; j < h->count; j++) {
+				d[j] = x;
+			}
+		}
+		return *this;
+	}
+
+	template <template <class> class Func, typename U>
+	auto accumulate(Func<U> f) -> typename decltype(f)::result_type {
+		using V = typename decltype(f)::result_type;
+		if (this->len() == 0) {
+			return V{};
+		}
+		chunk_cursor<T> src(*this);
+		evaluation pinned(src);
+		V acc(src[0]);
+		for (size_t k = 1; k < this->len(); k++) {
+			acc = f(acc, static_cast<V>(src[k]));
+		}
+		return acc;
+	}
+};
+
+template <typename T>
+struct to_ref<chunked_valarray<T>> { using type = chunk_cursor<T>; };
+template <typename T>
+struct is_vexpr<chunked_valarray<T>> : std::true_type {};
+
+}
+
+#endif /* _Chunked_h */
@@ -0,0 +1,359 @@
+// FFT.h
+
+/*
+ * fast Fourier transforms of valarray<std::complex<float/double>>
+ *
+ *     fft(z);                                  // in place, X[k] = sum x[j] e^(-2 pi i jk/n)
+ *     ifft(z);                                 // in place, the inverse (scaled by 1/n)
+ *     valarray<complex<double>> X = rfft(x);   // the n/2 + 1 nonnegative frequencies of a real x
+ *
+ * Any length works. n is factored into radix 4 passes, at most one radix 2
+ * pass, then 3s and whatever odd factors are left (those use a direct DFT
+ * of their own size, so a large prime n costs O(n^2)). A plan, the factors
+ * and one table of twiddle factors per pass, is built the first time a
+ * size is seen and kept in a small cache of the most recently used sizes
+ * (rfft's own twiddles too).
+ *
+ * The passes are Stockham's autosort form: every pass reads one array and
+ * writes the other in natural order, so there is no bit reversal and no
+ * strided scatter. The data ping-pongs between the valarray and a pooled
+ * scratch array and ends up back in the valarray. Butterflies are written
+ * on the real and imaginary parts (not std::complex's operator*, which
+ * checks for NaNs), the inner loop runs over the longer of the two
+ * contiguous directions of a pass so it can be vectorized, and large
+ * transforms split every pass over threads.
+ */
+
+#ifndef _FFT_h
+#define _FFT_h
+
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+
+#include "Parallel.h"
+#include "Valarray.h"
+
+namespace epl {
+
+/* e^(-2 pi i k / m), worked out in double with k reduced first */
+template <typename T>
+std::complex<T> unit_root(size_t k, size_t m) {
+	const double pi = 3.14159265358979323846;
+	double a = -2.0 * pi * static_cast<double>(k % m) / static_cast<double>(m);
+	return std::complex<T>(static_cast<T>(std::cos(a)), static_cast<T>(std::sin(a)));
+}
+
+template <typename T>
+class fft_plan {
+public:
+	/* one pass: radix r over blocks of span (the product of the earlier radices) */
+	struct pass {
+		size_t r;
+		size_t span;
+		size_t twiddles;	/* offset of w[k * (r - 1) + q - 1] = e^(-2 pi i kq / (span r)) */
+		size_t roots;		/* offset of the r-th roots of unity, for the odd radices */
+	};
+
+	explicit fft_plan(size_t n) : n(n) {
+		size_t m = n;
+		size_t span = 1;
+		vector<size_t> radix;
+		while (m % 4 == 0) { radix.push_back(4); m /= 4; }
+		if (m % 2 == 0) { radix.push_back(2); m /= 2; }
+		for (size_t f = 3; m > 1; f += 2) {
+			while (m % f == 0) { radix.push_back(f); m /= f; }
+			if (f * f > m && m > 1) { radix.push_back(m); m = 1; }
+		}
+		for (size_t s = 0; s < radix.size(); s++) {
+			size_t r = radix[s];
+			pass p{r, span, table.size(), 0};
+			for (size_t k = 0; k < span; k++) {
+				for (size_t q = 1; q < r; q++) {
+					table.push_back(unit_root<T>(k * q, span * r));
+				}
+			}
+			if (r != 2 && r != 3 && r != 4) {
+				p.roots = table.size();
+				for (size_t q = 0; q < r; q++) {
+					table.push_back(unit_root<T>(q, r));
+				}
+			}
+			passes.push_back(p);
+			span *= r;
+		}
+	}
+
+	const size_t n;
+	vector<pass> passes;
+	vector<std::complex<T>> table;
+};
+
+/* the twiddles e^(-2 pi i k / n), k < n/2, that rfft uses to separate its two half spectra */
+template <typename T>
+struct rfft_plan {
+	vector<std::complex<T>> w;
+	explicit rfft_plan(size_t n) {
+		for (size_t k = 0; k < n / 2; k++) {
+			w.push_back(unit_root<T>(k, n));
+		}
+	}
+};
+
+/* how many plans of each kind stay cached */
+const size_t cached_plans = 16;
+
+/*
+ * the plan P for size n, shared. The most recently used cached_plans
+ * sizes are kept; an evicted plan lives on while a caller still holds it
+ * and is simply made again the next time its size comes up.
+ */
+template <class P>
+std::shared_ptr<const P> plan_for(size_t n) {
+	static std::mutex lock;
+	static std::list<std::pair<size_t, std::shared_ptr<const P>>> plans;	/* most recently used first */
+	std::lock_guard<std::mutex> hold(lock);
+	for (auto k = plans.begin(); k != plans.end(); ++k) {
+		if (k->first == n) {
+			plans.splice(plans.begin(), plans, k);
+			return k->second;
+		}
+	}
+	plans.emplace_front(n, std::make_shared<const P>(n));
+	if (plans.size() > cached_plans) { plans.pop_back(); }
+	return plans.front().second;
+}
+
+namespace butterfly {
+
+/* complex values as two T, the twiddle conjugated for the inverse */
+template <typename T>
+struct cx {
+	T re, im;
+};
+template <bool Inv, typename T>
+cx<T> twiddle(const cx<T>& a, const std::complex<T>& w) {
+	T c = w.real();
+	T s = Inv ? -w.imag() : w.imag();
+	return cx<T>{a.re * c - a.im * s, a.re * s + a.im * c};
+}
+
+/*
+ * one pass over butterflies [b_lo, b_hi) x [k_lo, k_hi): butterfly (b, k)
+ * reads in[j + q * n / r] for j = b * span + k, multiplies by the twiddles
+ * for k, does a DFT of size r and writes out[b * span * r + k + q * span].
+ */
+template <bool Inv, typename T>
+struct stage {
+	const typename fft_plan<T>::pass& p;
+	const std::complex<T>* table;
+	const cx<T>* in;
+	cx<T>* out;
+	size_t n;
+
+	template <size_t R, class F>
+	void run(size_t b_lo, size_t b_hi, size_t k_lo, size_t k_hi, F dft) const {
+		const size_t m = n / R;
+		const size_t span = p.span;
+		const std::complex<T>* w = table + p.twiddles;
+		auto one = [&](size_t b, size_t k) {
+			size_t j = b * span + k;
+			cx<T> a[R];
+			a[0] = in[j];
+			for (size_t q = 1; q < R; q++) {
+				a[q] = twiddle<Inv>(in[j + q * m], w[k * (R - 1) + q - 1]);
+			}
+			dft(a);
+			cx<T>* y = out + b * span * R + k;
+			for (size_t q = 0; q < R; q++) {
+				y[q * span] = a[q];
+			}
+		};
+		if (span >= 4) {
+			for (size_t b = b_lo; b < b_hi; b++) {
+				for (size_t k = k_lo; k < k_hi; k++) { one(b, k); }
+			}
+		} else {
+			for (size_t k = k_lo; k < k_hi; k++) {
+				for (size_t b = b_lo; b < b_hi; b++) { one(b, k); }
+			}
+		}
+	}
+
+	void operator()(size_t b_lo, size_t b_hi, size_t k_lo, size_t k_hi) const {
+		switch (p.r) {
+		case 2:
+			this->run<2>(b_lo, b_hi, k_lo, k_hi, [](cx<T>* a) {
+				cx<T> x = a[0], y = a[1];
+				a[0] = cx<T>{x.re + y.re, x.im + y.im};
+				a[1] = cx<T>{x.re - y.re, x.im - y.im};
+			});
+			break;
+		case 3:
+			this->run<3>(b_lo, b_hi, k_lo, k_hi, [](cx<T>* a) {
+				const T h = T(0.866025403784438646763723170752936183);
+				cx<T> t1{a[1].re + a[2].re, a[1].im + a[2].im};
+				cx<T> t2{a[0].re - t1.re / 2, a[0].im - t1.im / 2};
+				/* -i (or i for the inverse) times sqrt(3)/2 (a1 - a2) */
+				T dr = h * (a[1].re - a[2].re), di = h * (a[1].im - a[2].im);
+				cx<T> t3 = Inv ? cx<T>{-di, dr} : cx<T>{di, -dr};
+				a[0] = cx<T>{a[0].re + t1.re, a[0].im + t1.im};
+				a[1] = cx<T>{t2.re + t3.re, t2.im + t3.im};
+				a[2] = cx<T>{t2.re - t3.re, t2.im - t3.im};
+			});
+			break;
+		case 4:
+			this->run<4>(b_lo, b_hi, k_lo, k_hi, [](cx<T>* a) {
+				cx<T> t0{a[0].re + a[2].re, a[0].im + a[2].im};
+				cx<T> t1{a[0].re - a[2].re, a[0].im - a[2].im};
+				cx<T> t2{a[1].re + a[3].re, a[1].im + a[3].im};
+				T dr = a[1].re - a[3].re, di = a[1].im - a[3].im;
+				cx<T> t3 = Inv ? cx<T>{-di, dr} : cx<T>{di, -dr};
+				a[0] = cx<T>{t0.re + t2.re, t0.im + t2.im};
+				a[1] = cx<T>{t1.re + t3.re, t1.im + t3.im};
+				a[2] = cx<T>{t0.re - t2.re, t0.im - t2.im};
+				a[3] = cx<T>{t1.re - t3.re, t1.im - t3.im};
+			});
+			break;
+		default:
+			this->odd(b_lo, b_hi, k_lo, k_hi);
+		}
+	}
+
+	/* any other radix, a direct DFT through the table of roots */
+	void odd(size_t b_lo, size_t b_hi, size_t k_lo, size_t k_hi) const {
+		const size_t r = p.r;
+		const size_t m = n / r;
+		const size_t span = p.span;
+		const std::complex<T>* w = table + p.twiddles;
+		const std::complex<T>* u = table + p.roots;
+		buffer<cx<T>> a(r);
+		cx<T>* x = a.data;
+		for (size_t b = b_lo; b < b_hi; b++) {
+			for (size_t k = k_lo; k < k_hi; k++) {
+				size_t j = b * span + k;
+				x[0] = in[j];
+				for (size_t q = 1; q < r; q++) {
+					x[q] = twiddle<Inv>(in[j + q * m], w[k * (r - 1) + q - 1]);
+				}
+				cx<T>* y = out + b * span * r + k;
+				for (size_t q = 0; q < r; q++) {
+					cx<T> s{0, 0};
+					for (size_t t = 0; t < r; t++) {
+						cx<T> v = twiddle<Inv>(x[t], u[(t * q) % r]);
+						s.re += v.re;
+						s.im += v.im;
+					}
+					y[q * span] = s;
+				}
+			}
+		}
+	}
+};
+
+}
+
+/* transform data[0, n) in place with plan, see the top of the file */
+template <bool Inv, typename T>
+void fft_run(const fft_plan<T>& plan, std::complex<T>* data) {
+	using butterfly::cx;
+	const size_t n = plan.n;
+	const size_t grain = 16 * 1024;
+	if (n < 2) { return; }
+	buffer<cx<T>> scratch(n);
+	cx<T>* in = reinterpret_cast<cx<T>*>(data);
+	cx<T>* out = scratch.data;
+	for (size_t s = 0; s < plan.passes.size(); s++) {
+		const typename fft_plan<T>::pass& p = plan.passes[s];
+		butterfly::stage<Inv, T> st{p, &plan.table[0], in, out, n};
+		size_t blocks = n / (p.span * p.r);
+		size_t threads = pieces(n, grain);
+		if (threads <= 1) {
+			st(0, blocks, 0, p.span);
+		} else if (blocks >= threads) {
+			parallel_for(blocks, threads, [&](size_t, size_t lo, size_t hi) { st(lo, hi, 0, p.span); });
+		} else {
+			parallel_for(p.span, threads, [&](size_t, size_t lo, size_t hi) { st(0, blocks, lo, hi); });
+		}
+		std::swap(in, out);
+	}
+	if (in != reinterpret_cast<cx<T>*>(data)) {
+		cx<T>* d = reinterpret_cast<cx<T>*>(data);
+		for (size_t k = 0; k < n; k++) {
+			d[k] = in[k];
+		}
+	}
+}
+
+template <typename T>
+valarray<std::complex<T>>& fft(valarray<std::complex<T>>& x) {
+	static_assert(std::is_floating_point<T>::value, "fft needs complex<float>, complex<double> or complex<long double>");
+	if (x.len() > 1) {
+		fft_run<false>(*plan_for<fft_plan<T>>(x.len()), &x[0]);
+	}
+	return x;
+}
+
+template <typename T>
+valarray<std::complex<T>>& ifft(valarray<std::complex<T>>& x) {
+	static_assert(std::is_floating_point<T>::value, "ifft needs complex<float>, complex<double> or complex<long double>");
+	size_t n = x.len();
+	if (n > 1) {
+		std::complex<T>* d = &x[0];
+		fft_run<true>(*plan_for<fft_plan<T>>(n), d);
+		T s = T(1) / static_cast<T>(n);
+		for (size_t k = 0; k < n; k++) {
+			d[k] = std::complex<T>(d[k].real() * s, d[k].imag() * s);
+		}
+	}
+	return x;
+}
+
+/*
+ * the transform of a real x, X[0] .. X[n/2]. For even n the n/2 complex
+ * values x[2j] + i x[2j + 1] are transformed and the two interleaved real
+ * spectra are separated afterwards, half the work of a complex fft.
+ */
+template <typename T>
+valarray<std::complex<T>> rfft(const valarray<T>& x) {
+	static_assert(std::is_floating_point<T>::value, "rfft needs float, double or long double");
+	using C = std::complex<T>;
+	size_t n = x.len();
+	valarray<C> out(n / 2 + 1);
+	if (n == 0) { return out; }
+	const T* src = &x[0];
+	if (n % 2 != 0 || n < 4) {
+		valarray<C> z(n);
+		for (size_t k = 0; k < n; k++) { z[k] = C(src[k], 0); }
+		fft(z);
+		for (size_t k = 0; k <= n / 2; k++) { out[k] = z[k]; }
+		return out;
+	}
+	size_t h = n / 2;
+	valarray<C> z(h);
+	C* zp = &z[0];
+	for (size_t k = 0; k < h; k++) { zp[k] = C(src[2 * k], src[2 * k + 1]); }
+	fft(z);
+	std::shared_ptr<const rfft_plan<T>> plan = plan_for<rfft_plan<T>>(n);
+	const C* w = &plan->w[0];
+	C* y = &out[0];
+	y[0] = C(zp[0].real() + zp[0].imag(), 0);
+	y[h] = C(zp[0].real() - zp[0].imag(), 0);
+	for (size_t k = 1; k < h; k++) {
+		/* even part (z[k] + conj z[h-k]) / 2, odd part (z[k] - conj z[h-k]) / 2i */
+		C a = zp[k], b = std::conj(zp[h - k]);
+		T er = (a.real() + b.real()) / 2, ei = (a.imag() + b.imag()) / 2;
+		T orr = (a.imag() - b.imag()) / 2, oi = -(a.real() - b.real()) / 2;
+		y[k] = C(er + orr * w[k].real() - oi * w[k].imag(), ei + orr * w[k].imag() + oi * w[k].real());
+	}
+	return out;
+}
+
+}
+
+#endif /* _FFT_h */
@@ -0,0 +1,152 @@
+// Histogram.h
+
+/*
+ * histograms of expressions
+ *
+ *     valarray<size_t> h = histogram(a * b, 100, 0.0, 1.0);   // 100 equal bins over [0, 1]
+ *     valarray<size_t> c = bincount(labels);                   // c[v] = how many times v occurs
+ *
+ * The expression is read one element at a time, never materialized. Bin k
+ * of histogram holds [lo + k w, lo + (k + 1) w) with w = (hi - lo) / bins,
+ * the last bin also takes hi itself, anything else (and NaN) is left out
+ * (lo < hi, or std::domain_error). bincount needs integers and throws
+ * std::domain_error on a negative one, its result is as long as the
+ * largest value plus one. bincount reads the expression twice, the first
+ * pass finds the largest value so the counts are sized once.
+ *
+ * Counting into one array stalls whenever neighbouring elements fall into
+ * the same bin (each increment waits for the previous store), so the
+ * counts are spread over four private copies, element k going to copy
+ * k % 4, and every thread has its own four. The copies are added up at the
+ * end. Above 16k bins the copies stop fitting in cache and one is used.
+ * bincount also uses fewer threads when their copies would take more room
+ * than the elements, so one huge value costs its own counts only once.
+ */
+
+#ifndef _Histogram_h
+#define _Histogram_h
+
+#include <cstddef>
+#include <stdexcept>
+#include <type_traits>
+
+#include "Parallel.h"
+#include "Valarray.h"
+
+namespace epl {
+
+/* the bin of x, or bins for anything outside [lo, hi], with no branches */
+struct binning {
+	double lo;
+	double hi;
+	double scale;
+	size_t bins;
+	size_t operator()(double x) const {
+		bool in = (x >= lo) & (x <= hi);
+		double b = (x - lo) * scale;
+		b = in ? b : static_cast<double>(bins);
+		size_t k = static_cast<size_t>(b);
+		return (in & (k == bins)) ? bins - 1 : k;
+	}
+};
+
+/* bincount's bins are the values themselves */
+struct value_binning {
+	template <typename V>
+	size_t operator()(const V& v) const { return static_cast<size_t>(v); }
+};
+
+template <class S, class B>
+void histogram_range(const S& src, const B& bin, size_t* c, size_t stride, size_t lo, size_t hi) {
+	size_t k = lo;
+	for (; k + 4 <= hi; k += 4) {
+		size_t b0 = bin(src[k]), b1 = bin(src[k + 1]), b2 = bin(src[k + 2]), b3 = bin(src[k + 3]);
+		c[b0] += 1;
+		c[stride + b1] += 1;
+		c[2 * stride + b2] += 1;
+		c[3 * stride + b3] += 1;
+	}
+	for (; k < hi; k++) {
+		c[bin(src[k])] += 1;
+	}
+}
+
+template <class E>
+typename std::enable_if<is_vexpr<E>::value, valarray<size_t>>::type
+histogram(const E& e, size_t bins, double lo, double hi) {
+	const size_t grain = 64 * 1024;
+	valarray<size_t> out(bins);
+	size_t n = e.len();
+	if (!(lo < hi)) { throw std::domain_error("histogram needs lo < hi"); }
+	if (bins == 0 || n == 0) { return out; }
+	evaluation scope(e);
+	binning bin{lo, hi, static_cast<double>(bins) / (hi - lo), bins};
+	/* bins + 1 per copy, the last one collects everything out of range */
+	size_t width = bins + 1;
+	size_t lanes = (bins <= 16 * 1024) ? 4 : 1;
+	size_t p = pieces(n, grain);
+	vector<size_t> counts(p * lanes * width);
+	size_t* c = &counts[0];
+	auto src = source(e);
+	parallel_for(n, p, [&](size_t piece, size_t a, size_t b) {
+		histogram_range(src, bin, c + piece * lanes * width, (lanes == 4) ? width : 0, a, b);
+	});
+	size_t* h = &out[0];
+	for (size_t q = 0; q < p * lanes; q++) {
+		const size_t* part = c + q * width;
+		for (size_t k = 0; k < bins; k++) { h[k] += part[k]; }
+	}
+	return out;
+}
+
+template <class E>
+typename std::enable_if<is_vexpr<E>::value && std::is_integral<Element<E>>::value, valarray<size_t>>::type
+bincount(const E& e) {
+	using T = Element<E>;
+	const size_t grain = 64 * 1024;
+	size_t n = e.len();
+	if (n == 0) { return valarray<size_t>(); }
+	evaluation scope(e);
+	auto src = source(e);
+
+	/* the largest value sizes the counts, the smallest must not be negative */
+	size_t p = pieces(n, grain);
+	vector<T> range(2 * p);
+	T* r = &range[0];
+	parallel_for(n, p, [&](size_t piece, size_t a, size_t b) {
+		T lo = src[a], hi = src[a];
+		for (size_t k = a + 1; k < b; k++) {
+			T v = src[k];
+			lo = (v < lo) ? v : lo;
+			hi = (hi < v) ? v : hi;
+		}
+		r[2 * piece] = lo;
+		r[2 * piece + 1] = hi;
+	});
+	T most = r[1];
+	for (size_t q = 0; q < p; q++) {
+		if (r[2 * q] < T()) { throw std::domain_error("bincount of a negative value"); }
+		most = (most < r[2 * q + 1]) ? r[2 * q + 1] : most;
+	}
+
+	size_t width = static_cast<size_t>(most) + 1;
+	size_t lanes = (width <= 16 * 1024) ? 4 : 1;
+	size_t fit = n / (lanes * width);
+	if (fit < p) { p = (fit == 0) ? 1 : fit; }
+	vector<size_t> counts(p * lanes * width);
+	size_t* c = &counts[0];
+	parallel_for(n, p, [&](size_t piece, size_t a, size_t b) {
+		histogram_range(src, value_binning(), c + piece * lanes * width, (lanes == 4) ? width : 0, a, b);
+	});
+	valarray<size_t> out(width);
+	size_t* h = &out[0];
+	for (size_t q = 0; q < p * lanes; q++) {
+		const size_t* part = c + q * width;
+		for (size_t k = 0; k < width; k++) { h[k] += part[k]; }
+	}
+	return out;
+}
+
+}
+
+#endif /* _Histogram_h */
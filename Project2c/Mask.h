@@ -0,0 +1,181 @@
+// Mask.h
+
+/*
+ * lazy comparisons, logic and select
+ *
+ *     valarray<double> y = select(a > 0.0 && a < hi, a, 0.0);
+ *     size_t n = count(a > t);
+ *
+ * a < b, a == b etc. build BinaryOp nodes of bool through the usual rewrite
+ * layer, &&, || and ! combine them (without short circuiting, both sides are
+ * always evaluated) and select(m, x, y) evaluates x and y then picks one,
+ * so none of these has a branch for the compiler to keep and the loops can
+ * use blends. A mask is an ordinary expression: it can be assigned to a
+ * valarray<bool>, cached, or accumulated, e.g. (a > t).accumulate(std::plus<int>()).
+ */
+
+#ifndef _Mask_h
+#define _Mask_h
+
+#include <cstddef>
+#include <type_traits>
+
+#include "Parallel.h"
+#include "Valarray.h"
+
+namespace epl {
+
+/* comparisons in the promoted type, same as the arithmetic functors */
+template <class T, class U>
+struct less_than : std::binary_function<ValueType<T>, ValueType<U>, bool> {
+	bool operator()(const ValueType<T>& x, const ValueType<U>& y) const { return CondComp<T, U>(x) < CondComp<U, T>(y); }
+};
+template <class T, class U>
+struct less_or_equal : std::binary_function<ValueType<T>, ValueType<U>, bool> {
+	bool operator()(const ValueType<T>& x, const ValueType<U>& y) const { return CondComp<T, U>(x) <= CondComp<U, T>(y); }
+};
+template <class T, class U>
+struct greater_than : std::binary_function<ValueType<T>, ValueType<U>, bool> {
+	bool operator()(const ValueType<T>& x, const ValueType<U>& y) const { return CondComp<T, U>(x) > CondComp<U, T>(y); }
+};
+template <class T, class U>
+struct greater_or_equal : std::binary_function<ValueType<T>, ValueType<U>, bool> {
+	bool operator()(const ValueType<T>& x, const ValueType<U>& y) const { return CondComp<T, U>(x) >= CondComp<U, T>(y); }
+};
+template <class T, class U>
+struct equality : std::binary_function<ValueType<T>, ValueType<U>, bool> {
+	bool operator()(const ValueType<T>& x, const ValueType<U>& y) const { return CondComp<T, U>(x) == CondComp<U, T>(y); }
+};
+template <class T, class U>
+struct inequality : std::binary_function<ValueType<T>, ValueType<U>, bool> {
+	bool operator()(const ValueType<T>& x, const ValueType<U>& y) const { return CondComp<T, U>(x) != CondComp<U, T>(y); }
+};
+
+/* & and | on bools rather than && and ||, nothing to branch around */
+template <class T, class U>
+struct conjunction : std::binary_function<ValueType<T>, ValueType<U>, bool> {
+	bool operator()(const ValueType<T>& x, const ValueType<U>& y) const { return static_cast<bool>(x) & static_cast<bool>(y); }
+};
+template <class T, class U>
+struct disjunction : std::binary_function<ValueType<T>, ValueType<U>, bool> {
+	bool operator()(const ValueType<T>& x, const ValueType<U>& y) const { return static_cast<bool>(x) | static_cast<bool>(y); }
+};
+template <class T>
+struct negation : std::unary_function<T, bool> {
+	bool operator()(const T& x) const { return !static_cast<bool>(x); }
+};
+
+/* select(m, x, y)[k] is m[k] ? x[k] : y[k], with both x[k] and y[k] computed */
+template <class M, class X, class Y>
+struct Select {
+	using value_type = typename std::common_type<CondComp<X, Y>, CondComp<Y, X>>::type;
+	const Ref<M> mask;
+	const Ref<X> x;
+	const Ref<Y> y;
+	Select(const M& mask, const X& x, const Y& y) :
+		mask(const_cast<M&>(mask)), x(const_cast<X&>(x)), y(const_cast<Y&>(y)) {}
+	value_type operator[](size_t k) const {
+		value_type a = x[k];
+		value_type b = y[k];
+		return mask[k] ? a : b;
+	}
+	size_t len() const {
+		size_t n = mask.len();
+		if (x.len() < n) { n = x.len(); }
+		if (y.len() < n) { n = y.len(); }
+		return n;
+	}
+	size_t size() const { return this->len(); }
+	bool hazard(const void* lo, const void* hi, bool elementwise) const {
+		return mask.hazard(lo, hi, elementwise) || x.hazard(lo, hi, elementwise) || y.hazard(lo, hi, elementwise);
+	}
+	bool same(const Select& that) const { return mask.same(that.mask) && x.same(that.x) && y.same(that.y); }
+};
+
+/* an operand of select: expressions as they are, scalars as UnVal */
+template <class T, class = void>
+struct operand { using type = T; static const T& wrap(const T& x) { return x; } };
+template <class T>
+struct operand<T, When<std::is_arithmetic<T>::value || is_complex<T>::value>> {
+	using type = UnVal<T>;
+	static type wrap(const T& x) { return type(UnaryVal<T>(x)); }
+};
+template <class T>
+using Operand = typename operand<T>::type;
+
+template <class M, class X, class Y>
+using SelectOf = typename std::enable_if<is_vexpr<M>::value && is_vexpr<Operand<X>>::value && is_vexpr<Operand<Y>>::value,
+	vexpr<Select<M, Operand<X>, Operand<Y>>>>::type;
+
+template <class M, class X, class Y>
+SelectOf<M, X, Y> select(const M& mask, const X& x, const Y& y) {
+	using Node = Select<M, Operand<X>, Operand<Y>>;
+	return vexpr<Node>(Node(mask, operand<X>::wrap(x), operand<Y>::wrap(y)));
+}
+
+/* the operators, between expressions and between an expression and a scalar */
+template <class Expr1, class Expr2>
+BinOp<less_than, Expr1, Expr2> operator<(const Expr1& x, const Expr2& y) { return rewrite<less_than, Expr1, Expr2>::apply(x, y); }
+template <class Expr1, class Expr2>
+BinOp<less_or_equal, Expr1, Expr2> operator<=(const Expr1& x, const Expr2& y) { return rewrite<less_or_equal, Expr1, Expr2>::apply(x, y); }
+template <class Expr1, class Expr2>
+BinOp<greater_than, Expr1, Expr2> operator>(const Expr1& x, const Expr2& y) { return rewrite<greater_than, Expr1, Expr2>::apply(x, y); }
+template <class Expr1, class Expr2>
+BinOp<greater_or_equal, Expr1, Expr2> operator>=(const Expr1& x, const Expr2& y) { return rewrite<greater_or_equal, Expr1, Expr2>::apply(x, y); }
+template <class Expr1, class Expr2>
+BinOp<equality, Expr1, Expr2> operator==(const Expr1& x, const Expr2& y) { return rewrite<equality, Expr1, Expr2>::apply(x, y); }
+template <class Expr1, class Expr2>
+BinOp<inequality, Expr1, Expr2> operator!=(const Expr1& x, const Expr2& y) { return rewrite<inequality, Expr1, Expr2>::apply(x, y); }
+template <class Expr1, class Expr2>
+BinOp<conjunction, Expr1, Expr2> operator&&(const Expr1& x, const Expr2& y) { return rewrite<conjunction, Expr1, Expr2>::apply(x, y); }
+template <class Expr1, class Expr2>
+BinOp<disjunction, Expr1, Expr2> operator||(const Expr1& x, const Expr2& y) { return rewrite<disjunction, Expr1, Expr2>::apply(x, y); }
+template <class Expr1>
+UnFun<negation, Expr1, ValueType<Expr1>> operator!(const Expr1& x) {
+	using Node = UnaryFunction<negation, ValueType<Expr1>, Expr1>;
+	return vexpr<Node>(Node(negation<ValueType<Expr1>>(), x));
+}
+
+template <typename T, typename U, typename = is_easy_math<U>>
+BinOp<less_than, T, UnVal<U>> operator<(const T& a, const U& b) { return a < UnVal<U>(UnaryVal<U>(b)); }
+template <typename T, typename U, typename = is_easy_math<U>>
+BinOp<less_than, UnVal<U>, T> operator<(const U& b, const T& a) { return UnVal<U>(UnaryVal<U>(b)) < a; }
+template <typename T, typename U, typename = is_easy_math<U>>
+BinOp<less_or_equal, T, UnVal<U>> operator<=(const T& a, const U& b) { return a <= UnVal<U>(UnaryVal<U>(b)); }
+template <typename T, typename U, typename = is_easy_math<U>>
+BinOp<less_or_equal, UnVal<U>, T> operator<=(const U& b, const T& a) { return UnVal<U>(UnaryVal<U>(b)) <= a; }
+template <typename T, typename U, typename = is_easy_math<U>>
+BinOp<greater_than, T, UnVal<U>> operator>(const T& a, const U& b) { return a > UnVal<U>(UnaryVal<U>(b)); }
+template <typename T, typename U, typename = is_easy_math<U>>
+BinOp<greater_than, UnVal<U>, T> operator>(const U& b, const T& a) { return UnVal<U>(UnaryVal<U>(b)) > a; }
+template <typename T, typename U, typename = is_easy_math<U>>
+BinOp<greater_or_equal, T, UnVal<U>> operator>=(const T& a, const U& b) { return a >= UnVal<U>(UnaryVal<U>(b)); }
+template <typename T, typename U, typename = is_easy_math<U>>
+BinOp<greater_or_equal, UnVal<U>, T> operator>=(const U& b, const T& a) { return UnVal<U>(UnaryVal<U>(b)) >= a; }
+template <typename T, typename U, typename = is_easy_math<U>>
+BinOp<equality, T, UnVal<U>> operator==(const T& a, const U& b) { return a == UnVal<U>(UnaryVal<U>(b)); }
+template <typename T, typename U, typename = is_easy_math<U>>
+BinOp<equality, UnVal<U>, T> operator==(const U& b, const T& a) { return UnVal<U>(UnaryVal<U>(b)) == a; }
+template <typename T, typename U, typename = is_easy_math<U>>
+BinOp<inequality, T, UnVal<U>> operator!=(const T& a, const U& b) { return a != UnVal<U>(UnaryVal<U>(b)); }
+template <typename T, typename U, typename = is_easy_math<U>>
+BinOp<inequality, UnVal<U>, T> operator!=(const U& b, const T& a) { return UnVal<U>(UnaryVal<U>(b)) != a; }
+
+/* reductions over a mask */
+template <class E, typename = is_easy_vexpr<E>>
+size_t count(const E& mask) {
+	evaluation scope(mask);
+	size_t n = 0;
+	for (size_t k = 0; k < mask.len(); k++) {
+		n += static_cast<size_t>(static_cast<bool>(mask[k]));
+	}
+	return n;
+}
+template <class E, typename = is_easy_vexpr<E>>
+bool any(const E& mask) { return count(mask) != 0; }
+template <class E, typename = is_easy_vexpr<E>>
+bool all(const E& mask) { return count(mask) == mask.len(); }
+
+}
+
+#endif /* _Mask_h */
@@ -0,0 +1,422 @@
+// Matrix.h
+
+/*
+ * a two dimensional epl::matrix<T> on top of epl::valarray<T>
+ *
+ * a matrix is a valarray of rows * cols elements stored either row major or
+ * column major. Inside an expression a matrix (and every view of one) is
+ * read in logical row major order, element k is (k / cols, k % cols), so
+ * matrices with different storage orders, transposes, rows, columns and
+ * blocks can all be mixed with the usual operators.
+ *
+ * views never copy, they just remap indexes. Assigning an expression to a
+ * matrix walks it with a cache-oblivious recursive tiling, so transposed or
+ * column major operands don't thrash the cache.
+ *
+ * matmul(a, b) is a lazy matrix product, assigning it to a matrix or a
+ * valarray runs the blocked, multithreaded gemm below.
+ */
+
+#ifndef _Matrix_h
+#define _Matrix_h
+
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+#include "Parallel.h"
+#include "Valarray.h"
+
+namespace epl {
+
+/* declare these up front */
+template <typename T>
+struct matrix;
+template <typename T>
+struct Transposed;
+template <typename T>
+struct Block;
+template <typename T>
+struct MatMul;
+
+enum storage_order { row_major, col_major };
+
+/* matrices are leaves, store them by reference like valarrays */
+template <typename T>
+struct to_ref<matrix<T>> { using type = matrix<T>&; };
+template <typename T>
+struct is_vexpr<matrix<T>> : std::true_type {};
+
+/* the shape of an expression, taken from the first matrix (or view) in it */
+struct extent {
+	size_t rows;
+	size_t cols;
+	bool known;
+};
+
+template <class E>
+extent shape_of(const E& e) { return extent{0, 0, false}; }
+template <typename T>
+extent shape_of(const matrix<T>& m) { return extent{m.rows(), m.cols(), true}; }
+template <typename T>
+extent shape_of(const Transposed<T>& m) { return extent{m.rows(), m.cols(), true}; }
+template <typename T>
+extent shape_of(const Block<T>& m) { return extent{m.rows(), m.cols(), true}; }
+template <typename T>
+extent shape_of(const MatMul<T>& m) { return extent{m.rows(), m.cols(), true}; }
+template <class E>
+extent shape_of(const vexpr<E>& e) { return shape_of(e.v); }
+template <class Op, class Lhs>
+extent shape_of(const UnaryOp<Op, Lhs>& e) { return shape_of(e.lhs); }
+template <template <class> class Op, class T, class Lhs>
+extent shape_of(const UnaryFunction<Op, T, Lhs>& e) { return shape_of(e.lhs); }
+template <class Op, class Lhs, class Rhs>
+extent shape_of(const BinaryOp<Op, Lhs, Rhs>& e) {
+	extent s = shape_of(e.lhs);
+	return s.known ? s : shape_of(e.rhs);
+}
+
+/* the matrix itself */
+template <typename T>
+struct matrix : public valarray<T> {
+	using value_type = T;
+	/* the elements as stored, with vector's range checked operator[] */
+	using flat = typename valarray<T>::storage;
+	size_t nrows;
+	size_t ncols;
+	storage_order order;
+
+	/* edge length of the tiles at the bottom of the recursive traversal */
+	static const size_t tile = 32;
+
+	matrix() : valarray<T>(), nrows(0), ncols(0), order(row_major) {}
+	matrix(size_t rows, size_t cols, storage_order order = row_major) :
+		valarray<T>(rows * cols), nrows(rows), ncols(cols), order(order) {}
+
+	/* create a matrix from an expression that contains at least one matrix */
+	template <typename U, typename = is_easy_vexpr<U>>
+	matrix(const U& e, storage_order order = row_major) : valarray<T>(), nrows(0), ncols(0), order(order) {
+		this->operator=(e);
+	}
+
+	size_t rows() const { return nrows; }
+	size_t cols() const { return ncols; }
+	size_t index(size_t i, size_t j) const { return (order == row_major) ? i * ncols + j : j * nrows + i; }
+
+	T& operator()(size_t i, size_t j) { return flat::operator[](index(i, j)); }
+	const T& operator()(size_t i, size_t j) const { return flat::operator[](index(i, j)); }
+
+	/* flat access is always in row major order, whatever the storage */
+	T& operator[](size_t k) {
+		return (order == row_major) ? flat::operator[](k) : this->operator()(k / ncols, k % ncols);
+	}
+	const T& operator[](size_t k) const {
+		return (order == row_major) ? flat::operator[](k) : this->operator()(k / ncols, k % ncols);
+	}
+
+	/* lazy views */
+	vexpr<Transposed<T>> transpose() const { return vexpr<Transposed<T>>(Transposed<T>(*this)); }
+	vexpr<Block<T>> block(size_t i, size_t j, size_t h, size_t w) const { return vexpr<Block<T>>(Block<T>(*this, i, j, h, w)); }
+	vexpr<Block<T>> row(size_t i) const { return this->block(i, 0, 1, ncols); }
+	vexpr<Block<T>> col(size_t j) const { return this->block(0, j, nrows, 1); }
+
+	template <template <class> class Func, typename U>
+	UnFun<Func, matrix<T>, U> apply(Func<U> f) {
+		using Op = UnaryFunction<Func, U, matrix<T>>;
+		return vexpr<Op>(Op(f, *this));
+	}
+	auto sqrt() -> decltype(this->apply(unary_sqrt<T>())) { return this->apply(unary_sqrt<T>()); }
+
+	/*
+	 * assign an expression, taking its shape when it has one. Anything that
+	 * reads us out of step (a transpose of ourselves, say) or changes our shape
+	 * is evaluated into a fresh matrix first. An expression with fewer
+	 * elements than the shape (m + v for a short v) is a std::length_error.
+	 */
+	template <typename U, typename = is_easy_vexpr<U>>
+	matrix& operator=(const U& e) {
+		evaluation scope(e);
+		extent s = shape_of(e);
+		size_t r = s.known ? s.rows : nrows;
+		size_t c = s.known ? s.cols : ncols;
+		if (e.len() != SIZE_MAX && e.len() < r * c) {
+			throw std::length_error("expression shorter than the matrix assigned to");
+		}
+		bool self = this->len() != 0 && e.hazard(this->storage(), this->storage() + this->len(), true);
+		if (self || r != nrows || c != ncols) {
+			matrix tmp(r, c, order);
+			tmp.fill(e, 0, r, 0, c);
+			valarray<T>::operator=(static_cast<valarray<T>&&>(tmp));
+		} else {
+			fill(e, 0, r, 0, c);
+		}
+		nrows = r;
+		ncols = c;
+		return *this;
+	}
+
+	/* a matrix product is computed by the blocked kernel straight into our storage */
+	matrix& operator=(const vexpr<MatMul<T>>& e) {
+		size_t r = e.v.rows();
+		size_t c = e.v.cols();
+		bool self = this->len() != 0 && e.hazard(this->storage(), this->storage() + this->len(), true);
+		if (self || r * c != this->len()) {
+			matrix tmp(r, c, order);
+			tmp = e;
+			valarray<T>::operator=(static_cast<valarray<T>&&>(tmp));
+		} else if (r * c != 0) {
+			bool rows = (order == row_major);
+			e.v.materialize(this->storage(), rows ? c : 1, rows ? 1 : r);
+		}
+		nrows = r;
+		ncols = c;
+		return *this;
+	}
+
+	T* storage() { return &flat::operator[](0); }
+	const T* storage() const { return &flat::operator[](0); }
+
+private:
+	/* cache-oblivious: halve the longer side until the tile fits */
+	template <typename U>
+	void fill(const U& e, size_t i0, size_t i1, size_t j0, size_t j1) {
+		if (i1 - i0 <= tile && j1 - j0 <= tile) {
+			if (i1 == i0 || j1 == j0) {
+				return;
+			}
+			T* p = this->storage();
+			for (size_t i = i0; i < i1; i++) {
+				for (size_t j = j0; j < j1; j++) {
+					p[index(i, j)] = e[i * ncols + j];
+				}
+			}
+			return;
+		}
+		if (i1 - i0 >= j1 - j0) {
+			size_t mid = i0 + (i1 - i0) / 2;
+			fill(e, i0, mid, j0, j1);
+			fill(e, mid, i1, j0, j1);
+		} else {
+			size_t mid = j0 + (j1 - j0) / 2;
+			fill(e, i0, i1, j0, mid);
+			fill(e, i0, i1, mid, j1);
+		}
+	}
+};
+
+/* m.transpose(), logical (i, j) reads m(j, i) */
+template <typename T>
+struct Transposed {
+	using value_type = T;
+	const matrix<T>& m;
+	Transposed(const matrix<T>& m) : m(m) {}
+	T operator[](size_t k) const { return m(k % m.nrows, k / m.nrows); }
+	size_t rows() const { return m.ncols; }
+	size_t cols() const { return m.nrows; }
+	size_t len() const { return m.len(); }
+	size_t size() const { return this->len(); }
+	bool hazard(const void* lo, const void* hi, bool elementwise) const { return m.hazard(lo, hi, false); }
+	bool same(const Transposed& that) const { return &m == &that.m; }
+};
+
+/* a h x w window of m starting at (i, j), also used for rows and columns */
+template <typename T>
+struct Block {
+	using value_type = T;
+	const matrix<T>& m;
+	size_t i;
+	size_t j;
+	size_t h;
+	size_t w;
+	Block(const matrix<T>& m, size_t i, size_t j, size_t h, size_t w) : m(m), i(i), j(j), h(h), w(w) {
+		if (i + h > m.nrows || j + w > m.ncols) { throw std::out_of_range("block out of range"); }
+	}
+	T operator[](size_t k) const { return m(i + k / w, j + k % w); }
+	size_t rows() const { return h; }
+	size_t cols() const { return w; }
+	size_t len() const { return h * w; }
+	size_t size() const { return this->len(); }
+	bool hazard(const void* lo, const void* hi, bool elementwise) const { return m.hazard(lo, hi, false); }
+	bool same(const Block& that) const { return &m == &that.m && i == that.i && j == that.j && h == that.h && w == that.w; }
+};
+
+/*
+ * packed, register blocked matrix product (the usual Goto/BLIS loop nest)
+ * C = A * B, every operand addressed through a row and a column stride.
+ * B is packed KC x NC at a time into NR wide slivers (sized for L3), A is
+ * packed MC x KC at a time into MR tall slivers (sized for L2), and the
+ * micro-kernel keeps an MR x NR block of C in registers for the whole KC loop.
+ * The inner loops are written so the compiler can vectorize them (-O3, with
+ * -mavx2 -mfma for AVX2), NR is one cache line of T.
+ */
+template <typename T>
+struct strided {
+	T* p;
+	size_t rs;
+	size_t cs;
+	T& operator()(size_t i, size_t j) const { return p[i * rs + j * cs]; }
+};
+
+template <typename T>
+struct gemm_kernel {
+	static const size_t MR = 6;
+	static const size_t NR = (sizeof(T) >= 64) ? 1 : 64 / sizeof(T);
+	static const size_t KC = 256;
+	static const size_t MC = ((128 * 1024) / (KC * sizeof(T)) / MR < 1) ? MR : (128 * 1024) / (KC * sizeof(T)) / MR * MR;
+	static const size_t NC = 4096 / NR * NR;
+
+	/* MR tall slivers of A(ic:ic+mc, pc:pc+kc), zero padded */
+	static void pack_a(strided<const T> a, size_t ic, size_t mc, size_t pc, size_t kc, T* out) {
+		for (size_t ir = 0; ir < mc; ir += MR) {
+			for (size_t p = 0; p < kc; p++) {
+				for (size_t i = 0; i < MR; i++) {
+					*out++ = (ir + i < mc) ? a(ic + ir + i, pc + p) : T();
+				}
+			}
+		}
+	}
+
+	/* NR wide slivers of B(pc:pc+kc, jc:jc+nc), zero padded */
+	static void pack_b(strided<const T> b, size_t pc, size_t kc, size_t jc, size_t nc, T* out) {
+		for (size_t jr = 0; jr < nc; jr += NR) {
+			for (size_t p = 0; p < kc; p++) {
+				for (size_t j = 0; j < NR; j++) {
+					*out++ = (jr + j < nc) ? b(pc + p, jc + jr + j) : T();
+				}
+			}
+		}
+	}
+
+	/* C(mr x nr) (+)= sliver a * sliver b */
+	static void micro(size_t kc, const T* a, const T* b, strided<T> c, size_t mr, size_t nr, bool first) {
+		T acc[MR][NR];
+		for (size_t i = 0; i < MR; i++) {
+			for (size_t j = 0; j < NR; j++) {
+				acc[i][j] = T();
+			}
+		}
+		for (size_t p = 0; p < kc; p++) {
+			for (size_t i = 0; i < MR; i++) {
+				T x = a[i];
+				for (size_t j = 0; j < NR; j++) {
+					acc[i][j] += x * b[j];
+				}
+			}
+			a += MR;
+			b += NR;
+		}
+		for (size_t i = 0; i < mr; i++) {
+			for (size_t j = 0; j < nr; j++) {
+				c(i, j) = first ? acc[i][j] : c(i, j) + acc[i][j];
+			}
+		}
+	}
+
+	/* C(m0:m1, n0:n1) = A(m0:m1, :) * B(:, n0:n1), single threaded */
+	static void run(strided<const T> a, strided<const T> b, strided<T> c, size_t k,
+		size_t m0, size_t m1, size_t n0, size_t n1) {
+		if (k == 0) {
+			for (size_t i = m0; i < m1; i++) {
+				for (size_t j = n0; j < n1; j++) {
+					c(i, j) = T();
+				}
+			}
+			return;
+		}
+		size_t nc_max = (n1 - n0 < NC) ? n1 - n0 : NC;
+		size_t kc_max = (k < KC) ? k : KC;
+		buffer<T> ap(MC * kc_max);
+		buffer<T> bp((nc_max + NR - 1) / NR * NR * kc_max);
+		for (size_t x = 0; x < MC * kc_max; x++) { ap.push_back(T()); }
+		for (size_t x = 0; x < (nc_max + NR - 1) / NR * NR * kc_max; x++) { bp.push_back(T()); }
+
+		for (size_t jc = n0; jc < n1; jc += NC) {
+			size_t nc = (n1 - jc < NC) ? n1 - jc : NC;
+			for (size_t pc = 0; pc < k; pc += KC) {
+				size_t kc = (k - pc < KC) ? k - pc : KC;
+				pack_b(b, pc, kc, jc, nc, bp.data);
+				for (size_t ic = m0; ic < m1; ic += MC) {
+					size_t mc = (m1 - ic < MC) ? m1 - ic : MC;
+					pack_a(a, ic, mc, pc, kc, ap.data);
+					for (size_t jr = 0; jr < nc; jr += NR) {
+						for (size_t ir = 0; ir < mc; ir += MR) {
+							strided<T> cc{&c(ic + ir, jc + jr), c.rs, c.cs};
+							micro(kc, ap.data + ir * kc, bp.data + jr * kc, cc,
+								(mc - ir < MR) ? mc - ir : MR, (nc - jr < NR) ? nc - jr : NR, pc == 0);
+						}
+					}
+				}
+			}
+		}
+	}
+};
+
+/*
+ * C = A * B across threads, C is cut into a grid of tm x tn independent
+ * blocks (roughly square, so both the M and N dimensions are shared out)
+ */
+template <typename T>
+void gemm(size_t m, size_t n, size_t k, strided<const T> a, strided<const T> b, strided<T> c) {
+	using G = gemm_kernel<T>;
+	size_t p = pieces(m * n, 128 * 128);
+	size_t tm = static_cast<size_t>(std::sqrt(double(p) * m / (n == 0 ? 1 : n)) + 0.5);
+	if (tm < 1) { tm = 1; }
+	if (tm > p) { tm = p; }
+	size_t tn = p / tm;
+	parallel_for(tm * tn, tm * tn, [&](size_t piece, size_t lo, size_t hi) {
+		for (size_t t = lo; t < hi; t++) {
+			size_t i = t / tn;
+			size_t j = t % tn;
+			G::run(a, b, c, k, m * i / tm / G::MR * G::MR, (i + 1 == tm) ? m : m * (i + 1) / tm / G::MR * G::MR,
+				n * j / tn, n * (j + 1) / tn);
+		}
+	});
+}
+
+/* matmul(a, b), the lazy matrix product */
+template <typename T>
+struct MatMul {
+	using value_type = T;
+	const matrix<T>& a;
+	const matrix<T>& b;
+	MatMul(const matrix<T>& a, const matrix<T>& b) : a(a), b(b) {
+		if (a.cols() != b.rows()) { throw std::invalid_argument("matmul: inner dimensions differ"); }
+	}
+
+	/* one element on its own is just a dot product */
+	T operator[](size_t k) const {
+		size_t i = k / b.cols();
+		size_t j = k % b.cols();
+		T acc = T();
+		for (size_t p = 0; p < a.cols(); p++) {
+			acc += a(i, p) * b(p, j);
+		}
+		return acc;
+	}
+	size_t rows() const { return a.rows(); }
+	size_t cols() const { return b.cols(); }
+	size_t len() const { return this->rows() * this->cols(); }
+	size_t size() const { return this->len(); }
+	bool hazard(const void* lo, const void* hi, bool elementwise) const {
+		return a.hazard(lo, hi, false) || b.hazard(lo, hi, false);
+	}
+	bool same(const MatMul& that) const { return &a == &that.a && &b == &that.b; }
+
+	/* the whole product, written to out with the given strides (row major by default) */
+	void materialize(T* out) const { this->materialize(out, this->cols(), 1); }
+	void materialize(T* out, size_t rs, size_t cs) const {
+		if (this->len() == 0) {
+			return;
+		}
+		strided<const T> sa{a.len() ? a.storage() : nullptr, a.order == row_major ? a.cols() : 1, a.order == row_major ? 1 : a.rows()};
+		strided<const T> sb{b.len() ? b.storage() : nullptr, b.order == row_major ? b.cols() : 1, b.order == row_major ? 1 : b.rows()};
+		gemm(this->rows(), this->cols(), a.cols(), sa, sb, strided<T>{out, rs, cs});
+	}
+};
+
+template <typename T>
+vexpr<MatMul<T>> matmul(const matrix<T>& a, const matrix<T>& b) { return vexpr<MatMul<T>>(MatMul<T>(a, b)); }
+
+}
+
+#endif /* _Matrix_h */
@@ -0,0 +1,190 @@
+// Parallel.h
+
+/*
+ * the little bit of threading the numeric kernels share. Work is split
+ * into contiguous ranges, one per hardware thread, and small problems never
+ * leave the calling thread.
+ */
+
+#ifndef _Parallel_h
+#define _Parallel_h
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "Vector.h"
+
+namespace epl {
+
+/* how many threads the kernels may use (at least one) */
+inline size_t hardware_threads() {
+	static const size_t n = std::thread::hardware_concurrency();
+	return (n == 0) ? 1 : n;
+}
+
+/* how many pieces to cut n items into, so that each piece has at least grain items */
+inline size_t pieces(size_t n, size_t grain) {
+	size_t p = hardware_threads();
+	size_t most = (grain == 0) ? n : n / grain;
+	if (most < p) { p = most; }
+	return (p == 0) ? 1 : p;
+}
+
+/*
+ * how many evaluations on the calling thread read something that must stay
+ * on it (the cursors of Chunked.h). While there are any, parallel_for runs
+ * the pieces on the calling thread.
+ */
+inline size_t& thread_pinned() {
+	static thread_local size_t n = 0;
+	return n;
+}
+
+/*
+ * an expression that has to be read on one thread says so through hazard:
+ * it claims to read this address, which no array has
+ */
+inline const char* pinned_address() {
+	static const char at = 0;
+	return &at;
+}
+
+/* and one with nodes that keep work for the length of an evaluation (see evaluation_frame) claims this one */
+inline const char* keeping_address() {
+	static const char at = 0;
+	return &at;
+}
+
+template <class E>
+bool claims(const E& e, const char* at) { return e.hazard(at, at + 1, false); }
+
+/* a number no other caller gets (never 0) */
+inline uint64_t unique_key() {
+	static std::atomic<uint64_t> last{0};
+	return ++last;
+}
+
+/* keep is rare (once per node and thread), all frames can share one lock */
+inline std::mutex& keep_lock() {
+	static std::mutex lock;
+	return lock;
+}
+
+/*
+ * what the pieces of one outermost evaluation share (see evaluation below):
+ * what lazy nodes keep for its length, and a number that is never used
+ * again (0 until the first keep). Every thread has one, used while it runs
+ * an outermost evaluation. Nothing in it needs constructing, so getting at
+ * it costs no more than at thread_pinned.
+ */
+class evaluation_frame {
+	using kept_type = vector<std::pair<uint64_t, std::shared_ptr<void>>>;
+	/* made on the first keep, most evaluations have nothing to keep */
+	kept_type* kept = nullptr;
+	friend class evaluation;
+public:
+	std::atomic<uint64_t> serial{0};
+
+	/* the M kept under key (a default M the first time), from any piece of the evaluation */
+	template <class M>
+	M& keep(uint64_t key) {
+		std::lock_guard<std::mutex> hold(keep_lock());
+		if (kept == nullptr) {
+			kept = new kept_type();
+			serial = unique_key();
+		}
+		kept_type& all = *kept;
+		for (uint64_t k = 0; k < all.size(); k++) {
+			if (all[k].first == key) { return *static_cast<M*>(all[k].second.get()); }
+		}
+		std::shared_ptr<M> m = std::make_shared<M>();
+		all.push_back(std::make_pair(key, std::shared_ptr<void>(m)));
+		return *m;
+	}
+};
+
+inline evaluation_frame& own_frame() {
+	static thread_local evaluation_frame f;
+	return f;
+}
+
+/* the frame the calling thread works in (null outside any evaluation), parallel_for hands it on to the pieces */
+inline evaluation_frame*& current_frame() {
+	static thread_local evaluation_frame* f = nullptr;
+	return f;
+}
+
+/*
+ * one evaluation of an expression (an assignment, a reduction, a
+ * materialize). The calling thread stays pinned while it runs if the
+ * expression has to be read on it, and the outermost one with nodes that
+ * keep work sets up the frame, whatever was kept in it goes when it ends.
+ * Anything else costs two calls to hazard.
+ */
+class evaluation {
+	const bool pin;
+	const bool outermost;
+public:
+	template <class E>
+	explicit evaluation(const E& e) : evaluation(claims(e, pinned_address()), claims(e, keeping_address())) {}
+	/* for callers that know: pinned or not, does anything keep work */
+	evaluation(bool pin, bool keeping) : pin(pin), outermost(keeping && current_frame() == nullptr) {
+		if (pin) { thread_pinned()++; }
+		if (outermost) { current_frame() = &own_frame(); }
+	}
+	evaluation(const evaluation&) = delete;
+	evaluation& operator=(const evaluation&) = delete;
+	~evaluation() {
+		if (outermost) {
+			evaluation_frame& f = *current_frame();
+			if (f.kept != nullptr) {
+				delete f.kept;
+				f.kept = nullptr;
+				f.serial = 0;
+			}
+			current_frame() = nullptr;
+		}
+		if (pin) { thread_pinned()--; }
+	}
+};
+
+/*
+ * call f(piece, lo, hi) for p contiguous pieces of [0, n), the last piece
+ * runs on the calling thread (all of them, one after another, when it is
+ * pinned). exceptions come back out of the futures.
+ */
+template <class F>
+void parallel_for(size_t n, size_t p, F f) {
+	if (p <= 1 || n < 2) {
+		f(0, 0, n);
+		return;
+	}
+	if (thread_pinned() != 0) {
+		for (size_t k = 0; k < p; k++) {
+			f(k, n * k / p, n * (k + 1) / p);
+		}
+		return;
+	}
+	vector<std::future<void>> tasks;
+	evaluation_frame* e = current_frame();
+	for (size_t k = 0; k + 1 < p; k++) {
+		tasks.push_back(std::async(std::launch::async, [e, f](size_t piece, size_t lo, size_t hi) {
+			current_frame() = e;
+			f(piece, lo, hi);
+		}, k, n * k / p, n * (k + 1) / p));
+	}
+	f(p - 1, n * (p - 1) / p, n);
+	for (uint64_t k = 0; k < tasks.size(); k++) {
+		tasks[k].get();
+	}
+}
+
+}
+
+#endif /* _Parallel_h */
@@ -0,0 +1,181 @@
+// Pipeline.h
+
+/*
+ * deferred evaluation of a chain of valarray assignments
+ *
+ *     pipeline p;
+ *     p.assign(t1, a * a);
+ *     p.assign(t2, t1 + b);
+ *     p.assign(out, t2.sqrt());
+ *     p.run();
+ *
+ * runs every stage over one block of indexes before moving on to the next
+ * block, so the intermediates (t1, t2) are still in cache when the next stage
+ * reads them. This is only legal when every stage reads the destinations at
+ * the same index it writes (which is what hazard() tells us), otherwise the
+ * stages are run one after another over the whole range.
+ *
+ * A stage writes as many elements as its expression has (the destination
+ * is only ever grown to that). A stage whose expression computes everything
+ * at once (matmul, scans) is materialized into a temporary when the run
+ * starts and copied out block by block.
+ */
+
+#ifndef _Pipeline_h
+#define _Pipeline_h
+
+#include <memory>
+#include <type_traits>
+
+#include "Parallel.h"
+#include "Valarray.h"
+
+namespace epl {
+
+class pipeline {
+	/* one recorded assignment, type erased */
+	struct stage {
+		virtual ~stage() {}
+		virtual void start() = 0;
+		virtual void run(size_t lo, size_t hi) = 0;
+		virtual void finish() = 0;
+		virtual void evaluate() = 0;
+		virtual bool hazard(const void* lo, const void* hi) const = 0;
+		virtual const void* begin() const = 0;
+		virtual const void* end() const = 0;
+		virtual size_t len() const = 0;
+		virtual size_t width() const = 0;
+	};
+
+	/* U is held like an operand, a valarray by reference (see leaf in Valarray.h) */
+	template <typename T, typename U>
+	struct assignment : stage {
+		valarray<T>& dest;
+		const Leaf<U> expr;
+		const size_t n;
+		/* a bulk expression, materialized for the length of one run */
+		std::unique_ptr<valarray<Element<U>>> whole;
+		assignment(valarray<T>& dest, const U& expr, size_t n) : dest(dest), expr(const_cast<U&>(expr)), n(n) {}
+		T* data() const { return &dest[0]; }
+		void start() { this->start(is_bulk<Leaf<U>>()); }
+		void start(std::false_type) {}
+		void start(std::true_type) {
+			whole.reset(new valarray<Element<U>>(n));
+			if (n != 0) { expr.v.materialize(&(*whole)[0]); }
+		}
+		void run(size_t lo, size_t hi) {
+			T* p = data();
+			if (whole) {
+				const valarray<Element<U>>& w = *whole;
+				for (size_t k = lo; k < hi; k++) {
+					p[k] = w[k];
+				}
+				return;
+			}
+			for (size_t k = lo; k < hi; k++) {
+				p[k] = expr[k];
+			}
+		}
+		void finish() { whole.reset(); }
+		void evaluate() { dest = expr; }
+		bool hazard(const void* lo, const void* hi) const { return expr.hazard(lo, hi, true); }
+		const void* begin() const { return data(); }
+		const void* end() const { return data() + n; }
+		size_t len() const { return n; }
+		size_t width() const { return sizeof(T); }
+	};
+
+	vector<std::unique_ptr<stage>> stages;
+	size_t cache_bytes;
+
+public:
+	/* roughly the size of L2, the working set of one block should fit in it */
+	explicit pipeline(size_t cache_bytes = 256 * 1024) : cache_bytes(cache_bytes) {}
+
+	/* record dest = e, dest is sized now, nothing is evaluated until run() */
+	template <typename T, typename U, typename = is_easy_vexpr<U>>
+	pipeline& assign(valarray<T>& dest, const U& e) {
+		size_t n = (e.len() == SIZE_MAX) ? dest.len() : e.len();
+		while (dest.len() < n) {
+			dest.push_back(T());
+		}
+		stages.push_back(std::unique_ptr<stage>(new assignment<T, U>(dest, e, n)));
+		return *this;
+	}
+
+	size_t size() const { return stages.size(); }
+
+	/* can we run block by block? no stage may read any destination out of step */
+	bool blocked() const {
+		for (uint64_t i = 0; i < stages.size(); i++) {
+			for (uint64_t j = 0; j < stages.size(); j++) {
+				if (stages[j]->len() != 0 && stages[i]->hazard(stages[j]->begin(), stages[j]->end())) {
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	/* number of indexes per block, sized so every destination's slice fits in cache */
+	size_t block() const {
+		size_t width = 0;
+		for (uint64_t k = 0; k < stages.size(); k++) {
+			width += stages[k]->width();
+		}
+		size_t n = (width == 0) ? cache_bytes : cache_bytes / width;
+		return (n == 0) ? 1 : n;
+	}
+
+	void run() {
+		size_t n = 0;
+		for (uint64_t k = 0; k < stages.size(); k++) {
+			if (stages[k]->len() > n) { n = stages[k]->len(); }
+		}
+		if (!this->blocked()) {
+			/* plain assignments, they know how to deal with aliasing */
+			for (uint64_t k = 0; k < stages.size(); k++) {
+				stages[k]->evaluate();
+			}
+			return;
+		}
+		/* one evaluation for the whole run: nothing a stage reads out of step is written during it */
+		bool pin = false, keeping = false;
+		for (uint64_t k = 0; k < stages.size(); k++) {
+			pin = pin || stages[k]->hazard(pinned_address(), pinned_address() + 1);
+			keeping = keeping || stages[k]->hazard(keeping_address(), keeping_address() + 1);
+		}
+		evaluation scope(pin, keeping);
+		for (uint64_t k = 0; k < stages.size(); k++) {
+			stages[k]->start();
+		}
+		size_t b = this->block();
+		for (size_t lo = 0; lo < n; lo += b) {
+			size_t hi = (n - lo < b) ? n : lo + b;
+			for (uint64_t k = 0; k < stages.size(); k++) {
+				run_stage(k, lo, hi);
+			}
+		}
+		for (uint64_t k = 0; k < stages.size(); k++) {
+			stages[k]->finish();
+		}
+	}
+
+	void clear() {
+		while (stages.size() != 0) {
+			stages.pop_back();
+		}
+	}
+
+private:
+	void run_stage(uint64_t k, size_t lo, size_t hi) {
+		size_t n = stages[k]->len();
+		if (lo < n) {
+			stages[k]->run(lo, (hi < n) ? hi : n);
+		}
+	}
+};
+
+}
+
+#endif /* _Pipeline_h */
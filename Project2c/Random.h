@@ -0,0 +1,227 @@
+// Random.h
+
+/*
+ * random numbers as expressions
+ *
+ *     valarray<double> u = uniform(n, seed);                    // [0, 1)
+ *     valarray<double> x = 2.0 * uniform(n, seed, 1) - 1.0;     // [-1, 1), another stream
+ *     valarray<float> z = mu + sigma * normal<float>(n, seed);
+ *     double m = std::get<0>(reduce(exp(normal(n, seed)), reducers::mean));
+ *
+ * Element k is a pure function of (seed, stream, k): it comes from
+ * Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2,
+ * 3") run on the counter (k / 2, stream) with the seed as its key. There is
+ * no generator state to carry from one element to the next, so the nodes
+ * are lazy and read in any order, the same seed and stream give the same
+ * numbers whichever thread computes them and however the work is split, and
+ * different streams (or seeds) are independent. Assigning a bare uniform or normal fills the
+ * destination across threads, 64 counters at a time, so the rounds are
+ * straight line integer loops the compiler can vectorize.
+ *
+ * Each block of four words makes two elements: uniform takes 53 bits (24
+ * for float) from each pair of words, normal makes two uniforms of them and
+ * uses both Box-Muller outputs. Only float and double are drawn (long double
+ * would need more than two words per element).
+ */
+
+#ifndef _Random_h
+#define _Random_h
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#include "Parallel.h"
+#include "Transcendental.h"
+#include "Valarray.h"
+
+namespace epl {
+
+/* the four output words of Philox4x32-10 */
+struct philox_block {
+	uint32_t w[4];
+};
+
+inline philox_block philox4x32(uint32_t c0, uint32_t c1, uint32_t c2, uint32_t c3, uint32_t k0, uint32_t k1) {
+	const uint64_t m0 = 0xD2511F53u, m1 = 0xCD9E8D57u;
+	for (int round = 0; round < 10; round++) {
+		uint64_t p0 = m0 * c0;
+		uint64_t p1 = m1 * c2;
+		uint32_t hi0 = static_cast<uint32_t>(p0 >> 32), lo0 = static_cast<uint32_t>(p0);
+		uint32_t hi1 = static_cast<uint32_t>(p1 >> 32), lo1 = static_cast<uint32_t>(p1);
+		c0 = hi1 ^ c1 ^ k0;
+		c1 = lo1;
+		c2 = hi0 ^ c3 ^ k1;
+		c3 = lo0;
+		k0 += 0x9E3779B9u;
+		k1 += 0xBB67AE85u;
+	}
+	return philox_block{{c0, c1, c2, c3}};
+}
+
+/* the block for counter k of (seed, stream) */
+inline philox_block philox_at(uint64_t seed, uint64_t stream, uint64_t k) {
+	return philox4x32(static_cast<uint32_t>(k), static_cast<uint32_t>(k >> 32),
+		static_cast<uint32_t>(stream), static_cast<uint32_t>(stream >> 32),
+		static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32));
+}
+
+/*
+ * the same for up to width consecutive counters at once, kept as one array
+ * per word so that each round is a loop over independent lanes (32 x 32 -> 64
+ * bit products, which every vector unit has)
+ */
+struct philox_lanes {
+	static const size_t width = 64;
+	uint32_t w[4][width];
+
+	void run(uint64_t seed, uint64_t stream, uint64_t first, size_t m) {
+		uint32_t* c0 = w[0];
+		uint32_t* c1 = w[1];
+		uint32_t* c2 = w[2];
+		uint32_t* c3 = w[3];
+		for (size_t j = 0; j < m; j++) {
+			c0[j] = static_cast<uint32_t>(first + j);
+			c1[j] = static_cast<uint32_t>((first + j) >> 32);
+			c2[j] = static_cast<uint32_t>(stream);
+			c3[j] = static_cast<uint32_t>(stream >> 32);
+		}
+		uint32_t k0 = static_cast<uint32_t>(seed), k1 = static_cast<uint32_t>(seed >> 32);
+		for (int round = 0; round < 10; round++) {
+			for (size_t j = 0; j < m; j++) {
+				uint64_t p0 = uint64_t(0xD2511F53u) * c0[j];
+				uint64_t p1 = uint64_t(0xCD9E8D57u) * c2[j];
+				uint32_t n0 = static_cast<uint32_t>(p1 >> 32) ^ c1[j] ^ k0;
+				uint32_t n2 = static_cast<uint32_t>(p0 >> 32) ^ c3[j] ^ k1;
+				c1[j] = static_cast<uint32_t>(p1);
+				c3[j] = static_cast<uint32_t>(p0);
+				c0[j] = n0;
+				c2[j] = n2;
+			}
+			k0 += 0x9E3779B9u;
+			k1 += 0xBB67AE85u;
+		}
+	}
+};
+
+/* [0, 1) from the high bits of one or two words */
+template <class T>
+T unit_interval(uint32_t a, uint32_t b);
+template <>
+inline double unit_interval<double>(uint32_t a, uint32_t b) {
+	return ((a >> 5) * 67108864.0 + (b >> 6)) * (1.0 / 9007199254740992.0);
+}
+template <>
+inline float unit_interval<float>(uint32_t a, uint32_t b) {
+	return (a >> 8) * (1.0f / 16777216.0f);
+}
+
+/*
+ * what the nodes share: length, seed, stream, and filling an array across
+ * threads. Counter j gives elements 2j and 2j + 1, Draw::pair turns its
+ * four words into the two.
+ */
+template <class T, class Draw>
+struct RandomSource {
+	using value_type = T;
+	size_t n;
+	uint64_t seed;
+	uint64_t stream;
+	static const size_t grain = 16 * 1024;
+
+	RandomSource(size_t n, uint64_t seed, uint64_t stream) : n(n), seed(seed), stream(stream) {}
+	T operator[](size_t k) const {
+		philox_block b = philox_at(seed, stream, k >> 1);
+		T even, odd;
+		Draw::pair(b.w[0], b.w[1], b.w[2], b.w[3], even, odd);
+		return (k & 1) ? odd : even;
+	}
+	size_t len() const { return n; }
+	size_t size() const { return n; }
+	bool hazard(const void* lo, const void* hi, bool elementwise) const { return false; }
+	/* a pure function of its parameters, the same parameters are the same numbers */
+	bool same(const RandomSource& that) const { return n == that.n && seed == that.seed && stream == that.stream; }
+
+	void materialize(T* out) const {
+		parallel_for(n, pieces(n, grain), [&](size_t piece, size_t lo, size_t hi) { this->fill(out, lo, hi); });
+	}
+
+	/* elements [lo, hi), a block of counters at a time */
+	void fill(T* out, size_t lo, size_t hi) const {
+		const size_t width = philox_lanes::width;
+		philox_lanes p;
+		T even[width], odd[width];
+		size_t last = (hi + 1) >> 1;
+		for (size_t first = lo >> 1; first < last; first += width) {
+			size_t m = (last - first < width) ? last - first : width;
+			p.run(seed, stream, first, m);
+			for (size_t j = 0; j < m; j++) {
+				Draw::pair(p.w[0][j], p.w[1][j], p.w[2][j], p.w[3][j], even[j], odd[j]);
+			}
+			for (size_t j = 0; j < m; j++) {
+				size_t k = 2 * (first + j);
+				if (k >= lo) { out[k] = even[j]; }
+				if (k + 1 < hi) { out[k + 1] = odd[j]; }
+			}
+		}
+	}
+};
+
+/* two uniforms per counter, from words 0 and 1 and from words 2 and 3 */
+template <class T>
+struct uniform_draw {
+	static void pair(uint32_t w0, uint32_t w1, uint32_t w2, uint32_t w3, T& even, T& odd) {
+		even = unit_interval<T>(w0, w1);
+		odd = unit_interval<T>(w2, w3);
+	}
+};
+
+/*
+ * Box-Muller: counter j gives radius sqrt(-2 log u1) and angle 2 pi u2,
+ * element 2j is the cosine side and 2j + 1 the sine side (1 - u1 keeps the
+ * logarithm away from zero). log, sin and cos are the fast kernels from
+ * Transcendental.h (relative error below 1e-8), which vectorize.
+ */
+template <class T>
+struct normal_draw {
+	static void pair(uint32_t w0, uint32_t w1, uint32_t w2, uint32_t w3, T& even, T& odd) {
+		const double two_pi = 6.283185307179586476925;
+		double u1 = 1.0 - unit_interval<double>(w0, w1);
+		double u2 = unit_interval<double>(w2, w3);
+		double r = std::sqrt(-2.0 * kernel::log(u1));
+		int64_t q;
+		double x = kernel::reduce(two_pi * u2, q);
+		double sin_x = kernel::sin_poly(x);
+		double cos_x = kernel::cos_poly(x);
+		double sn = (q & 1) ? cos_x : sin_x;
+		double cs = (q & 1) ? -sin_x : cos_x;
+		even = static_cast<T>(r * ((q & 2) ? -cs : cs));
+		odd = static_cast<T>(r * ((q & 2) ? -sn : sn));
+	}
+};
+
+template <class T>
+using Uniform = RandomSource<T, uniform_draw<T>>;
+template <class T>
+using Normal = RandomSource<T, normal_draw<T>>;
+
+/* the types unit_interval is there for */
+template <class T>
+using random_real = std::integral_constant<bool, std::is_same<T, float>::value || std::is_same<T, double>::value>;
+
+template <class T = double>
+typename std::enable_if<random_real<T>::value, vexpr<Uniform<T>>>::type
+uniform(size_t n, uint64_t seed, uint64_t stream = 0) {
+	return vexpr<Uniform<T>>(Uniform<T>(n, seed, stream));
+}
+
+template <class T = double>
+typename std::enable_if<random_real<T>::value, vexpr<Normal<T>>>::type
+normal(size_t n, uint64_t seed, uint64_t stream = 0) {
+	return vexpr<Normal<T>>(Normal<T>(n, seed, stream));
+}
+
+}
+
+#endif /* _Random_h */
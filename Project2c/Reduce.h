@@ -0,0 +1,253 @@
+// Reduce.h
+
+/*
+ * several reductions of one expression in a single pass
+ *
+ *     using namespace epl::reducers;
+ *     double s, lo, hi, ss;
+ *     std::tie(s, lo, hi, ss) = reduce(a * b, sum, min, max, sum_sq);
+ *     double exact = std::get<0>(reduce(x, reducers::kahan_sum));
+ *
+ * every element of the expression is evaluated once and handed to each
+ * accumulator, the results come back as a tuple in the order asked for.
+ * The accumulator tags live in epl::reducers, so that with using
+ * directives for both std and epl min and max are not ambiguous.
+ *
+ * An accumulator is a tag with a nested acc<T> that has add(x), merge(that)
+ * and result(). The range is split over threads (parallel_for, like the
+ * scans), each thread walks its piece in blocks of 1024 and inside a block
+ * feeds four copies of the accumulators round robin, so there are four
+ * independent dependency chains for the compiler to keep in registers or
+ * vector lanes. The copies are merged at the end of every block and the
+ * blocks into the thread's total, the threads' totals in order at the end.
+ *
+ *     sum, sum_sq      plain sums (of x and of x * x)
+ *     kahan_sum        compensated sum, the error does not grow with n
+ *     pairwise_sum     sums of blocks combined pairwise, error O(log n)
+ *     min, max         NaNs are skipped, an empty range gives +inf / -inf
+ *                      (numeric_limits max / lowest for integers)
+ */
+
+#ifndef _Reduce_h
+#define _Reduce_h
+
+#include <cstddef>
+#include <limits>
+#include <tuple>
+#include <type_traits>
+
+#include "Parallel.h"
+#include "Valarray.h"
+
+namespace epl {
+
+template <class T>
+T highest() { return std::numeric_limits<T>::has_infinity ? std::numeric_limits<T>::infinity() : std::numeric_limits<T>::max(); }
+template <class T>
+T lowest() { return std::numeric_limits<T>::has_infinity ? -std::numeric_limits<T>::infinity() : std::numeric_limits<T>::lowest(); }
+
+struct summation {
+	template <class T>
+	struct acc {
+		using result_type = T;
+		T s = T();
+		void add(const T& x) { s = s + x; }
+		void merge(const acc& that) { s = s + that.s; }
+		result_type result() const { return s; }
+	};
+};
+
+struct sum_of_squares {
+	template <class T>
+	struct acc {
+		using result_type = T;
+		T s = T();
+		void add(const T& x) { s = s + x * x; }
+		void merge(const acc& that) { s = s + that.s; }
+		result_type result() const { return s; }
+	};
+};
+
+/* s - c is the sum so far, c the low order bits that did not make it into s */
+struct kahan_summation {
+	template <class T>
+	struct acc {
+		using result_type = T;
+		T s = T();
+		T c = T();
+		void add(const T& x) {
+			T y = x - c;
+			T t = s + y;
+			c = (t - s) - y;
+			s = t;
+		}
+		void merge(const acc& that) {
+			this->add(that.s);
+			this->add(-that.c);
+		}
+		result_type result() const { return s - c; }
+	};
+};
+
+/*
+ * elements go into a plain running sum, merged sums (blocks, lanes, threads)
+ * into a binary counter: level[l] holds a sum of 2^l merged sums and is only
+ * live while bit l of count is set, so adding one carries like an increment.
+ */
+struct pairwise_summation {
+	template <class T>
+	struct acc {
+		using result_type = T;
+		T s = T();
+		T level[64];
+		size_t count = 0;
+		void add(const T& x) { s = s + x; }
+		void merge(const acc& that) {
+			T v = that.result();
+			size_t m = count++;
+			size_t l = 0;
+			for (; (m & 1) != 0; m >>= 1, l++) {
+				v = level[l] + v;
+			}
+			level[l] = v;
+		}
+		result_type result() const {
+			T r = s;
+			for (size_t l = 0; (count >> l) != 0; l++) {
+				if (((count >> l) & 1) != 0) { r = level[l] + r; }
+			}
+			return r;
+		}
+	};
+};
+
+/* the comparisons are written so a NaN never replaces what we have */
+struct minimum {
+	template <class T>
+	struct acc {
+		using result_type = T;
+		T m = highest<T>();
+		void add(const T& x) { m = (x < m) ? x : m; }
+		void merge(const acc& that) { this->add(that.m); }
+		result_type result() const { return m; }
+	};
+};
+
+struct maximum {
+	template <class T>
+	struct acc {
+		using result_type = T;
+		T m = lowest<T>();
+		void add(const T& x) { m = (m < x) ? x : m; }
+		void merge(const acc& that) { this->add(that.m); }
+		result_type result() const { return m; }
+	};
+};
+
+namespace reducers {
+const summation sum{};
+const sum_of_squares sum_sq{};
+const kahan_summation kahan_sum{};
+const pairwise_summation pairwise_sum{};
+const minimum min{};
+const maximum max{};
+}
+
+template <class A, class T>
+using Accumulator = typename A::template acc<T>;
+template <class A, class T>
+using AccResult = typename Accumulator<A, T>::result_type;
+
+/* one state per accumulator, all fed the same elements */
+template <class T, class... A>
+struct accumulators {
+	void add(const T& x) {}
+	void merge(const accumulators& that) {}
+	std::tuple<> results() const { return std::tuple<>(); }
+};
+template <class T, class A, class... R>
+struct accumulators<T, A, R...> {
+	Accumulator<A, T> head;
+	accumulators<T, R...> tail;
+	void add(const T& x) {
+		head.add(x);
+		tail.add(x);
+	}
+	void merge(const accumulators& that) {
+		head.merge(that.head);
+		tail.merge(that.tail);
+	}
+	std::tuple<AccResult<A, T>, AccResult<R, T>...> results() const {
+		return std::tuple_cat(std::make_tuple(head.result()), tail.results());
+	}
+};
+
+/* feed src[lo, hi) into total, see the top of the file */
+template <class S, class P>
+void reduce_range(const S& src, P& total, size_t lo, size_t hi) {
+	const size_t block = 1024;
+	for (size_t b = lo; b < hi; b += block) {
+		size_t end = (hi - b < block) ? hi : b + block;
+		P l0, l1, l2, l3;
+		size_t k = b;
+		for (; k + 4 <= end; k += 4) {
+			l0.add(src[k]);
+			l1.add(src[k + 1]);
+			l2.add(src[k + 2]);
+			l3.add(src[k + 3]);
+		}
+		for (; k < end; k++) {
+			l0.add(src[k]);
+		}
+		l0.merge(l1);
+		l2.merge(l3);
+		l0.merge(l2);
+		total.merge(l0);
+	}
+}
+
+template <class S, class P>
+void reduce_all(const S& src, P& total, size_t n) {
+	const size_t grain = 64 * 1024;
+	size_t p = pieces(n, grain);
+	if (p <= 1) {
+		reduce_range(src, total, 0, n);
+		return;
+	}
+	vector<P> part(p);
+	P* parts = &part[0];
+	parallel_for(n, p, [&](size_t piece, size_t lo, size_t hi) { reduce_range(src, parts[piece], lo, hi); });
+	for (size_t k = 0; k < p; k++) {
+		total.merge(parts[k]);
+	}
+}
+
+/* element by element, or all at once for nodes like matmul and the scans */
+template <class E, class P>
+void reduce_into(const E& e, P& total, std::false_type) {
+	reduce_all(source(e), total, e.len());
+}
+template <class E, class P>
+void reduce_into(const E& e, P& total, std::true_type) {
+	valarray<Element<E>> tmp(e.len());
+	e.v.materialize(&tmp[0]);
+	reduce_all(source(tmp), total, e.len());
+}
+
+template <class E, class... A>
+using Reduction = typename std::enable_if<is_vexpr<E>::value && sizeof...(A) != 0,
+	std::tuple<AccResult<A, Element<E>>...>>::type;
+
+template <class E, class... A>
+Reduction<E, A...> reduce(const E& e, const A&...) {
+	accumulators<Element<E>, A...> total;
+	evaluation scope(e);
+	if (e.len() != 0) {
+		reduce_into(e, total, is_bulk<E>());
+	}
+	return total.results();
+}
+
+}
+
+#endif /* _Reduce_h */
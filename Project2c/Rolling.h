@@ -0,0 +1,227 @@
+// Rolling.h
+
+/*
+ * moving windows over expressions
+ *
+ *     valarray<double> s = rolling_sum(x, 20);             // s[i] = x[i] + ... + x[i + 19]
+ *     valarray<double> m = rolling_mean(price * volume, 20);
+ *     valarray<double> lo = rolling_min(x, 250), hi = rolling_max(x, 250);
+ *
+ * Element i covers the w elements e[i] .. e[i + w - 1], only whole windows
+ * are produced: the result has n - w + 1 elements (none when n < w, a
+ * window of 0 is a std::domain_error). The results are lazy nodes, one
+ * element on its own is computed from its window (O(w)), and assigning
+ * the node goes through materialize(), which is O(n) whatever w is. The
+ * operand is evaluated once (valarrays and views are read in place).
+ *
+ * rolling_sum and rolling_mean slide one running sum along: the element
+ * entering is added and the one leaving subtracted, both through a
+ * compensated (Neumaier) sum, so the rounding errors do not pile up over
+ * millions of steps. A NaN or an infinity cannot be subtracted out again,
+ * while the running sum is not finite it is recomputed from the window.
+ * The mean of integers is a double.
+ *
+ * rolling_min and rolling_max keep a monotonic deque of the positions that
+ * can still become the extreme of a later window (each one is pushed and
+ * popped at most once), in a ring of w slots. NaNs are skipped like in
+ * reduce, a window with nothing but NaNs gives +inf / -inf.
+ *
+ * The output is cut into one piece per thread (parallel_for), every piece
+ * starts from its own first window, so neighbouring pieces overlap by w - 1
+ * input elements. Pieces are at least 4 w long to keep that overlap small.
+ */
+
+#ifndef _Rolling_h
+#define _Rolling_h
+
+#include <cstddef>
+#include <stdexcept>
+#include <type_traits>
+
+#include "Parallel.h"
+#include "Reduce.h"
+#include "Valarray.h"
+#include "View.h"
+
+namespace epl {
+
+/* s + c is the sum, c collects what each addition rounded away */
+template <class R>
+struct neumaier {
+	R s = R();
+	R c = R();
+	void add(const R& x) {
+		R t = s + x;
+		bool bigger = ((s < R()) ? -s : s) >= ((x < R()) ? -x : x);
+		c += bigger ? (s - t) + x : (x - t) + s;
+		s = t;
+	}
+	R result() const { return s + c; }
+	/* false for infinities and NaN (and never for integers) */
+	bool finite() const { return s - s == R(); }
+};
+
+/* sums, and means when divided by w */
+template <class R>
+struct window_sum {
+	template <class S>
+	static R one(const S& src, size_t i, size_t w) {
+		neumaier<R> acc;
+		for (size_t j = i; j < i + w; j++) {
+			acc.add(static_cast<R>(src[j]));
+		}
+		return acc.result();
+	}
+	template <class S, class T>
+	static void run(const S& src, T* out, size_t lo, size_t hi, size_t w, const R& divisor) {
+		neumaier<R> acc;
+		for (size_t j = lo; j + 1 < lo + w; j++) {
+			acc.add(static_cast<R>(src[j]));
+		}
+		for (size_t i = lo; i < hi; i++) {
+			acc.add(static_cast<R>(src[i + w - 1]));
+			out[i] = static_cast<T>(acc.result() / divisor);
+			if (acc.finite()) {
+				acc.add(-static_cast<R>(src[i]));
+				continue;
+			}
+			/* start again from the next window, less its newest element */
+			acc = neumaier<R>();
+			for (size_t j = i + 1; j < i + w; j++) {
+				acc.add(static_cast<R>(src[j]));
+			}
+		}
+	}
+};
+
+/* the extreme where better(a, b) means a wins over b */
+template <class T, class S, class Better>
+T window_extreme_one(const S& src, size_t i, size_t w, const T& none, Better better) {
+	T m = none;
+	for (size_t j = i; j < i + w; j++) {
+		T x = src[j];
+		m = better(x, m) ? x : m;
+	}
+	return m;
+}
+
+/* see the top of the file: ring[head] .. is the deque, best first */
+template <class T, class S, class Better>
+void window_extreme(const S& src, T* out, size_t lo, size_t hi, size_t w, const T& none, Better better) {
+	vector<size_t> slots(w);
+	size_t* ring = &slots[0];
+	size_t head = 0, count = 0;
+	for (size_t j = lo; j + 1 < hi + w; j++) {
+		if (count != 0 && ring[head] + w <= j) {
+			head = (head + 1 == w) ? 0 : head + 1;
+			count--;
+		}
+		T x = src[j];
+		if (x == x) {
+			while (count != 0) {
+				size_t back = head + count - 1;
+				back = (back >= w) ? back - w : back;
+				if (better(T(src[ring[back]]), x)) { break; }
+				count--;
+			}
+			size_t end = head + count;
+			ring[(end >= w) ? end - w : end] = j;
+			count++;
+		}
+		if (j + 1 >= lo + w) {
+			out[j + 1 - w] = (count != 0) ? T(src[ring[head]]) : none;
+		}
+	}
+}
+
+template <class T>
+struct window_min {
+	static bool better(const T& a, const T& b) { return a < b; }
+	template <class S>
+	static T one(const S& src, size_t i, size_t w) { return window_extreme_one(src, i, w, highest<T>(), better); }
+	template <class S>
+	static void run(const S& src, T* out, size_t lo, size_t hi, size_t w, const T&) {
+		window_extreme(src, out, lo, hi, w, highest<T>(), better);
+	}
+};
+
+template <class T>
+struct window_max {
+	static bool better(const T& a, const T& b) { return b < a; }
+	template <class S>
+	static T one(const S& src, size_t i, size_t w) { return window_extreme_one(src, i, w, lowest<T>(), better); }
+	template <class S>
+	static void run(const S& src, T* out, size_t lo, size_t hi, size_t w, const T&) {
+		window_extreme(src, out, lo, hi, w, lowest<T>(), better);
+	}
+};
+
+/* a rolling K over windows of w with results of type T, a mean divides the sums by w */
+template <class E, class K, class T, bool mean = false>
+struct Rolling {
+	using value_type = T;
+	const Ref<E> e;
+	const size_t w;
+	static const size_t grain = 64 * 1024;
+
+	Rolling(const E& e, size_t w) : e(const_cast<E&>(e)), w(w) {
+		if (w == 0) { throw std::domain_error("rolling window of 0 elements"); }
+	}
+
+	value_type operator[](size_t i) const { return this->finish(K::one(e, i, w)); }
+	size_t len() const { return (e.len() < w) ? 0 : e.len() - w + 1; }
+	size_t size() const { return this->len(); }
+	bool hazard(const void* lo, const void* hi, bool elementwise) const { return e.hazard(lo, hi, false); }
+	bool same(const Rolling& that) const { return w == that.w && e.same(that.e); }
+
+	void materialize(value_type* out) const {
+		evaluation scope(e);
+		this->run(out, direct<E>());
+	}
+
+	void run(value_type* out, std::true_type) const { this->run_on(source(static_cast<const E&>(e)), out); }
+	void run(value_type* out, std::false_type) const {
+		valarray<Element<E>> tmp = static_cast<const E&>(e);
+		this->run_on(source(tmp), out);
+	}
+
+	template <class S>
+	void run_on(const S& src, value_type* out) const {
+		size_t m = this->len();
+		size_t p = pieces(m, (4 * w < grain) ? grain : 4 * w);
+		value_type divisor = mean ? value_type(w) : value_type(1);
+		parallel_for(m, p, [&](size_t piece, size_t lo, size_t hi) {
+			if (lo < hi) { K::run(src, out, lo, hi, w, divisor); }
+		});
+	}
+
+private:
+	value_type finish(const value_type& x) const { return mean ? x / value_type(w) : x; }
+};
+
+template <class E>
+using Mean = typename std::conditional<std::is_floating_point<Element<E>>::value, Element<E>, double>::type;
+template <class E, class K, class T, bool mean = false>
+using RollingOf = typename std::enable_if<is_vexpr<E>::value && std::is_arithmetic<Element<E>>::value,
+	vexpr<Rolling<E, K, T, mean>>>::type;
+
+template <class E>
+RollingOf<E, window_sum<Element<E>>, Element<E>> rolling_sum(const E& e, size_t w) {
+	return vexpr<Rolling<E, window_sum<Element<E>>, Element<E>>>(Rolling<E, window_sum<Element<E>>, Element<E>>(e, w));
+}
+template <class E>
+RollingOf<E, window_sum<Mean<E>>, Mean<E>, true> rolling_mean(const E& e, size_t w) {
+	return vexpr<Rolling<E, window_sum<Mean<E>>, Mean<E>, true>>(Rolling<E, window_sum<Mean<E>>, Mean<E>, true>(e, w));
+}
+template <class E>
+RollingOf<E, window_min<Element<E>>, Element<E>> rolling_min(const E& e, size_t w) {
+	return vexpr<Rolling<E, window_min<Element<E>>, Element<E>>>(Rolling<E, window_min<Element<E>>, Element<E>>(e, w));
+}
+template <class E>
+RollingOf<E, window_max<Element<E>>, Element<E>> rolling_max(const E& e, size_t w) {
+	return vexpr<Rolling<E, window_max<Element<E>>, Element<E>>>(Rolling<E, window_max<Element<E>>, Element<E>>(e, w));
+}
+
+}
+
+#endif /* _Rolling_h */
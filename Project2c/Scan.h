@@ -0,0 +1,203 @@
+// Scan.h
+
+/*
+ * prefix scans over any expression
+ *
+ *     valarray<double> run = inclusive_scan(x);                          // x0, x0+x1, ...
+ *     valarray<int> starts = exclusive_scan(len, 0);                     // 0, l0, l0+l1, ...
+ *     valarray<double> best = inclusive_scan(x, [](double a, double b) { return a < b ? b : a; });
+ *
+ * f only has to be associative. The result is a lazy node like matmul:
+ * assigning the whole node goes through materialize(), which evaluates the
+ * operand once. Inside a larger expression (inclusive_scan(x) * 1.5) the
+ * first element read materializes the scan into a buffer that belongs to
+ * that evaluation (the assignment or reduction, see evaluation_frame in
+ * Parallel.h), every element after that is one load. The buffer goes when
+ * the evaluation ends, so a stored expression sees its operand as it is
+ * the next time it is evaluated. An element read on its own folds its
+ * prefix, O(k).
+ *
+ * materialize() works in two passes over p contiguous pieces (one per thread
+ * once there is enough work): every piece scans itself with no carry-in,
+ * the piece totals are scanned serially, then every piece but the first
+ * folds its offset into its results.
+ */
+
+#ifndef _Scan_h
+#define _Scan_h
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+
+#include "Parallel.h"
+#include "Valarray.h"
+
+namespace epl {
+
+/*
+ * scan e[lo, hi) into out[lo, hi), starting from carry when there is one.
+ * four elements at a time: scan the four among themselves (two steps,
+ * independent of anything before them), then fold the carry into each, so
+ * the chain from one block to the next is a single f instead of four.
+ */
+template <class E, class F, class T>
+void scan_range(const E& e, const F& f, T* out, size_t lo, size_t hi, const T* carry) {
+	size_t k = lo;
+	T acc = (carry != nullptr) ? *carry : T();
+	if (carry == nullptr && k < hi) {
+		acc = e[k];
+		out[k] = acc;
+		k++;
+	}
+	for (; k + 4 <= hi; k += 4) {
+		T x0 = e[k], x1 = e[k + 1], x2 = e[k + 2], x3 = e[k + 3];
+		x1 = f(x0, x1);
+		x3 = f(x2, x3);
+		x2 = f(x1, x2);
+		x3 = f(x1, x3);
+		out[k] = f(acc, x0);
+		out[k + 1] = f(acc, x1);
+		out[k + 2] = f(acc, x2);
+		acc = f(acc, x3);
+		out[k + 3] = acc;
+	}
+	for (; k < hi; k++) {
+		acc = f(acc, e[k]);
+		out[k] = acc;
+	}
+}
+
+/* e[k - 1] as element k, for the exclusive scan */
+template <class E>
+struct shifted {
+	const E e;
+	auto operator[](size_t k) const -> decltype(e[k]) { return e[k - 1]; }
+};
+
+/* the materialized scan behind operator[], kept in the evaluation's frame and filled by whichever piece gets there first */
+template <typename T>
+struct scan_memo {
+	std::once_flag once;
+	std::unique_ptr<valarray<T>> all;
+};
+
+/* where a thread last found a scan: node, evaluation serial, data */
+template <typename T>
+struct scan_slot {
+	uint64_t id = 0;
+	uint64_t serial = 0;
+	const T* data = nullptr;
+};
+
+/* inclusive (or exclusive, from init) scan of e with f */
+template <class E, class F>
+struct Scan {
+	using value_type = Element<E>;
+	const Ref<E> e;
+	const F f;
+	const bool exclusive;
+	const value_type init;
+	/* copies compute the same scan, so they share it */
+	const uint64_t id = unique_key();
+	static const size_t grain = 64 * 1024;
+
+	Scan(const E& e, const F& f, bool exclusive, const value_type& init) :
+		e(const_cast<E&>(e)), f(f), exclusive(exclusive), init(init) {}
+
+	/* element k, out of the whole scan (see the top of the file) */
+	value_type operator[](size_t k) const {
+		evaluation_frame* now = current_frame();
+		if (now == nullptr) { return this->one(k); }
+		/* a few slots, so that scans of the same type read side by side do not evict each other */
+		static thread_local scan_slot<value_type> slots[4];
+		scan_slot<value_type>& s = slots[id % 4];
+		if (s.id != id || s.serial != now->serial) {
+			scan_memo<value_type>& m = now->keep<scan_memo<value_type>>(id);
+			std::call_once(m.once, [&]() {
+				m.all.reset(new valarray<value_type>(this->len()));
+				if (this->len() != 0) { this->materialize(m.all->data()); }
+			});
+			s.id = id;
+			s.serial = now->serial;
+			s.data = m.all->data();
+		}
+		return s.data[k];
+	}
+	/* element k on its own, outside of any evaluation */
+	value_type one(size_t k) const {
+		if (exclusive) {
+			value_type acc = init;
+			for (size_t j = 0; j < k; j++) { acc = f(acc, e[j]); }
+			return acc;
+		}
+		value_type acc = e[0];
+		for (size_t j = 1; j <= k; j++) { acc = f(acc, e[j]); }
+		return acc;
+	}
+	size_t len() const { return e.len(); }
+	size_t size() const { return this->len(); }
+	/* and it keeps itself for the evaluation, see operator[] */
+	bool hazard(const void* lo, const void* hi, bool elementwise) const {
+		return lo == keeping_address() || e.hazard(lo, hi, false);
+	}
+	bool same(const Scan& that) const {
+		return std::is_empty<F>::value && exclusive == that.exclusive && init == that.init && e.same(that.e);
+	}
+
+	/* the whole scan, see the top of the file */
+	void materialize(value_type* out) const {
+		size_t n = this->len();
+		if (n == 0) { return; }
+		evaluation scope(e);
+		if (exclusive) {
+			out[0] = init;
+			this->run(shifted<decltype(source(e))>{source(e)}, out, 1, n, &init);
+		} else {
+			this->run(source(e), out, 0, n, nullptr);
+		}
+	}
+
+	template <class S>
+	void run(const S& src, value_type* out, size_t lo, size_t hi, const value_type* carry) const {
+		size_t n = hi - lo;
+		size_t p = pieces(n, grain);
+		if (p <= 1) {
+			scan_range(src, f, out, lo, hi, carry);
+			return;
+		}
+		vector<value_type> offset(p);
+		parallel_for(n, p, [&](size_t piece, size_t a, size_t b) {
+			scan_range(src, f, out, lo + a, lo + b, (piece == 0) ? carry : nullptr);
+		});
+		offset[0] = out[lo + n / p - 1];
+		for (size_t j = 1; j + 1 < p; j++) {
+			offset[j] = f(offset[j - 1], out[lo + n * (j + 1) / p - 1]);
+		}
+		parallel_for(n, p, [&](size_t piece, size_t a, size_t b) {
+			if (piece == 0) { return; }
+			const value_type c = offset[piece - 1];
+			for (size_t k = lo + a; k < lo + b; k++) {
+				out[k] = f(c, out[k]);
+			}
+		});
+	}
+};
+
+template <class E, class F>
+using ScanOf = typename std::enable_if<is_vexpr<E>::value, vexpr<Scan<E, F>>>::type;
+
+template <class E, class F = std::plus<Element<E>>>
+ScanOf<E, F> inclusive_scan(const E& e, F f = F()) {
+	return vexpr<Scan<E, F>>(Scan<E, F>(e, f, false, Element<E>()));
+}
+template <class E, class T, class F = std::plus<Element<E>>>
+ScanOf<E, F> exclusive_scan(const E& e, const T& init, F f = F()) {
+	return vexpr<Scan<E, F>>(Scan<E, F>(e, f, true, Element<E>(init)));
+}
+
+}
+
+#endif /* _Scan_h */
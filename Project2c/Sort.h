@@ -0,0 +1,312 @@
+// Sort.h
+
+/*
+ * sorting and selection on valarrays
+ *
+ *     sort(x);                                   // in place, ascending
+ *     sort(x, [](double a, double b) { return a > b; });
+ *     valarray<size_t> order = argsort(a * b);   // stable, a permutation of 0 .. n-1
+ *     valarray<double> y = gather(x, order);     // y[k] = x[order[k]], lazily
+ *     double median = nth_element(x, x.size() / 2);
+ *     partial_sort(x, 10);                       // the 10 smallest, in order, at the front
+ *
+ * Everything works on the raw storage, never through the checked
+ * iterators. Integer and floating point keys in ascending order go through
+ * an LSD radix sort, eight bits a pass, on keys mapped to unsigned integers
+ * that compare the same way (floats: -NaN < -inf < ... < -0 < +0 < ... <
+ * +inf < NaN). Passes whose byte is the same in every key are skipped.
+ * Anything else (a comparator, other key types) is a merge sort: pieces are
+ * sorted with std::sort / std::stable_sort, then merged pairwise, every
+ * merge split into equal parts along its merge path so the threads share
+ * it evenly. Large radix sorts count and scatter per thread too.
+ */
+
+#ifndef _Sort_h
+#define _Sort_h
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+
+#include "Parallel.h"
+#include "Valarray.h"
+
+namespace epl {
+
+/* keys the radix sort takes, mapped to unsigned integers in the same order */
+template <class T, class = void>
+struct radix_traits : std::false_type {};
+template <class T>
+struct radix_traits<T, When<std::is_integral<T>::value && !std::is_same<T, bool>::value>> : std::true_type {
+	using U = typename std::make_unsigned<T>::type;
+	static const U flip = std::is_signed<T>::value ? U(U(1) << (8 * sizeof(U) - 1)) : U(0);
+	static U encode(T x) { return U(x) ^ flip; }
+	static T decode(U u) { return T(u ^ flip); }
+};
+/* flip the sign bit of positives and every bit of negatives */
+template <class T>
+struct radix_traits<T, When<std::is_floating_point<T>::value && std::numeric_limits<T>::is_iec559 &&
+	(sizeof(T) == 4 || sizeof(T) == 8)>> : std::true_type {
+	using U = typename std::conditional<sizeof(T) == 4, uint32_t, uint64_t>::type;
+	static const U sign = U(U(1) << (8 * sizeof(U) - 1));
+	static U encode(T x) {
+		U u;
+		std::memcpy(&u, &x, sizeof(u));
+		return ((u & sign) != 0) ? U(~u) : U(u | sign);
+	}
+	static T decode(U u) {
+		u = ((u & sign) != 0) ? U(u & ~sign) : U(~u);
+		T x;
+		std::memcpy(&x, &u, sizeof(x));
+		return x;
+	}
+};
+
+/*
+ * sort key[0, n) (and val along with it, when Pay) by the unsigned keys,
+ * stably. tkey and tval are scratch of the same size. Every pass counts the
+ * bytes per piece, turns the counts into where each piece's share of each
+ * bucket starts, then every piece scatters its elements in order.
+ */
+template <bool Pay, class U, class P>
+void radix_sort(U* key, U* tkey, P* val, P* tval, size_t n) {
+	const size_t grain = 64 * 1024;
+	const size_t p = pieces(n, grain);
+	vector<size_t> counts(p * 256);
+	size_t* count = &counts[0];
+	U* src = key;
+	U* dst = tkey;
+	P* vsrc = val;
+	P* vdst = tval;
+	for (size_t shift = 0; shift < 8 * sizeof(U); shift += 8) {
+		parallel_for(n, p, [&](size_t piece, size_t lo, size_t hi) {
+			size_t* c = count + piece * 256;
+			for (size_t d = 0; d < 256; d++) { c[d] = 0; }
+			for (size_t k = lo; k < hi; k++) { c[(src[k] >> shift) & 0xff] += 1; }
+		});
+		bool all_same = false;
+		size_t start = 0;
+		for (size_t d = 0; d < 256; d++) {
+			size_t total = 0;
+			for (size_t q = 0; q < p; q++) {
+				size_t c = count[q * 256 + d];
+				count[q * 256 + d] = start + total;
+				total += c;
+			}
+			all_same = all_same || total == n;
+			start += total;
+		}
+		if (all_same) { continue; }
+		parallel_for(n, p, [&](size_t piece, size_t lo, size_t hi) {
+			size_t* c = count + piece * 256;
+			for (size_t k = lo; k < hi; k++) {
+				size_t at = c[(src[k] >> shift) & 0xff]++;
+				dst[at] = src[k];
+				if (Pay) { vdst[at] = vsrc[k]; }
+			}
+		});
+		std::swap(src, dst);
+		std::swap(vsrc, vdst);
+	}
+	if (src != key) {
+		std::copy(src, src + n, key);
+		if (Pay) { std::copy(vsrc, vsrc + n, val); }
+	}
+}
+
+/* how many of the first d merged elements of a[0, na) and b[0, nb) come from a (ties go to a) */
+template <class T, class C>
+size_t merge_split(const T* a, size_t na, const T* b, size_t nb, size_t d, C comp) {
+	size_t lo = (d > nb) ? d - nb : 0;
+	size_t hi = (d < na) ? d : na;
+	while (lo < hi) {
+		size_t i = lo + (hi - lo) / 2;
+		size_t j = d - i;
+		if (j > 0 && !comp(b[j - 1], a[i])) {
+			lo = i + 1;
+		} else {
+			hi = i;
+		}
+	}
+	return lo;
+}
+
+/* merge a and b into out, cut into pieces of the output along the merge path */
+template <class T, class C>
+void parallel_merge(const T* a, size_t na, const T* b, size_t nb, T* out, C comp, size_t grain) {
+	size_t n = na + nb;
+	parallel_for(n, pieces(n, grain), [&](size_t, size_t lo, size_t hi) {
+		size_t i0 = merge_split(a, na, b, nb, lo, comp);
+		size_t i1 = merge_split(a, na, b, nb, hi, comp);
+		std::merge(a + i0, a + i1, b + (lo - i0), b + (hi - i1), out + lo, comp);
+	});
+}
+
+/* sort x[0, n) with comp, stably when Stable, see the top of the file */
+template <bool Stable, class T, class C>
+void merge_sort(T* x, size_t n, C comp) {
+	const size_t grain = 16 * 1024;
+	size_t p = pieces(n, grain);
+	if (p <= 1) {
+		if (Stable) { std::stable_sort(x, x + n, comp); } else { std::sort(x, x + n, comp); }
+		return;
+	}
+	parallel_for(n, p, [&](size_t, size_t lo, size_t hi) {
+		if (Stable) { std::stable_sort(x + lo, x + hi, comp); } else { std::sort(x + lo, x + hi, comp); }
+	});
+	/* run k is [n * k / p, n * (k + 1) / p) to start with, every round merges neighbours */
+	vector<size_t> bounds(p + 1);
+	size_t* at = &bounds[0];
+	for (size_t k = 0; k <= p; k++) { at[k] = n * k / p; }
+	buffer<T> scratch(n);
+	for (size_t k = 0; k < n; k++) { scratch.push_back(x[k]); }
+	T* src = x;
+	T* dst = scratch.data;
+	for (size_t runs = p; runs > 1; runs = (runs + 1) / 2) {
+		size_t w = 0;
+		for (size_t r = 0; r < runs; r += 2) {
+			/* an odd run out at the end is merged with nothing, i.e. copied */
+			size_t lo = at[r], mid = at[r + 1];
+			size_t hi = (r + 2 <= runs) ? at[r + 2] : mid;
+			parallel_merge(src + lo, mid - lo, src + mid, hi - mid, dst + lo, comp, grain);
+			at[w++] = lo;
+		}
+		at[w] = n;
+		std::swap(src, dst);
+	}
+	if (src != x) { std::copy(src, src + n, x); }
+}
+
+template <typename T, class C>
+void sort_range(T* x, size_t n, C comp, std::false_type, bool) { merge_sort<false>(x, n, comp); }
+template <typename T, class C>
+void sort_range(T* x, size_t n, C comp, std::true_type, bool radix) {
+	using R = radix_traits<T>;
+	using U = typename R::U;
+	if (!radix || n < 256) {
+		merge_sort<false>(x, n, comp);
+		return;
+	}
+	buffer<U> key(n), tmp(n);
+	for (size_t k = 0; k < n; k++) { key.data[k] = R::encode(x[k]); }
+	radix_sort<false, U, size_t>(key.data, tmp.data, nullptr, nullptr, n);
+	for (size_t k = 0; k < n; k++) { x[k] = R::decode(key.data[k]); }
+}
+template <typename T, class C>
+void sort_range(T* x, size_t n, C comp, bool radix) {
+	sort_range(x, n, comp, std::integral_constant<bool, radix_traits<T>::value>(), radix);
+}
+
+/* sort in place, with comp or ascending */
+template <typename T, class C>
+valarray<T>& sort(valarray<T>& x, C comp) {
+	if (x.len() > 1) {
+		sort_range(&x[0], x.len(), comp, std::is_same<C, std::less<T>>::value);
+	}
+	return x;
+}
+template <typename T>
+valarray<T>& sort(valarray<T>& x) { return sort(x, std::less<T>()); }
+
+template <typename T, class C>
+void argsort_range(const T* keys, size_t* order, size_t n, C comp, std::false_type) {
+	for (size_t k = 0; k < n; k++) { order[k] = k; }
+	merge_sort<true>(order, n, [&](size_t i, size_t j) { return comp(keys[i], keys[j]); });
+}
+template <typename T, class C>
+void argsort_range(const T* keys, size_t* order, size_t n, C comp, std::true_type) {
+	using R = radix_traits<T>;
+	using U = typename R::U;
+	buffer<U> key(n), tmp(n);
+	buffer<size_t> idx(n);
+	for (size_t k = 0; k < n; k++) {
+		key.data[k] = R::encode(keys[k]);
+		order[k] = k;
+	}
+	radix_sort<true>(key.data, tmp.data, order, idx.data, n);
+}
+
+/* e as one array: a valarray's own storage, anything else evaluated into tmp */
+template <class E>
+const Element<E>* flat(const E& e, valarray<Element<E>>& tmp) {
+	tmp = e;
+	return &tmp[0];
+}
+template <typename T>
+const T* flat(const valarray<T>& e, valarray<T>&) { return &e[0]; }
+
+/*
+ * the permutation that sorts e, stably: e[order[0]] <= e[order[1]] <= ...
+ * e is evaluated once, a valarray is read where it is.
+ */
+template <class E, class C = std::less<Element<E>>>
+typename std::enable_if<is_vexpr<E>::value, valarray<size_t>>::type argsort(const E& e, C comp = C()) {
+	size_t n = e.len();
+	valarray<size_t> order(n);
+	if (n == 0) { return order; }
+	valarray<Element<E>> tmp;
+	argsort_range(flat(e, tmp), &order[0], n, comp,
+		std::integral_constant<bool, radix_traits<Element<E>>::value && std::is_same<C, std::less<Element<E>>>::value>());
+	return order;
+}
+
+/*
+ * y[k] = e[idx[k]], e is read out of step so it is never an elementwise alias.
+ * the indexes are checked once, when the node is built (std::out_of_range),
+ * and read unchecked after that
+ */
+template <class E, class I>
+struct Gather {
+	using value_type = Element<E>;
+	const Ref<E> e;
+	const Ref<I> idx;
+	Gather(const E& e, const I& idx) : e(const_cast<E&>(e)), idx(const_cast<I&>(idx)) {
+		using J = Element<I>;
+		size_t n = e.len();
+		for (size_t k = 0; k < idx.len(); k++) {
+			J j = this->idx[k];
+			if (j < J() || static_cast<size_t>(j) >= n) { throw std::out_of_range("gather index out of range"); }
+		}
+	}
+	value_type operator[](size_t k) const { return e[static_cast<size_t>(idx[k])]; }
+	size_t len() const { return idx.len(); }
+	size_t size() const { return this->len(); }
+	bool hazard(const void* lo, const void* hi, bool elementwise) const {
+		return e.hazard(lo, hi, false) || idx.hazard(lo, hi, elementwise);
+	}
+	bool same(const Gather& that) const { return e.same(that.e) && idx.same(that.idx); }
+};
+
+template <class E, class I>
+typename std::enable_if<is_vexpr<E>::value && is_vexpr<I>::value && std::is_integral<Element<I>>::value,
+	vexpr<Gather<E, I>>>::type gather(const E& e, const I& idx) {
+	return vexpr<Gather<E, I>>(Gather<E, I>(e, idx));
+}
+
+/* put the k-th smallest at x[k], smaller ones before it and larger ones after, and return it */
+template <typename T, class C = std::less<T>>
+T nth_element(valarray<T>& x, size_t k, C comp = C()) {
+	T* p = &x[k];
+	T* first = p - k;
+	std::nth_element(first, p, first + x.len(), comp);
+	return *p;
+}
+
+/* the k smallest, sorted, at the front, the rest after them in no order */
+template <typename T, class C = std::less<T>>
+valarray<T>& partial_sort(valarray<T>& x, size_t k, C comp = C()) {
+	if (x.len() == 0) { return x; }
+	T* first = &x[0];
+	size_t n = x.len();
+	std::partial_sort(first, first + ((k < n) ? k : n), first + n, comp);
+	return x;
+}
+
+}
+
+#endif /* _Sort_h */
@@ -0,0 +1,455 @@
+// Sparse.h
+
+/*
+ * sparse valarrays: only the nonzeros are stored and visited
+ *
+ *     sparse_valarray<double> x(dense), y(n);       // from a dense expression, all zero
+ *     y.set(17, 2.5);
+ *     sparse_valarray<double> z = 2.0 * x + y;      // union of the nonzeros
+ *     sparse_valarray<double> w = x * y;            // intersection
+ *     sparse_valarray<double> g = x * (a + b);      // only a + b at x's nonzeros
+ *     double d = dot(x, a);
+ *     axpy(0.5, x, a);                              // a += 0.5 x, dense a
+ *     valarray<double> full = z.dense();
+ *
+ * The nonzeros are kept as two arrays, the sorted indices and the values
+ * next to them (for a vector that is both the coordinate and the CSR
+ * layout). Expressions between sparse operands are their own small family
+ * of expression templates: a node hands out a cursor that walks its
+ * nonzeros in increasing index order (done, index, value, next), so x + y
+ * is a merge of the two index lists and x * y skips to the indices both
+ * have. Everything is proportional to the number of nonzeros, the length
+ * never enters into it. Only operations that keep zeros zero exist:
+ * sparse + - * sparse, sparse * or / dense, dense * sparse, sparse * or /
+ * scalar, scalar * sparse and unary minus. To add a sparse array to a dense
+ * one use axpy, or dense().
+ *
+ * Results keep every index that was visited, even if the value came out as
+ * zero (x - x has x's pattern), prune() drops them. Sparse operands must have
+ * the same length (std::length_error), a dense operand at least that length.
+ */
+
+#ifndef _Sparse_h
+#define _Sparse_h
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "Parallel.h"
+#include "Valarray.h"
+
+namespace epl {
+
+template <typename T>
+struct sparse_valarray;
+
+/* sparse expressions (nodes below and sparse_valarray itself) */
+template <class E>
+struct is_sparse : std::false_type {};
+template <typename T>
+struct is_sparse<sparse_valarray<T>> : std::true_type {};
+
+/* leaves are held by reference, nodes by value, as for dense expressions */
+template <typename T>
+struct to_ref<sparse_valarray<T>> { using type = const sparse_valarray<T>&; };
+
+/* walks the stored nonzeros of a sparse_valarray */
+template <typename T>
+struct sparse_cursor {
+	const size_t* i;
+	const size_t* end;
+	const T* v;
+	bool done() const { return i == end; }
+	size_t index() const { return *i; }
+	T value() const { return *v; }
+	void next() { ++i; ++v; }
+};
+
+template <typename T>
+struct sparse_valarray {
+	using value_type = T;
+	using cursor = sparse_cursor<T>;
+	size_t n;
+	vector<size_t> idx;
+	vector<T> val;
+
+	explicit sparse_valarray(size_t n = 0) : n(n) {}
+
+	/* the nonzeros of a dense expression, O(n) once */
+	template <typename E, typename = is_easy_vexpr<E>>
+	explicit sparse_valarray(const E& e) : n(e.len()) {
+		evaluation scope(e);
+		for (size_t k = 0; k < n; k++) {
+			T x = e[k];
+			if (x != T()) {
+				idx.push_back(k);
+				val.push_back(x);
+			}
+		}
+	}
+
+	template <typename E>
+	sparse_valarray(const E& e, When<is_sparse<E>::value>* = nullptr) : n(0) { this->build(e); }
+
+	sparse_valarray& operator=(const sparse_valarray& that) { return this->operator=<sparse_valarray>(that); }
+	template <typename E, typename = When<is_sparse<E>::value>>
+	sparse_valarray& operator=(const E& e) {
+		this->build(e);
+		return *this;
+	}
+
+	size_t len() const { return n; }
+	size_t size() const { return n; }
+	size_t nnz() const { return idx.size(); }
+	size_t nnz_bound() const { return this->nnz(); }
+	const size_t* indices() const { return idx.data(); }
+	const T* values() const { return val.data(); }
+	cursor begin() const { return cursor{idx.data(), idx.data() + idx.size(), val.data()}; }
+
+	/* element k, zero if it is not stored (binary search) */
+	T operator[](size_t k) const {
+		if (k >= n) { throw std::out_of_range("subscript out of range"); }
+		const size_t* at = std::lower_bound(idx.data(), idx.data() + idx.size(), k);
+		return (at != idx.data() + idx.size() && *at == k) ? val[at - idx.data()] : T();
+	}
+
+	/* store x at k, cheap at the end, a shift anywhere else */
+	void set(size_t k, const T& x) {
+		if (k >= n) { throw std::out_of_range("subscript out of range"); }
+		size_t m = idx.size();
+		size_t j = std::lower_bound(idx.data(), idx.data() + m, k) - idx.data();
+		if (j < m && idx[j] == k) {
+			val[j] = x;
+			return;
+		}
+		idx.push_back(k);
+		val.push_back(x);
+		size_t* i = idx.data();
+		T* v = val.data();
+		for (size_t q = m; q > j; q--) {
+			i[q] = i[q - 1];
+			v[q] = v[q - 1];
+		}
+		i[j] = k;
+		v[j] = x;
+	}
+
+	/* drop the stored zeros */
+	void prune() {
+		size_t* i = idx.data();
+		T* v = val.data();
+		size_t m = 0;
+		for (size_t j = 0; j < idx.size(); j++) {
+			if (v[j] != T()) {
+				i[m] = i[j];
+				v[m] = v[j];
+				m++;
+			}
+		}
+		while (idx.size() > m) {
+			idx.pop_back();
+			val.pop_back();
+		}
+	}
+
+	valarray<T> dense() const {
+		valarray<T> out(n);
+		T* d = out.data();
+		for (size_t j = 0; j < idx.size(); j++) {
+			d[idx[j]] = val[j];
+		}
+		return out;
+	}
+
+private:
+	/* walk e once into fresh arrays (so e may read this array) */
+	template <typename E>
+	void build(const E& e) {
+		size_t bound = e.nnz_bound();
+		vector<size_t> i(bound);
+		vector<T> v(bound);
+		size_t* pi = i.data();
+		T* pv = v.data();
+		size_t m = 0;
+		for (auto c = e.begin(); !c.done(); c.next()) {
+			pi[m] = c.index();
+			pv[m] = c.value();
+			m++;
+		}
+		while (i.size() > m) {
+			i.pop_back();
+			v.pop_back();
+		}
+		n = e.len();
+		idx = std::move(i);
+		val = std::move(v);
+	}
+};
+
+template <class A, class B>
+void same_length(const A& a, const B& b) {
+	if (a.len() != b.len()) { throw std::length_error("sparse operands of different lengths"); }
+}
+
+/* a op b at every index either has, the missing side counts as zero */
+template <class Op, class A, class B>
+struct SparseUnion {
+	using value_type = decltype(std::declval<Op>()(ValueType<A>(), ValueType<B>()));
+	const Op op;
+	const Ref<A> a;
+	const Ref<B> b;
+	SparseUnion(const Op& op, const A& a, const B& b) : op(op), a(a), b(b) { same_length(a, b); }
+	size_t len() const { return a.len(); }
+	size_t nnz_bound() const { return a.nnz_bound() + b.nnz_bound(); }
+
+	struct cursor {
+		const Op* op;
+		decltype(std::declval<const A&>().begin()) ca;
+		decltype(std::declval<const B&>().begin()) cb;
+		bool done() const { return ca.done() && cb.done(); }
+		size_t index() const {
+			if (ca.done()) { return cb.index(); }
+			if (cb.done()) { return ca.index(); }
+			return std::min(ca.index(), cb.index());
+		}
+		value_type value() const {
+			size_t k = this->index();
+			ValueType<A> x = (!ca.done() && ca.index() == k) ? ca.value() : ValueType<A>();
+			ValueType<B> y = (!cb.done() && cb.index() == k) ? cb.value() : ValueType<B>();
+			return (*op)(x, y);
+		}
+		void next() {
+			size_t k = this->index();
+			if (!ca.done() && ca.index() == k) { ca.next(); }
+			if (!cb.done() && cb.index() == k) { cb.next(); }
+		}
+	};
+	cursor begin() const { return cursor{&op, a.begin(), b.begin()}; }
+};
+
+/* a op b only where both have a nonzero (op(0, y) and op(x, 0) are zero) */
+template <class Op, class A, class B>
+struct SparseIntersection {
+	using value_type = decltype(std::declval<Op>()(ValueType<A>(), ValueType<B>()));
+	const Op op;
+	const Ref<A> a;
+	const Ref<B> b;
+	SparseIntersection(const Op& op, const A& a, const B& b) : op(op), a(a), b(b) { same_length(a, b); }
+	size_t len() const { return a.len(); }
+	size_t nnz_bound() const { return std::min(a.nnz_bound(), b.nnz_bound()); }
+
+	struct cursor {
+		const Op* op;
+		decltype(std::declval<const A&>().begin()) ca;
+		decltype(std::declval<const B&>().begin()) cb;
+		/* step the one behind until they meet */
+		void align() {
+			while (!ca.done() && !cb.done() && ca.index() != cb.index()) {
+				if (ca.index() < cb.index()) { ca.next(); } else { cb.next(); }
+			}
+		}
+		bool done() const { return ca.done() || cb.done(); }
+		size_t index() const { return ca.index(); }
+		value_type value() const { return (*op)(ca.value(), cb.value()); }
+		void next() {
+			ca.next();
+			cb.next();
+			this->align();
+		}
+	};
+	cursor begin() const {
+		cursor c{&op, a.begin(), b.begin()};
+		c.align();
+		return c;
+	}
+};
+
+/* s op d[k] at the nonzeros k of s, d is any dense expression (read only there) */
+template <class Op, class S, class D, bool DenseFirst>
+struct SparseDense {
+	using value_type = decltype(std::declval<Op>()(ValueType<S>(), ValueType<D>()));
+	const Op op;
+	const Ref<S> s;
+	const Ref<D> d;
+	SparseDense(const Op& op, const S& s, const D& d) : op(op), s(s), d(const_cast<D&>(d)) {
+		if (d.len() < s.len()) { throw std::length_error("dense operand shorter than the sparse one"); }
+	}
+	size_t len() const { return s.len(); }
+	size_t nnz_bound() const { return s.nnz_bound(); }
+
+	struct cursor {
+		const SparseDense* node;
+		decltype(std::declval<const S&>().begin()) cs;
+		bool done() const { return cs.done(); }
+		size_t index() const { return cs.index(); }
+		value_type value() const { return node->apply(cs.value(), node->d[cs.index()], std::integral_constant<bool, DenseFirst>()); }
+		void next() { cs.next(); }
+	};
+	cursor begin() const { return cursor{this, s.begin()}; }
+
+	template <class X, class Y>
+	value_type apply(const X& x, const Y& y, std::false_type) const { return op(x, y); }
+	template <class X, class Y>
+	value_type apply(const X& x, const Y& y, std::true_type) const { return op(y, x); }
+};
+
+/* f(value) at every nonzero, f keeps zero zero (scaling, negation) */
+template <class F, class S>
+struct SparseMap {
+	using value_type = decltype(std::declval<F>()(ValueType<S>()));
+	const F f;
+	const Ref<S> s;
+	SparseMap(const F& f, const S& s) : f(f), s(s) {}
+	size_t len() const { return s.len(); }
+	size_t nnz_bound() const { return s.nnz_bound(); }
+
+	struct cursor {
+		const F* f;
+		decltype(std::declval<const S&>().begin()) cs;
+		bool done() const { return cs.done(); }
+		size_t index() const { return cs.index(); }
+		value_type value() const { return (*f)(cs.value()); }
+		void next() { cs.next(); }
+	};
+	cursor begin() const { return cursor{&f, s.begin()}; }
+};
+
+template <class Op, class A, class B>
+struct is_sparse<SparseUnion<Op, A, B>> : std::true_type {};
+template <class Op, class A, class B>
+struct is_sparse<SparseIntersection<Op, A, B>> : std::true_type {};
+template <class Op, class S, class D, bool F>
+struct is_sparse<SparseDense<Op, S, D, F>> : std::true_type {};
+template <class F, class S>
+struct is_sparse<SparseMap<F, S>> : std::true_type {};
+
+/* x times a scalar on either side, x over a scalar, minus x */
+template <class T, class U, bool ScalarFirst>
+struct sparse_scale {
+	U c;
+	auto operator()(const T& x) const -> decltype(x * c) { return ScalarFirst ? c * x : x * c; }
+};
+template <class T, class U>
+struct sparse_divide {
+	U c;
+	auto operator()(const T& x) const -> decltype(x / c) { return x / c; }
+};
+template <class T>
+struct sparse_negate {
+	T operator()(const T& x) const { return -x; }
+};
+
+/* the value type both operands promote to, and the std functor on it */
+template <class A, class B>
+using SparseCommon = typename std::common_type<ValueType<A>, ValueType<B>>::type;
+template <template <class> class Op, class A, class B>
+using SparseOp = Op<SparseCommon<A, B>>;
+
+/* the result type R, when the operands are what the operator is for */
+template <bool B, class R>
+using SparseIf = typename std::enable_if<B, R>::type;
+template <class A, class B>
+using both_sparse = std::integral_constant<bool, is_sparse<A>::value && is_sparse<B>::value>;
+template <class S, class D>
+using sparse_dense = std::integral_constant<bool, is_sparse<S>::value && is_vexpr<D>::value>;
+template <class S, class U>
+using sparse_scalar = std::integral_constant<bool, is_sparse<S>::value && std::is_arithmetic<U>::value>;
+
+template <class A, class B>
+SparseIf<both_sparse<A, B>::value, SparseUnion<SparseOp<std::plus, A, B>, A, B>>
+operator+(const A& a, const B& b) {
+	return SparseUnion<SparseOp<std::plus, A, B>, A, B>(SparseOp<std::plus, A, B>(), a, b);
+}
+template <class A, class B>
+SparseIf<both_sparse<A, B>::value, SparseUnion<SparseOp<std::minus, A, B>, A, B>>
+operator-(const A& a, const B& b) {
+	return SparseUnion<SparseOp<std::minus, A, B>, A, B>(SparseOp<std::minus, A, B>(), a, b);
+}
+template <class A, class B>
+SparseIf<both_sparse<A, B>::value, SparseIntersection<SparseOp<std::multiplies, A, B>, A, B>>
+operator*(const A& a, const B& b) {
+	return SparseIntersection<SparseOp<std::multiplies, A, B>, A, B>(SparseOp<std::multiplies, A, B>(), a, b);
+}
+
+template <class S, class D>
+SparseIf<sparse_dense<S, D>::value, SparseDense<SparseOp<std::multiplies, S, D>, S, D, false>>
+operator*(const S& s, const D& d) {
+	return SparseDense<SparseOp<std::multiplies, S, D>, S, D, false>(SparseOp<std::multiplies, S, D>(), s, d);
+}
+template <class D, class S>
+SparseIf<sparse_dense<S, D>::value, SparseDense<SparseOp<std::multiplies, S, D>, S, D, true>>
+operator*(const D& d, const S& s) {
+	return SparseDense<SparseOp<std::multiplies, S, D>, S, D, true>(SparseOp<std::multiplies, S, D>(), s, d);
+}
+template <class S, class D>
+SparseIf<sparse_dense<S, D>::value, SparseDense<SparseOp<std::divides, S, D>, S, D, false>>
+operator/(const S& s, const D& d) {
+	return SparseDense<SparseOp<std::divides, S, D>, S, D, false>(SparseOp<std::divides, S, D>(), s, d);
+}
+
+template <class S, class U>
+SparseIf<sparse_scalar<S, U>::value, SparseMap<sparse_scale<ValueType<S>, U, false>, S>>
+operator*(const S& s, const U& c) {
+	return SparseMap<sparse_scale<ValueType<S>, U, false>, S>(sparse_scale<ValueType<S>, U, false>{c}, s);
+}
+template <class U, class S>
+SparseIf<sparse_scalar<S, U>::value, SparseMap<sparse_scale<ValueType<S>, U, true>, S>>
+operator*(const U& c, const S& s) {
+	return SparseMap<sparse_scale<ValueType<S>, U, true>, S>(sparse_scale<ValueType<S>, U, true>{c}, s);
+}
+template <class S, class U>
+SparseIf<sparse_scalar<S, U>::value, SparseMap<sparse_divide<ValueType<S>, U>, S>>
+operator/(const S& s, const U& c) {
+	return SparseMap<sparse_divide<ValueType<S>, U>, S>(sparse_divide<ValueType<S>, U>{c}, s);
+}
+template <class S>
+SparseIf<is_sparse<S>::value, SparseMap<sparse_negate<ValueType<S>>, S>>
+operator-(const S& s) {
+	return SparseMap<sparse_negate<ValueType<S>>, S>(sparse_negate<ValueType<S>>(), s);
+}
+
+/* sum of x[k] y[k], over the nonzeros both share */
+template <class A, class B>
+SparseIf<both_sparse<A, B>::value, SparseCommon<A, B>> dot(const A& a, const B& b) {
+	SparseCommon<A, B> acc = SparseCommon<A, B>();
+	auto product = a * b;
+	for (auto c = product.begin(); !c.done(); c.next()) {
+		acc += c.value();
+	}
+	return acc;
+}
+/* and with a dense expression, read at the nonzeros of the sparse one only */
+template <class S, class D>
+SparseIf<sparse_dense<S, D>::value, SparseCommon<S, D>> dot(const S& s, const D& d) {
+	SparseCommon<S, D> acc = SparseCommon<S, D>();
+	auto product = s * d;
+	for (auto c = product.begin(); !c.done(); c.next()) {
+		acc += c.value();
+	}
+	return acc;
+}
+template <class D, class S>
+SparseIf<sparse_dense<S, D>::value, SparseCommon<S, D>> dot(const D& d, const S& s) { return dot(s, d); }
+
+/* y += a x for a dense y, O(nnz) */
+template <typename U, typename T, class S>
+SparseIf<is_sparse<S>::value, void> axpy(const U& a, const S& x, valarray<T>& y) {
+	if (y.len() < x.len()) { throw std::length_error("axpy into a shorter valarray"); }
+	T* d = y.data();
+	for (auto c = x.begin(); !c.done(); c.next()) {
+		d[c.index()] += a * c.value();
+	}
+}
+/* and for a sparse y, the union of both patterns */
+template <typename U, typename T, class S>
+SparseIf<is_sparse<S>::value, void> axpy(const U& a, const S& x, sparse_valarray<T>& y) {
+	y = a * x + y;
+}
+
+}
+
+#endif /* _Sparse_h */
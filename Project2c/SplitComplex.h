@@ -0,0 +1,266 @@
+// SplitComplex.h
+
+/*
+ * split (structure of arrays) complex storage
+ *
+ *     split_complex<double> z(n), w(n);
+ *     z = z * w + 1.0;
+ *
+ * split_complex<T> keeps the real and the imaginary parts in two arrays of T
+ * and reads as a vexpr of std::complex<T>, so it mixes with valarrays of
+ * real or complex numbers under the usual CondComp promotions. Products and
+ * quotients with a split operand skip std::complex's operators (and their
+ * NaN/inf recovery calls) for the textbook formulas, evaluated in the
+ * promoted component type. With contiguous re/im loads and stores that
+ * leaves plain T arithmetic the compiler can vectorize. The quotient is the
+ * unscaled formula, so |c|^2 + |d|^2 of the divisor has to stay in range.
+ */
+
+#ifndef _SplitComplex_h
+#define _SplitComplex_h
+
+#include <cmath>
+#include <complex>
+#include <initializer_list>
+#include <limits>
+#include <type_traits>
+
+#include "Parallel.h"
+#include "Valarray.h"
+
+namespace epl {
+
+template <typename T>
+class split_complex {
+	valarray<T> re;
+	valarray<T> im;
+	/* &re[0] and &im[0] (valarray's operator[] is range checked) */
+	T* rp = nullptr;
+	T* ip = nullptr;
+
+	void sync() {
+		rp = (re.len() == 0) ? nullptr : &re[0];
+		ip = (im.len() == 0) ? nullptr : &im[0];
+	}
+public:
+	using value_type = std::complex<T>;
+	split_complex() {}
+	explicit split_complex(size_t n) : re(n), im(n) { this->sync(); }
+	split_complex(std::initializer_list<value_type> il) {
+		for (const value_type& z : il) {
+			re.push_back(z.real());
+			im.push_back(z.imag());
+		}
+		this->sync();
+	}
+	split_complex(const split_complex& that) { this->assign(that, that.len()); }
+	split_complex(split_complex&& that) : re(std::move(that.re)), im(std::move(that.im)) {
+		this->sync();
+		that.sync();
+	}
+	template <typename U, typename = is_easy_vexpr<U>>
+	split_complex(const U& e) { this->operator=(e); }
+
+	split_complex& operator=(const split_complex& that) { return (this == &that) ? *this : this->assign(that, that.len()); }
+	split_complex& operator=(split_complex&& that) {
+		std::swap(re, that.re);
+		std::swap(im, that.im);
+		this->sync();
+		that.sync();
+		return *this;
+	}
+
+	/* evaluate e into our storage (sized to e), through a pooled temporary if e reads us out of step */
+	template <typename U, typename = is_easy_vexpr<U>>
+	split_complex& operator=(const U& e) {
+		size_t n = (e.len() == SIZE_MAX) ? this->len() : e.len();
+		evaluation scope(e);
+		bool hazard = this->len() != 0 &&
+			(e.hazard(rp, rp + this->len(), true) || e.hazard(ip, ip + this->len(), true));
+		if (hazard) {
+			buffer<value_type> tmp(n);
+			for (size_t k = 0; k < n; k++) {
+				tmp.push_back(e[k]);
+			}
+			return this->assign(tmp, n);
+		}
+		return this->assign(e, n);
+	}
+
+	template <typename U>
+	split_complex& assign(const U& e, size_t n) {
+		this->resize(n);
+		T* r = rp;
+		T* i = ip;
+		for (size_t k = 0; k < n; k++) {
+			value_type z = e[k];
+			r[k] = z.real();
+			i[k] = z.imag();
+		}
+		return *this;
+	}
+
+	void resize(size_t n) {
+		while (re.len() > n) { re.pop_back(); im.pop_back(); }
+		while (re.len() < n) { re.push_back(T()); im.push_back(T()); }
+		this->sync();
+	}
+
+	value_type operator[](size_t k) const { return value_type(rp[k], ip[k]); }
+	void set(size_t k, const value_type& z) { re[k] = z.real(); im[k] = z.imag(); }
+	const valarray<T>& real() const { return re; }
+	const valarray<T>& imag() const { return im; }
+	size_t len() const { return re.len(); }
+	size_t size() const { return this->len(); }
+	bool hazard(const void* lo, const void* hi, bool elementwise) const {
+		return re.hazard(lo, hi, elementwise) || im.hazard(lo, hi, elementwise);
+	}
+	bool same(const split_complex& that) const { return this == &that; }
+};
+
+/* split_complex is a leaf like valarray: held by reference, usable as an operand */
+template <typename T>
+struct to_ref<split_complex<T>> { using type = split_complex<T>&; };
+template <typename T>
+struct is_vexpr<split_complex<T>> : std::true_type {};
+
+/* does an expression read split storage? */
+template <class E>
+struct is_split : std::false_type {};
+template <typename T>
+struct is_split<split_complex<T>> : std::true_type {};
+template <typename T>
+struct is_split<vexpr<split_complex<T>>> : std::true_type {};
+template <class Op, class L, class R>
+struct is_split<vexpr<BinaryOp<Op, L, R>>> : std::integral_constant<bool, is_split<L>::value || is_split<R>::value> {};
+template <class Op, class L>
+struct is_split<vexpr<UnaryOp<Op, L>>> : is_split<L> {};
+
+/* x * y in the component type P of the result, real operands are not promoted to complex */
+struct split_mul : op_kernel {
+	template <class R, class X, class Y>
+	static R apply(const X& x, const Y& y) { return mul<typename std::remove_const<R>::type::value_type>(x, y); }
+
+	template <class P, class A, class B>
+	static std::complex<P> mul(const std::complex<A>& x, const std::complex<B>& y) {
+		P a = x.real(), b = x.imag(), c = y.real(), d = y.imag();
+		return std::complex<P>(a * c - b * d, a * d + b * c);
+	}
+	template <class P, class A, class B>
+	static std::complex<P> mul(const std::complex<A>& x, const B& y) {
+		P c = y;
+		return std::complex<P>(P(x.real()) * c, P(x.imag()) * c);
+	}
+	template <class P, class A, class B>
+	static std::complex<P> mul(const A& x, const std::complex<B>& y) {
+		P a = x;
+		return std::complex<P>(a * P(y.real()), a * P(y.imag()));
+	}
+};
+
+/* x / y, one reciprocal of |y|^2 per element */
+struct split_div : op_kernel {
+	template <class R, class X, class Y>
+	static R apply(const X& x, const Y& y) { return div<typename std::remove_const<R>::type::value_type>(x, y); }
+
+	template <class P, class A, class B>
+	static std::complex<P> div(const std::complex<A>& x, const std::complex<B>& y) {
+		P a = x.real(), b = x.imag(), c = y.real(), d = y.imag();
+		P s = P(1) / (c * c + d * d);
+		return std::complex<P>((a * c + b * d) * s, (b * c - a * d) * s);
+	}
+	template <class P, class A, class B>
+	static std::complex<P> div(const std::complex<A>& x, const B& y) {
+		P c = y;
+		return std::complex<P>(P(x.real()) / c, P(x.imag()) / c);
+	}
+	template <class P, class A, class B>
+	static std::complex<P> div(const A& x, const std::complex<B>& y) {
+		P c = y.real(), d = y.imag();
+		P s = P(x) / (c * c + d * d);
+		return std::complex<P>(c * s, -d * s);
+	}
+};
+
+/* BinaryOp picks the kernels up through fusion (sums and differences are componentwise already) */
+template <class L, class R>
+struct fusion<multiplication<L, R>, L, R, When<is_split<L>::value || is_split<R>::value>> { using type = split_mul; };
+template <class L, class R>
+struct fusion<division<L, R>, L, R, When<is_split<L>::value || is_split<R>::value>> { using type = split_div; };
+
+/*
+ * abs, arg, conj, real and imag of any complex expression (split or not).
+ * abs scales by the larger part instead of calling hypot, so it stays
+ * overflow safe without a library call per element.
+ */
+template <class T>
+using Component = typename std::remove_const<T>::type::value_type;
+
+template <class T>
+struct complex_abs {
+	using argument_type = T;
+	using result_type = Component<T>;
+	result_type operator()(const T& z) const {
+		result_type a = std::fabs(z.real());
+		result_type b = std::fabs(z.imag());
+		/* an infinite part wins over a NaN in the other, in either order */
+		const result_type inf = std::numeric_limits<result_type>::infinity();
+		bool huge = (a == inf) || (b == inf);
+		result_type m = (a < b) ? b : a;
+		result_type r = result_type(1) / ((m == 0) ? result_type(1) : m);
+		a = a * r;
+		b = b * r;
+		result_type y = m * std::sqrt(a * a + b * b);
+		return huge ? inf : y;
+	}
+};
+template <class T>
+struct complex_arg {
+	using argument_type = T;
+	using result_type = Component<T>;
+	result_type operator()(const T& z) const { return std::atan2(z.imag(), z.real()); }
+};
+template <class T>
+struct complex_conj {
+	using argument_type = T;
+	using result_type = std::complex<Component<T>>;
+	result_type operator()(const T& z) const { return result_type(z.real(), -z.imag()); }
+};
+template <class T>
+struct complex_real {
+	using argument_type = T;
+	using result_type = Component<T>;
+	result_type operator()(const T& z) const { return z.real(); }
+};
+template <class T>
+struct complex_imag {
+	using argument_type = T;
+	using result_type = Component<T>;
+	result_type operator()(const T& z) const { return z.imag(); }
+};
+
+/* node type for the functions above, only for expressions of complex values */
+template <template <class> class Op, class E>
+using ComplexFun = typename std::enable_if<is_complex<typename std::remove_const<ValueType<E>>::type>::value,
+	UnFun<Op, E, ValueType<E>>>::type;
+
+template <template <class> class Op, class E>
+ComplexFun<Op, E> complex_fn(const E& x) {
+	using Node = UnaryFunction<Op, ValueType<E>, E>;
+	return vexpr<Node>(Node(Op<ValueType<E>>(), x));
+}
+
+template <class E>
+ComplexFun<complex_abs, E> abs(const E& x) { return complex_fn<complex_abs>(x); }
+template <class E>
+ComplexFun<complex_arg, E> arg(const E& x) { return complex_fn<complex_arg>(x); }
+template <class E>
+ComplexFun<complex_conj, E> conj(const E& x) { return complex_fn<complex_conj>(x); }
+template <class E>
+ComplexFun<complex_real, E> real(const E& x) { return complex_fn<complex_real>(x); }
+template <class E>
+ComplexFun<complex_imag, E> imag(const E& x) { return complex_fn<complex_imag>(x); }
+
+}
+
+#endif /* _SplitComplex_h */
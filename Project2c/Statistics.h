@@ -0,0 +1,217 @@
+// Statistics.h
+
+/*
+ * one pass mean, variance, skewness and covariance
+ *
+ *     double m, v;
+ *     std::tie(m, v) = reduce(exp(x), reducers::mean, reducers::variance);
+ *     statistics<double> s = std::get<0>(reduce(a * b, reducers::moments));   // s.mean, s.skewness(), ...
+ *     double c = covariance(x, y), r = correlation(x, y);
+ *
+ * these are accumulators for reduce() (Reduce.h, in epl::reducers with the
+ * others), so the expression is evaluated once, the work is spread over
+ * four lanes per block and over threads the same way, and they mix with
+ * sum, min etc. in one call.
+ *
+ * Every lane runs Welford's update (running mean and central moments, no
+ * large sums of squares to cancel), lanes, blocks and threads are combined
+ * with Chan's pairwise formulas. Integer expressions are summarized in
+ * double. variance and covariance are the population ones (divide by n),
+ * sample_variance and statistics::sample_variance() divide by n - 1. The
+ * statistics of an empty range are NaN.
+ */
+
+#ifndef _Statistics_h
+#define _Statistics_h
+
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <type_traits>
+#include <utility>
+
+#include "Reduce.h"
+#include "Valarray.h"
+
+namespace epl {
+
+/* the type statistics are kept in: floating point as it is, everything else in double */
+template <class T>
+using Real = typename std::conditional<std::is_floating_point<T>::value, T, double>::type;
+
+/* count, mean and the second and third central moments (sums of powers of x - mean) */
+template <class R>
+struct statistics {
+	R n = 0;
+	R mean = 0;
+	R m2 = 0;
+	R m3 = 0;
+
+	R variance() const { return (n > 0) ? m2 / n : std::numeric_limits<R>::quiet_NaN(); }
+	R sample_variance() const { return (n > 1) ? m2 / (n - 1) : std::numeric_limits<R>::quiet_NaN(); }
+	R skewness() const { return std::sqrt(n) * m3 / (m2 * std::sqrt(m2)); }
+
+	/* Welford */
+	void add(R x) {
+		R n1 = n;
+		n = n + 1;
+		R delta = x - mean;
+		R delta_n = delta / n;
+		R term = delta * delta_n * n1;
+		mean = mean + delta_n;
+		m3 = m3 + term * delta_n * (n - 2) - 3 * delta_n * m2;
+		m2 = m2 + term;
+	}
+
+	/* Chan et al., the moments of the union of two disjoint samples */
+	void merge(const statistics& that) {
+		if (that.n == 0) { return; }
+		if (n == 0) { *this = that; return; }
+		R na = n, nb = that.n;
+		n = na + nb;
+		R delta = that.mean - mean;
+		R delta_n = delta / n;
+		R cross = delta * delta_n * na * nb;
+		m3 = m3 + that.m3 + cross * delta_n * (na - nb) + 3 * delta_n * (na * that.m2 - nb * m2);
+		m2 = m2 + that.m2 + cross;
+		mean = mean + delta_n * nb;
+	}
+};
+
+/* the same, for pairs (x, y): both means and variances and the co-moment, sum of (x - mean x)(y - mean y) */
+template <class R>
+struct co_statistics {
+	R n = 0;
+	R mean_x = 0;
+	R mean_y = 0;
+	R m2_x = 0;
+	R m2_y = 0;
+	R c = 0;
+
+	R covariance() const { return (n > 0) ? c / n : std::numeric_limits<R>::quiet_NaN(); }
+	R sample_covariance() const { return (n > 1) ? c / (n - 1) : std::numeric_limits<R>::quiet_NaN(); }
+	R correlation() const { return c / std::sqrt(m2_x * m2_y); }
+
+	void add(R x, R y) {
+		n = n + 1;
+		R dx = x - mean_x;
+		R dy = y - mean_y;
+		mean_x = mean_x + dx / n;
+		mean_y = mean_y + dy / n;
+		R ex = x - mean_x;
+		R ey = y - mean_y;
+		m2_x = m2_x + dx * ex;
+		m2_y = m2_y + dy * ey;
+		c = c + dx * ey;
+	}
+
+	void merge(const co_statistics& that) {
+		if (that.n == 0) { return; }
+		if (n == 0) { *this = that; return; }
+		R na = n, nb = that.n;
+		n = na + nb;
+		R dx = that.mean_x - mean_x;
+		R dy = that.mean_y - mean_y;
+		R w = na * nb / n;
+		m2_x = m2_x + that.m2_x + dx * dx * w;
+		m2_y = m2_y + that.m2_y + dy * dy * w;
+		c = c + that.c + dx * dy * w;
+		mean_x = mean_x + dx * (nb / n);
+		mean_y = mean_y + dy * (nb / n);
+	}
+};
+
+/* accumulators over statistics<R>, they differ only in what they report */
+template <class Report>
+struct moment_reduction {
+	template <class T>
+	struct acc {
+		using result_type = decltype(Report::get(std::declval<statistics<Real<T>>>()));
+		statistics<Real<T>> s;
+		void add(const T& x) { s.add(x); }
+		void merge(const acc& that) { s.merge(that.s); }
+		result_type result() const { return Report::get(s); }
+	};
+};
+
+struct report_mean {
+	template <class R>
+	static R get(const statistics<R>& s) { return (s.n > 0) ? s.mean : std::numeric_limits<R>::quiet_NaN(); }
+};
+struct report_variance {
+	template <class R>
+	static R get(const statistics<R>& s) { return s.variance(); }
+};
+struct report_sample_variance {
+	template <class R>
+	static R get(const statistics<R>& s) { return s.sample_variance(); }
+};
+struct report_skewness {
+	template <class R>
+	static R get(const statistics<R>& s) { return s.skewness(); }
+};
+struct report_moments {
+	template <class R>
+	static statistics<R> get(const statistics<R>& s) { return s; }
+};
+
+namespace reducers {
+const moment_reduction<report_mean> mean{};
+const moment_reduction<report_variance> variance{};
+const moment_reduction<report_sample_variance> sample_variance{};
+const moment_reduction<report_skewness> skewness{};
+const moment_reduction<report_moments> moments{};
+}
+
+/* x and y side by side, as an expression of std::pair, for the co-moment */
+template <class X, class Y>
+struct Zip {
+	using value_type = std::pair<Element<X>, Element<Y>>;
+	const Ref<X> x;
+	const Ref<Y> y;
+	Zip(const X& x, const Y& y) : x(const_cast<X&>(x)), y(const_cast<Y&>(y)) {}
+	value_type operator[](size_t k) const { return value_type(x[k], y[k]); }
+	size_t len() const { return (x.len() < y.len()) ? x.len() : y.len(); }
+	size_t size() const { return this->len(); }
+	bool hazard(const void* lo, const void* hi, bool elementwise) const {
+		return x.hazard(lo, hi, elementwise) || y.hazard(lo, hi, elementwise);
+	}
+	bool same(const Zip& that) const { return x.same(that.x) && y.same(that.y); }
+};
+
+struct co_moment_reduction {
+	template <class T>
+	struct acc {
+		using R = Real<decltype(T().first + T().second)>;
+		using result_type = co_statistics<R>;
+		co_statistics<R> s;
+		void add(const T& p) { s.add(p.first, p.second); }
+		void merge(const acc& that) { s.merge(that.s); }
+		result_type result() const { return s; }
+	};
+};
+namespace reducers {
+const co_moment_reduction co_moments{};
+}
+
+template <class X, class Y>
+using CoStatistics = typename std::enable_if<is_vexpr<X>::value && is_vexpr<Y>::value,
+	AccResult<co_moment_reduction, std::pair<Element<X>, Element<Y>>>>::type;
+
+template <class X, class Y>
+CoStatistics<X, Y> co_statistics_of(const X& x, const Y& y) {
+	return std::get<0>(reduce(vexpr<Zip<X, Y>>(Zip<X, Y>(x, y)), reducers::co_moments));
+}
+
+template <class X, class Y>
+auto covariance(const X& x, const Y& y) -> decltype(co_statistics_of(x, y).covariance()) {
+	return co_statistics_of(x, y).covariance();
+}
+template <class X, class Y>
+auto correlation(const X& x, const Y& y) -> decltype(co_statistics_of(x, y).correlation()) {
+	return co_statistics_of(x, y).correlation();
+}
+
+}
+
+#endif /* _Statistics_h */
@@ -0,0 +1,299 @@
+// Stencil.h
+
+/*
+ * shifted reads, stencils and convolutions of expressions
+ *
+ *     valarray<double> next = shift(x, 1);                       // x[k + 1], 0 past the end
+ *     valarray<double> rot = cshift(x, -3);                      // x[(k - 3) mod n]
+ *     valarray<double> d2 = stencil<1, -2, 1>(u, boundary::clamp) / (h * h);
+ *     valarray<double> y = convolve(x, taps);                    // FIR filter, same length as x
+ *
+ * shift(e, k) is element e[i + k] (like std::valarray::shift, a positive k
+ * moves the elements towards the front), cshift(e, k) wraps around, and
+ * shift(e, k, policy) takes any of the boundary policies (in
+ * epl::boundary, clamp would be ambiguous with std::clamp otherwise):
+ *
+ *     zero     everything outside [0, n) reads as 0
+ *     clamp    reads before the front get e[0], past the end e[n - 1]
+ *     wrap     index mod n, periodic
+ *
+ * stencil<w0, w1, ..., wm-1>(e, policy) is the sum of wj e[i + j - c] with
+ * c = (m - 1) / 2, so an odd stencil is centred and stencil<-1, 1> is the
+ * forward difference. The weights are integers known at compile time, the
+ * sum is unrolled completely and 0, 1 and -1 weights cost nothing or one
+ * add. convolve(e, h, policy) takes the weights at run time and flips them,
+ * element i is the sum of h[j] e[i + c - j] (numpy's mode='same' for odd
+ * lengths). The policy defaults to zero.
+ *
+ * shift is a plain lazy node, good inside larger expressions. stencil and
+ * convolve are lazy too (each element on its own reads its m neighbours
+ * through the policy), assigning one goes through materialize(): the
+ * operand is evaluated once (unless it already is a valarray or a view),
+ * only the elements less than m taps from either end go through the
+ * boundary policy, and the interior is a branch free loop over i that the
+ * compiler vectorizes. convolve works on blocks of 64 outputs
+ * held in a local array, adding one weight times a shifted run of the
+ * input at a time, so the partial sums stay in registers while the taps
+ * stream past. Long arrays are split over threads (parallel_for).
+ *
+ * All three read the operand out of step, so assigning them to their own
+ * operand (x = shift(x, 1)) goes through a temporary, like any other
+ * hazard.
+ */
+
+#ifndef _Stencil_h
+#define _Stencil_h
+
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+
+#include "Parallel.h"
+#include "Valarray.h"
+#include "View.h"
+
+namespace epl {
+
+/* the boundary policies, at(e, j, n) is e[j] for any j */
+struct zero_padding {
+	template <class E>
+	static Element<E> at(const E& e, ptrdiff_t j, size_t n) {
+		return (j < 0 || static_cast<size_t>(j) >= n) ? Element<E>() : Element<E>(e[j]);
+	}
+};
+
+struct edge_clamping {
+	template <class E>
+	static Element<E> at(const E& e, ptrdiff_t j, size_t n) {
+		size_t k = (j < 0) ? 0 : (static_cast<size_t>(j) >= n) ? n - 1 : static_cast<size_t>(j);
+		return e[k];
+	}
+};
+
+struct wrapping {
+	template <class E>
+	static Element<E> at(const E& e, ptrdiff_t j, size_t n) {
+		ptrdiff_t m = static_cast<ptrdiff_t>(n);
+		ptrdiff_t k = j % m;
+		return e[(k < 0) ? k + m : k];
+	}
+};
+
+namespace boundary {
+const zero_padding zero{};
+const edge_clamping clamp{};
+const wrapping wrap{};
+}
+
+/* e[i + k] through the policy B */
+template <class E, class B>
+struct Shift {
+	using value_type = Element<E>;
+	const Ref<E> e;
+	const ptrdiff_t k;
+
+	Shift(const E& e, ptrdiff_t k) : e(const_cast<E&>(e)), k(k) {}
+	value_type operator[](size_t i) const { return B::at(e, static_cast<ptrdiff_t>(i) + k, e.len()); }
+	size_t len() const { return e.len(); }
+	size_t size() const { return this->len(); }
+	bool hazard(const void* lo, const void* hi, bool elementwise) const { return e.hazard(lo, hi, elementwise && k == 0); }
+	bool same(const Shift& that) const { return k == that.k && e.same(that.e); }
+};
+
+template <class E, class B = zero_padding>
+typename std::enable_if<is_vexpr<E>::value, vexpr<Shift<E, B>>>::type
+shift(const E& e, ptrdiff_t k, B = B()) {
+	return vexpr<Shift<E, B>>(Shift<E, B>(e, k));
+}
+template <class E>
+typename std::enable_if<is_vexpr<E>::value, vexpr<Shift<E, wrapping>>>::type
+cshift(const E& e, ptrdiff_t k) {
+	return vexpr<Shift<E, wrapping>>(Shift<E, wrapping>(e, k));
+}
+
+/* acc + w x, with the weights that need no multiply spelled out */
+template <int W>
+struct tap {
+	template <typename T, typename U>
+	static T add(const T& acc, const U& x) { return acc + T(W) * x; }
+};
+template <>
+struct tap<0> {
+	template <typename T, typename U>
+	static T add(const T& acc, const U& x) { return acc; }
+};
+template <>
+struct tap<1> {
+	template <typename T, typename U>
+	static T add(const T& acc, const U& x) { return acc + x; }
+};
+template <>
+struct tap<-1> {
+	template <typename T, typename U>
+	static T add(const T& acc, const U& x) { return acc - x; }
+};
+
+/* the weights one after the other: in the interior straight from src, near the ends through a policy */
+template <int... W>
+struct taps {
+	template <typename T, class S>
+	static T sum(const T& acc, const S& src, ptrdiff_t j) { return acc; }
+	template <class B, typename T, class E>
+	static T sum_at(const T& acc, const E& e, ptrdiff_t j, size_t n) { return acc; }
+};
+template <int W, int... R>
+struct taps<W, R...> {
+	template <typename T, class S>
+	static T sum(const T& acc, const S& src, ptrdiff_t j) {
+		return taps<R...>::sum(tap<W>::add(acc, src[j]), src, j + 1);
+	}
+	template <class B, typename T, class E>
+	static T sum_at(const T& acc, const E& e, ptrdiff_t j, size_t n) {
+		return taps<R...>::template sum_at<B>(tap<W>::add(acc, B::at(e, j, n)), e, j + 1, n);
+	}
+};
+
+/*
+ * what stencils and convolutions share: the output is split into the part
+ * whose taps all fall inside [0, n) and the parts near the ends, which go
+ * through the policy. Output i reads K::before() elements in front of i and
+ * K::after() behind it, K::interior and K::edge do the work.
+ */
+template <class K, class E, class B>
+struct Windowed {
+	using value_type = Element<E>;
+	const Ref<E> e;
+	static const size_t grain = 64 * 1024;
+
+	Windowed(const E& e) : e(const_cast<E&>(e)) {}
+	size_t len() const { return e.len(); }
+	size_t size() const { return this->len(); }
+	bool hazard(const void* lo, const void* hi, bool elementwise) const { return e.hazard(lo, hi, false); }
+
+	void materialize(value_type* out) const {
+		evaluation scope(e);
+		this->run(out, direct<E>());
+	}
+
+	void run(value_type* out, std::true_type) const { this->run_on(source(static_cast<const E&>(e)), out); }
+	void run(value_type* out, std::false_type) const {
+		valarray<value_type> tmp = static_cast<const E&>(e);
+		this->run_on(source(tmp), out);
+	}
+
+	template <class S>
+	void run_on(const S& src, value_type* out) const {
+		const K& self = static_cast<const K&>(*this);
+		size_t n = this->len();
+		/* the outputs whose taps i - before .. i + after are all inside */
+		size_t first = self.before(), last = (n > self.after()) ? n - self.after() : 0;
+		if (last < first) { last = first; }
+		parallel_for(n, pieces(n, grain), [&](size_t piece, size_t lo, size_t hi) {
+			size_t a = (lo < first) ? first : lo;
+			size_t b = (hi < last) ? hi : last;
+			if (b < a) { b = a; }
+			for (size_t i = lo; i < a && i < hi; i++) { out[i] = self.edge(i); }
+			if (a < b) { self.interior(src, out, a, b); }
+			for (size_t i = (b > lo) ? b : lo; i < hi; i++) { out[i] = self.edge(i); }
+		});
+	}
+};
+
+/* the compile-time stencil */
+template <class E, class B, int... W>
+struct Stencil : Windowed<Stencil<E, B, W...>, E, B> {
+	using base = Windowed<Stencil<E, B, W...>, E, B>;
+	using value_type = Element<E>;
+	static const size_t m = sizeof...(W);
+
+	Stencil(const E& e) : base(e) {}
+	size_t centre() const { return (m - 1) / 2; }
+	size_t before() const { return this->centre(); }
+	size_t after() const { return m - 1 - this->centre(); }
+
+	value_type operator[](size_t i) const { return this->edge(i); }
+	value_type edge(size_t i) const {
+		ptrdiff_t j = static_cast<ptrdiff_t>(i) - static_cast<ptrdiff_t>(this->centre());
+		return taps<W...>::template sum_at<B>(value_type(), this->e, j, this->len());
+	}
+	template <class S>
+	void interior(const S& src, value_type* out, size_t a, size_t b) const {
+		ptrdiff_t c = static_cast<ptrdiff_t>(this->centre());
+		for (size_t i = a; i < b; i++) {
+			out[i] = taps<W...>::sum(value_type(), src, static_cast<ptrdiff_t>(i) - c);
+		}
+	}
+	bool same(const Stencil& that) const { return this->e.same(that.e); }
+};
+
+template <int... W, class E, class B = zero_padding>
+typename std::enable_if<is_vexpr<E>::value && sizeof...(W) != 0, vexpr<Stencil<E, B, W...>>>::type
+stencil(const E& e, B = B()) {
+	return vexpr<Stencil<E, B, W...>>(Stencil<E, B, W...>(e));
+}
+
+/* the run time convolution, the weights are copied into a buffer the copies of the node share */
+template <class E, class B>
+struct Convolution : Windowed<Convolution<E, B>, E, B> {
+	using base = Windowed<Convolution<E, B>, E, B>;
+	using value_type = Element<E>;
+	std::shared_ptr<buffer<value_type>> h;
+
+	template <class H>
+	Convolution(const E& e, const H& weights) : base(e), h(std::make_shared<buffer<value_type>>(weights.len())) {
+		for (size_t j = 0; j < weights.len(); j++) {
+			h->push_back(weights[j]);
+		}
+	}
+	size_t centre() const { return (h->len() == 0) ? 0 : (h->len() - 1) / 2; }
+	/* flipped, the weight at j reads i + c - j */
+	size_t before() const { return (h->len() == 0) ? 0 : h->len() - 1 - this->centre(); }
+	size_t after() const { return this->centre(); }
+
+	value_type operator[](size_t i) const { return this->edge(i); }
+	value_type edge(size_t i) const {
+		const buffer<value_type>& w = *h;
+		ptrdiff_t j0 = static_cast<ptrdiff_t>(i + this->centre());
+		value_type acc = value_type();
+		for (size_t j = 0; j < w.len(); j++) {
+			acc = acc + w[j] * B::at(this->e, j0 - static_cast<ptrdiff_t>(j), this->len());
+		}
+		return acc;
+	}
+
+	/* see the top of the file: a block of sums, one weight at a time */
+	template <class S>
+	void interior(const S& src, value_type* out, size_t a, size_t b) const {
+		const size_t block = 64;
+		const buffer<value_type>& w = *h;
+		size_t m = w.len(), c = this->centre();
+		value_type acc[block];
+		for (size_t i0 = a; i0 < b; i0 += block) {
+			size_t len = (b - i0 < block) ? b - i0 : block;
+			for (size_t i = 0; i < block; i++) {
+				acc[i] = value_type();
+			}
+			for (size_t j = 0; j < m; j++) {
+				const value_type wj = w[j];
+				size_t from = i0 + c - j;
+				for (size_t i = 0; i < len; i++) {
+					acc[i] = acc[i] + wj * src[from + i];
+				}
+			}
+			for (size_t i = 0; i < len; i++) {
+				out[i0 + i] = acc[i];
+			}
+		}
+	}
+	bool same(const Convolution& that) const { return h == that.h && this->e.same(that.e); }
+};
+
+template <class E, class H, class B = zero_padding>
+typename std::enable_if<is_vexpr<E>::value && is_vexpr<H>::value, vexpr<Convolution<E, B>>>::type
+convolve(const E& e, const H& h, B = B()) {
+	return vexpr<Convolution<E, B>>(Convolution<E, B>(e, h));
+}
+
+}
+
+#endif /* _Stencil_h */
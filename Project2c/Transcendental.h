@@ -0,0 +1,269 @@
+// Transcendental.h
+
+/*
+ * exp, log, sin, cos, tanh, pow and sqrt as valarray expression nodes
+ *
+ *     valarray<double> y = epl::exp(x) * epl::sin(2.0 * x);   // libm, <= 1 ulp
+ *     valarray<double> z = epl::exp<fast>(x);                 // < 1e-8 relative
+ *
+ * precise calls the std:: function for every element. fast uses the
+ * polynomial kernels below for float and double: range reduction, a short
+ * polynomial and exponent bit twiddling, written with selects instead of
+ * branches and without table lookups so the compiler can vectorize them
+ * (sin and cos keep one branch, to libm for |x| >= 1e5). Their relative
+ * error is below 1e-8, comfortably inside the 1e-7 budget. Integer elements
+ * are computed in double, long double and complex elements always take the
+ * std:: path (in both tiers).
+ *
+ * There are no float kernels: float elements are widened, run through the
+ * double kernels and rounded back. The results are as good as a float can
+ * hold, but a vectorized float loop only gets the double lane count, half
+ * of what a float kernel would.
+ */
+
+#ifndef _Transcendental_h
+#define _Transcendental_h
+
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+#include "Valarray.h"
+
+namespace epl {
+
+/* accuracy tiers */
+struct precise {};
+struct fast {};
+
+/* the fast kernels, all in double */
+namespace kernel {
+
+inline uint64_t bits(double x) { uint64_t b; std::memcpy(&b, &x, sizeof(b)); return b; }
+inline double from_bits(uint64_t b) { double x; std::memcpy(&x, &b, sizeof(x)); return x; }
+
+/* 2^n for -1022 <= n <= 1023 */
+inline double pow2(int64_t n) { return from_bits(static_cast<uint64_t>(n + 1023) << 52); }
+
+/* round to nearest for |x| < 2^51 (std::floor keeps gcc from vectorizing) */
+inline double round(double x) {
+	const double magic = 6755399441055744.0; // 1.5 * 2^52
+	return (x + magic) - magic;
+}
+
+/* exp(x) = 2^n * e^r, |r| <= ln(2)/2 */
+inline double exp(double x) {
+	const double log2e = 1.4426950408889634074;
+	const double ln2_hi = 6.93147180369123816490e-01;
+	const double ln2_lo = 1.90821492927058770002e-10;
+	double xc = (x < -745.2) ? -745.2 : ((x > 709.8) ? 709.8 : x);
+	double n = kernel::round(xc * log2e);
+	double r = (xc - n * ln2_hi) - n * ln2_lo;
+	double p = 1.0 + r * (1.0 + r * (1.0 / 2 + r * (1.0 / 6 + r * (1.0 / 24 + r * (1.0 / 120 +
+		r * (1.0 / 720 + r * (1.0 / 5040 + r * (1.0 / 40320 + r * (1.0 / 362880)))))))));
+	/* scale in two halves so subnormal results and 2^1024 * p < max still work */
+	int64_t k = static_cast<int64_t>(n);
+	double y = p * pow2(k / 2) * pow2(k - k / 2);
+	y = (x > 709.79) ? std::numeric_limits<double>::infinity() : y;
+	y = (x < -745.2) ? 0.0 : y;
+	return (x != x) ? x : y;
+}
+
+/* log(x) = e * ln(2) + log(m), m in [sqrt(1/2), sqrt(2)), log(m) = 2 atanh(s) */
+inline double log(double x) {
+	const double ln2_hi = 6.93147180369123816490e-01;
+	const double ln2_lo = 1.90821492927058770002e-10;
+	bool tiny = x < std::numeric_limits<double>::min();
+	uint64_t b = bits(x * (tiny ? 18014398509481984.0 : 1.0)); // 2^54
+	/* the exponent field as a double without an int to double conversion */
+	double e = from_bits(0x4330000000000000ULL | ((b >> 52) & 0x7ff)) - (4503599627370496.0 + 1023.0);
+	e = e - (tiny ? 54.0 : 0.0);
+	double m = from_bits((b & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL);
+	bool big = m > 1.41421356237309504880;
+	m = m * (big ? 0.5 : 1.0);
+	e = e + (big ? 1.0 : 0.0);
+	double f = m - 1.0;
+	double s = f / (2.0 + f);
+	double z = s * s;
+	double r = z * (1.0 / 3 + z * (1.0 / 5 + z * (1.0 / 7 + z * (1.0 / 9 + z * (1.0 / 11 + z * (1.0 / 13))))));
+	double y = e * ln2_hi + (2.0 * s + (2.0 * s * r + e * ln2_lo));
+	/* 0, negative, inf and nan all in one select */
+	double inf = std::numeric_limits<double>::infinity();
+	double odd = (x == 0.0) ? -inf : ((x < 0.0) ? std::numeric_limits<double>::quiet_NaN() : x);
+	return (x > 0.0 && x < inf) ? y : odd;
+}
+
+/* sin and cos of r for |r| <= pi/4 */
+inline double sin_poly(double r) {
+	double s = r * r;
+	return r + r * s * (-1.0 / 6 + s * (1.0 / 120 + s * (-1.0 / 5040 + s * (1.0 / 362880 +
+		s * (-1.0 / 39916800 + s * (1.0 / 6227020800.0))))));
+}
+inline double cos_poly(double r) {
+	double s = r * r;
+	return 1.0 + s * (-1.0 / 2 + s * (1.0 / 24 + s * (-1.0 / 720 + s * (1.0 / 40320 +
+		s * (-1.0 / 3628800 + s * (1.0 / 479001600.0))))));
+}
+
+/*
+ * x = n * pi/2 + r, three part Cody-Waite reduction (exact products for
+ * |n| < 2^20), so only |x| below 1e5 takes the fast path
+ */
+inline double reduce(double x, int64_t& q) {
+	const double pio2_1 = 1.57079632673412561417e+00;
+	const double pio2_2 = 6.07710050630396597660e-11;
+	const double pio2_3 = 2.02226624879595063154e-21;
+	double n = kernel::round(x * 0.63661977236758134308);
+	q = static_cast<int64_t>(n);
+	return ((x - n * pio2_1) - n * pio2_2) - n * pio2_3;
+}
+
+inline double sin(double x) {
+	if (!(std::fabs(x) < 1.0e5)) { return std::sin(x); }
+	int64_t q;
+	double r = reduce(x, q);
+	double s = sin_poly(r);
+	double c = cos_poly(r);
+	double y = (q & 1) ? c : s;
+	return (q & 2) ? -y : y;
+}
+
+inline double cos(double x) {
+	if (!(std::fabs(x) < 1.0e5)) { return std::cos(x); }
+	int64_t q;
+	double r = reduce(x, q);
+	double s = sin_poly(r);
+	double c = cos_poly(r);
+	double y = (q & 1) ? -s : c;
+	return (q & 2) ? -y : y;
+}
+
+/* Taylor series near zero, 1 - 2 / (e^2x + 1) elsewhere */
+inline double tanh(double x) {
+	double a = std::fabs(x);
+	double z = x * x;
+	double small = x * (1.0 + z * (-1.0 / 3 + z * (2.0 / 15 + z * (-17.0 / 315 + z * (62.0 / 2835 +
+		z * (-1382.0 / 155925 + z * (21844.0 / 6081075 + z * (-929569.0 / 638512875 +
+		z * (6404582.0 / 10854718875.0)))))))));
+	double large = 1.0 - 2.0 / (kernel::exp(2.0 * a) + 1.0);
+	large = (x < 0) ? -large : large;
+	return (a < 0.5) ? small : large;
+}
+
+inline double pow(double x, double y) {
+	if (y == 0.0) { return 1.0; }
+	if (x > 0.0) { return kernel::exp(y * kernel::log(x)); }
+	if (x == 0.0) { return (y > 0.0) ? 0.0 : std::numeric_limits<double>::infinity(); }
+	if (x != x || std::floor(y) != y) { return std::numeric_limits<double>::quiet_NaN(); }
+	double r = kernel::exp(y * kernel::log(-x));
+	return (std::fmod(y, 2.0) != 0.0) ? -r : r;
+}
+
+}
+
+/* integers are computed in double, everything else in its own type */
+template <class T>
+using Promote = typename std::conditional<std::is_integral<T>::value, double, T>::type;
+
+/*
+ * a functor for UnaryFunction: Fn::precise(x) is the std:: version,
+ * Fn::fast(x) the kernel for double (float goes through double)
+ */
+template <class Fn, class Tier>
+struct math_fn {
+	template <class T>
+	struct op {
+		using argument_type = T;
+		using result_type = Promote<T>;
+		result_type operator()(const T& x) const { return eval(Tier(), Promote<T>(x)); }
+
+		template <class U>
+		static U eval(precise, const U& x) { return Fn::precise(x); }
+		template <class U>
+		static U eval(fast, const U& x) { return Fn::precise(x); }
+		static double eval(fast, double x) { return Fn::fast(x); }
+		static float eval(fast, float x) { return static_cast<float>(Fn::fast(x)); }
+	};
+};
+
+struct exp_fn {
+	template <class T> static T precise(const T& x) { return std::exp(x); }
+	static double fast(double x) { return kernel::exp(x); }
+};
+struct log_fn {
+	template <class T> static T precise(const T& x) { return std::log(x); }
+	static double fast(double x) { return kernel::log(x); }
+};
+struct sin_fn {
+	template <class T> static T precise(const T& x) { return std::sin(x); }
+	static double fast(double x) { return kernel::sin(x); }
+};
+struct cos_fn {
+	template <class T> static T precise(const T& x) { return std::cos(x); }
+	static double fast(double x) { return kernel::cos(x); }
+};
+struct tanh_fn {
+	template <class T> static T precise(const T& x) { return std::tanh(x); }
+	static double fast(double x) { return kernel::tanh(x); }
+};
+struct sqrt_fn {
+	template <class T> static T precise(const T& x) { return std::sqrt(x); }
+	static double fast(double x) { return std::sqrt(x); }
+};
+
+/* type alias for the node built by exp(x) and friends */
+template <class Fn, class Tier, class E>
+using MathFun = UnFun<math_fn<Fn, Tier>::template op, E, ValueType<E>>;
+
+template <class Fn, class Tier, class E>
+MathFun<Fn, Tier, E> math(const E& x) {
+	using Op = UnaryFunction<math_fn<Fn, Tier>::template op, ValueType<E>, E>;
+	return vexpr<Op>(Op(typename math_fn<Fn, Tier>::template op<ValueType<E>>(), x));
+}
+
+template <class Tier = precise, class E>
+MathFun<exp_fn, Tier, E> exp(const E& x) { return math<exp_fn, Tier>(x); }
+template <class Tier = precise, class E>
+MathFun<log_fn, Tier, E> log(const E& x) { return math<log_fn, Tier>(x); }
+template <class Tier = precise, class E>
+MathFun<sin_fn, Tier, E> sin(const E& x) { return math<sin_fn, Tier>(x); }
+template <class Tier = precise, class E>
+MathFun<cos_fn, Tier, E> cos(const E& x) { return math<cos_fn, Tier>(x); }
+template <class Tier = precise, class E>
+MathFun<tanh_fn, Tier, E> tanh(const E& x) { return math<tanh_fn, Tier>(x); }
+template <class Tier = precise, class E>
+MathFun<sqrt_fn, Tier, E> sqrt(const E& x) { return math<sqrt_fn, Tier>(x); }
+
+/* pow(x, y) for two expressions or an expression and a scalar exponent */
+template <class Tier, class X, class Y>
+struct power {
+	using R = decltype(std::pow(std::declval<ValueType<X>>(), std::declval<ValueType<Y>>()));
+	R operator()(const ValueType<X>& x, const ValueType<Y>& y) const { return eval(Tier(), x, y, R()); }
+
+	template <class A, class B, class U>
+	static U eval(precise, const A& x, const B& y, U) { return std::pow(x, y); }
+	template <class A, class B, class U>
+	static U eval(fast, const A& x, const B& y, U) { return std::pow(x, y); }
+	template <class A, class B>
+	static double eval(fast, const A& x, const B& y, double) { return kernel::pow(x, y); }
+	template <class A, class B>
+	static float eval(fast, const A& x, const B& y, float) { return static_cast<float>(kernel::pow(x, y)); }
+};
+
+template <class Tier, class X, class Y>
+using Pow = typename std::enable_if<is_vexpr<X>::value && is_vexpr<Y>::value,
+	vexpr<BinaryOp<power<Tier, X, Y>, X, Y>>>::type;
+
+template <class Tier = precise, class X, class Y>
+Pow<Tier, X, Y> pow(const X& x, const Y& y) {
+	using Op = BinaryOp<power<Tier, X, Y>, X, Y>;
+	return vexpr<Op>(Op(power<Tier, X, Y>(), x, y));
+}
+template <class Tier = precise, class X, class U, typename = is_easy_math<U>>
+Pow<Tier, X, UnVal<U>> pow(const X& x, const U& y) { return pow<Tier>(x, UnVal<U>(UnaryVal<U>(y))); }
+
+}
+
+#endif /* _Transcendental_h */
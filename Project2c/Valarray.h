@@ -14,20 +14,54 @@
 #ifndef _Valarray_h
 #define _Valarray_h
 
+#include <cassert>
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
 
 // #include <vector>
 // using std::vector; // during development and testing
+#include "Parallel.h"
 #include "Vector.h"
 using epl::vector; // after submission
 
 namespace epl {
 
-/* declare these up front */
-template <typename T>
+/* declare these up front, valarray<T> grows at run time, valarray<T, N> has N elements inline */
+const size_t dynamic_extent = SIZE_MAX;
+template <typename T, size_t N = dynamic_extent>
 struct valarray;
 template <typename T>
+struct storage_ref;
+template <typename T>
 struct vexpr;
+template <class Op, class Lhs, class Rhs, class = void>
+struct fusion;
+template <template <class, class> class Op, class Lhs, class Rhs, class = void>
+struct rewrite;
+template <template <class> class Op, class Lhs, class = void>
+struct rewrite_unary;
+template <typename T>
+struct Cached;
+
+/* kernel tags a BinaryOp can be lowered to (a*b + c, c + a*b, a*b - c, c - a*b) */
+struct no_fusion {};
+struct mul_add {};
+struct add_mul {};
+struct mul_sub {};
+struct sub_mul {};
+
+/* x / c evaluated as x * (1 / c) when that is exact (see UnaryDivisor) */
+struct by_reciprocal {};
+
+/* a kernel tag that replaces op(x, y) itself with Tag::apply<R>(x, y) (see SplitComplex.h) */
+struct op_kernel {};
 
 /* type alias to detect numeric types */
 template <typename T> struct is_complex : public std::false_type {};
@@ -35,10 +69,20 @@ template <typename T> struct is_complex<std::complex<T>> : public std::true_type
 
 /*
  * return true for all math-y types, could be more restrictive,
- * but I like the idea of allowing unsigned long long
+ * but I like the idea of allowing unsigned long long (and floating
+ * point scalars, so 2.0 * x + y can be fused)
+ */
+template <typename T>
+using is_easy_math = typename std::enable_if<std::is_arithmetic<T>::value || is_complex<T>::value>::type;
+
+/*
+ * valarray storage: starts on a cache line and is padded to whole cache
+ * lines (aligned_layout in Vector.h), so vectorized loops over it never
+ * need an unaligned load and may run on to the end of the last line
  */
+const size_t valarray_alignment = 64;
 template <typename T>
-using is_easy_math = typename std::enable_if<std::is_integral<T>::value || is_complex<T>::value>::type;
+using valarray_storage = vector<T, aligned_layout<valarray_alignment>>;
 
 /*
  * Proxy should store a reference to a vector but a copy of a Proxy.
@@ -49,7 +93,9 @@ struct to_ref { using type = T; };
 template<typename T>
 struct to_ref<vector<T>> { using type = vector<T>&; };
 template<typename T>
-struct to_ref<valarray<T>> { using type = valarray<T>&; };
+struct to_ref<valarray<T>> { using type = storage_ref<T>; };
+template<typename T, size_t N>
+struct to_ref<valarray<T, N>> { using type = valarray<T, N>&; };
 template<typename T>
 using Ref = typename to_ref<T>::type;
 
@@ -96,6 +142,29 @@ using ConditionalComplex = typename std::conditional<
 template <class T, class U>
 using CondComp = ConditionalComplex<ValueType<T>, ValueType<U>>;
 
+/*
+ * how an expression holds on to a valarray: by reference, reading the
+ * storage straight through an aligned pointer. Every node should already
+ * stop at len(), a read past it (a node that forgot to) is only caught by
+ * the assert in debug builds. Reads in the padding of the last block are
+ * allowed, the whole block loops of valarray::fill make them.
+ */
+template <typename T>
+struct storage_ref {
+	using value_type = T;
+	valarray<T>* a;
+	storage_ref(valarray<T>& a) : a(&a) {}
+	operator valarray<T>&() const { return *a; }
+	const T& operator[](size_t k) const {
+		assert(k < (a->len() + valarray_storage<T>::lanes - 1) / valarray_storage<T>::lanes * valarray_storage<T>::lanes);
+		return assume_aligned<valarray_alignment>(a->data())[k];
+	}
+	size_t len() const { return a->len(); }
+	size_t size() const { return this->len(); }
+	bool hazard(const void* lo, const void* hi, bool elementwise) const { return a->hazard(lo, hi, elementwise); }
+	bool same(const storage_ref& that) const { return a == that.a; }
+};
+
 /* a very special vexpr, returns the same value no matter what */
 template <class T>
 struct UnaryVal {
@@ -105,8 +174,69 @@ struct UnaryVal {
 	T operator[](size_t k) const { return v; }
 	size_t len() const { return SIZE_MAX; }
 	size_t size() const { return this->len(); }
+	bool hazard(const void* lo, const void* hi, bool elementwise) const { return false; }
+	bool same(const UnaryVal& that) const { return v == that.v; }
+};
+
+/*
+ * a compile-time scalar, the rewrite layer folds x * constant<1>(),
+ * x + constant<0>() etc. away before anything is evaluated
+ */
+template <int N>
+struct UnaryConst {
+	using value_type = int;
+	static constexpr int value = N;
+	int operator[](size_t k) const { return N; }
+	size_t len() const { return SIZE_MAX; }
+	size_t size() const { return this->len(); }
+	bool hazard(const void* lo, const void* hi, bool elementwise) const { return false; }
+	bool same(const UnaryConst& that) const { return true; }
+};
+
+/*
+ * the scalar of x / c for floating point c. when c is a power of two with
+ * a finite reciprocal, x * (1 / c) rounds the same exact value as x / c and
+ * the division is evaluated as that multiply (by_reciprocal), any other c
+ * is divided by as written.
+ */
+template <class T>
+struct UnaryDivisor {
+	using value_type = T;
+	T v;
+	T reciprocal;
+	bool exact;
+	UnaryDivisor(const T v) : v(v), reciprocal(T(1) / v), exact(false) {
+		int e;
+		T m = std::frexp(v, &e);
+		exact = (m == T(0.5) || m == T(-0.5)) && std::isfinite(reciprocal);
+	}
+	T operator[](size_t k) const { return v; }
+	size_t len() const { return SIZE_MAX; }
+	size_t size() const { return this->len(); }
+	bool hazard(const void* lo, const void* hi, bool elementwise) const { return false; }
+	bool same(const UnaryDivisor& that) const { return v == that.v; }
 };
 
+/*
+ * aliasing: every vexpr node has a hazard(lo, hi, elementwise) member that
+ * says whether writing the destination storage [lo, hi) element by element
+ * could clobber something the expression still has to read. Nodes that read
+ * element k to produce element k pass elementwise through, anything that
+ * reads other positions (shifts, permutations) must pass false to its
+ * operands. Only valarray storage itself can actually answer true.
+ *
+ * common subexpressions: every node also has same(that), true when both
+ * nodes are guaranteed to produce the same values (same operands, stateless
+ * ops). A BinaryOp whose two sides are the same computes them only once.
+ * Only direct siblings are caught, x op x: in sqrt(a) * b + sqrt(a) the two
+ * sqrt(a) sit at different depths and are each computed. Assign such a
+ * repeat to a valarray of its own to compute it once.
+ */
+template <class A, class B>
+bool twins(const A& a, const B& b) { return false; }
+template <class A>
+bool twins(const A& a, const A& b) { return a.same(b); }
+
 /* unary function vexpr (used for things like negation, sqrt, etc.) */
 template <class Op, class Lhs>
 struct UnaryOp {
@@ -117,19 +247,91 @@ struct UnaryOp {
 	CondComp<Lhs, Lhs> operator[](size_t k) const { return op(lhs[k]); }
 	size_t len() const { return lhs.len(); }
 	size_t size() const { return this->len(); }
+	bool hazard(const void* lo, const void* hi, bool elementwise) const { return lhs.hazard(lo, hi, elementwise); }
+	bool same(const UnaryOp& that) const { return std::is_empty<Op>::value && lhs.same(that.lhs); }
 };
 
+/*
+ * a * b + c for the fused kernels: std::fma where it is an instruction
+ * (FP_FAST_FMA and friends), otherwise it would be a library call per
+ * element and the two-step expression is used instead
+ */
+inline float fused(float a, float b, float c) {
+#ifdef FP_FAST_FMAF
+	return std::fma(a, b, c);
+#else
+	return a * b + c;
+#endif
+}
+inline double fused(double a, double b, double c) {
+#ifdef FP_FAST_FMA
+	return std::fma(a, b, c);
+#else
+	return a * b + c;
+#endif
+}
+inline long double fused(long double a, long double b, long double c) {
+#ifdef FP_FAST_FMAL
+	return std::fma(a, b, c);
+#else
+	return a * b + c;
+#endif
+}
+
 /* binary function vexpr (used for things like addition, subtraction, etc.) */
 template <class Op, class Lhs, class Rhs>
 struct BinaryOp {
 	const Op op;
 	const Ref<Lhs> lhs;
 	const Ref<Rhs> rhs;
+	const bool twin;
 	using value_type = decltype(op(lhs[0], rhs[0]));
-	BinaryOp(const Op& op, const Lhs& lhs, const Rhs& rhs) : op(op), lhs(const_cast<Lhs&>(lhs)), rhs(const_cast<Rhs&>(rhs)) {}
-	auto operator[](size_t k) const -> decltype(op(lhs[k], rhs[k])) { return op(lhs[k], rhs[k]); }
+	BinaryOp(const Op& op, const Lhs& lhs, const Rhs& rhs) :
+		op(op), lhs(const_cast<Lhs&>(lhs)), rhs(const_cast<Rhs&>(rhs)), twin(twins(this->lhs, this->rhs)) {}
+	auto operator[](size_t k) const -> decltype(op(lhs[k], rhs[k])) {
+		return twin ? eval(k, typename std::is_same<Lhs, Rhs>::type()) : eval(k, typename fusion<Op, Lhs, Rhs>::type());
+	}
 	size_t len() const { return (lhs.len() < rhs.len()) ? lhs.len() : rhs.len(); }
 	size_t size() const { return this->len(); }
+	bool hazard(const void* lo, const void* hi, bool elementwise) const {
+		return lhs.hazard(lo, hi, elementwise) || rhs.hazard(lo, hi, elementwise);
+	}
+	bool same(const BinaryOp& that) const { return std::is_empty<Op>::value && lhs.same(that.lhs) && rhs.same(that.rhs); }
+
+	/* x op x, evaluate x once (twin is never set unless Lhs and Rhs match) */
+	value_type eval(size_t k, std::true_type) const {
+		auto x = lhs[k];
+		return join(x, x, typename fusion<Op, Lhs, Rhs>::type());
+	}
+	value_type eval(size_t k, std::false_type) const { return op(lhs[k], rhs[k]); }
+
+	/* op(x, y), or the op_kernel standing in for it */
+	template <class Tag>
+	value_type eval(size_t k, Tag) const { return join(lhs[k], rhs[k], Tag()); }
+	template <class X, class Y, class Tag>
+	value_type join(const X& x, const Y& y, Tag) const { return join(x, y, Tag(), std::is_base_of<op_kernel, Tag>()); }
+	template <class X, class Y, class Tag>
+	value_type join(const X& x, const Y& y, Tag, std::false_type) const { return op(x, y); }
+	template <class X, class Y, class Tag>
+	value_type join(const X& x, const Y& y, Tag, std::true_type) const { return Tag::template apply<value_type>(x, y); }
+
+	/* one eval per kernel tag, see fusion below (only the chosen one is instantiated) */
+	value_type eval(size_t k, no_fusion) const { return op(lhs[k], rhs[k]); }
+	value_type eval(size_t k, mul_add) const {
+		return fused(value_type(lhs.v.lhs[k]), value_type(lhs.v.rhs[k]), value_type(rhs[k]));
+	}
+	value_type eval(size_t k, add_mul) const {
+		return fused(value_type(rhs.v.lhs[k]), value_type(rhs.v.rhs[k]), value_type(lhs[k]));
+	}
+	value_type eval(size_t k, mul_sub) const {
+		return fused(value_type(lhs.v.lhs[k]), value_type(lhs.v.rhs[k]), -value_type(rhs[k]));
+	}
+	value_type eval(size_t k, sub_mul) const {
+		return fused(-value_type(rhs.v.lhs[k]), value_type(rhs.v.rhs[k]), value_type(lhs[k]));
+	}
+	value_type eval(size_t k, by_reciprocal) const {
+		return rhs.v.exact ? value_type(value_type(lhs[k]) * rhs.v.reciprocal) : op(lhs[k], rhs[k]);
+	}
 };
 
 /* unary function vexpr (used for things like apply) */
@@ -142,6 +344,8 @@ struct UnaryFunction {
 	value_type operator[](size_t k) const { return op(static_cast<T>(lhs[k])); }
 	size_t len() const { return lhs.len(); }
 	size_t size() const { return this->len(); }
+	bool hazard(const void* lo, const void* hi, bool elementwise) const { return lhs.hazard(lo, hi, elementwise); }
+	bool same(const UnaryFunction& that) const { return std::is_empty<Op<T>>::value && lhs.same(that.lhs); }
 };
 
 /* 
@@ -155,7 +359,7 @@ struct unary_negate : std::unary_function<ValueType<T>, ValueType<T>> {
 };
 template <class T>
 struct unary_sqrt : std::unary_function<T, T> {
-	T operator()(const T& x) const { return sqrt(x); }
+	T operator()(const T& x) const { return std::sqrt(x); }
 };
 template <class T, class U>
 struct addition : std::binary_function<ValueType<T>, ValueType<U>, ValueType<T>> {
@@ -190,6 +394,68 @@ struct division : std::binary_function<ValueType<T>, ValueType<U>, ValueType<T>>
 	}
 };
 
+/*
+ * fused multiply-add recognition: a BinaryOp adding (or subtracting) a product
+ * is evaluated with a single std::fma, which rounds once instead of twice,
+ * when the target has an fma instruction (see fused above, without one
+ * the kernel is the plain a * b + c). We only fuse when the product is a
+ * real floating type and the addend does not promote it (so the result
+ * type is unchanged), everything else stays a plain two-step evaluation.
+ */
+template <class A, class B>
+using Product = vexpr<BinaryOp<multiplication<A, B>, A, B>>;
+
+template <class P, class C>
+using can_fuse = std::integral_constant<bool,
+	std::is_floating_point<ValueType<P>>::value &&
+	std::is_arithmetic<ValueType<C>>::value &&
+	std::is_same<typename std::common_type<ValueType<P>, ValueType<C>>::type, ValueType<P>>::value>;
+
+template <bool Fuse, class Kernel>
+using FuseIf = typename std::conditional<Fuse, Kernel, no_fusion>::type;
+
+template <class Op, class Lhs, class Rhs, class>
+struct fusion { using type = no_fusion; };
+template <class A, class B, class C>
+struct fusion<addition<Product<A, B>, C>, Product<A, B>, C> {
+	using type = FuseIf<can_fuse<Product<A, B>, C>::value, mul_add>;
+};
+template <class C, class A, class B>
+struct fusion<addition<C, Product<A, B>>, C, Product<A, B>> {
+	using type = FuseIf<can_fuse<Product<A, B>, C>::value, add_mul>;
+};
+template <class A, class B, class C, class D>
+struct fusion<addition<Product<A, B>, Product<C, D>>, Product<A, B>, Product<C, D>> {
+	using type = FuseIf<can_fuse<Product<A, B>, Product<C, D>>::value, mul_add>;
+};
+template <class A, class B, class C>
+struct fusion<subtraction<Product<A, B>, C>, Product<A, B>, C> {
+	using type = FuseIf<can_fuse<Product<A, B>, C>::value, mul_sub>;
+};
+template <class C, class A, class B>
+struct fusion<subtraction<C, Product<A, B>>, C, Product<A, B>> {
+	using type = FuseIf<can_fuse<Product<A, B>, C>::value, sub_mul>;
+};
+template <class A, class B, class C, class D>
+struct fusion<subtraction<Product<A, B>, Product<C, D>>, Product<A, B>, Product<C, D>> {
+	using type = FuseIf<can_fuse<Product<A, B>, Product<C, D>>::value, mul_sub>;
+};
+
+/* real x / c for floating point c, complex quotients are left alone */
+template <class A, class T>
+struct fusion<division<A, vexpr<UnaryDivisor<T>>>, A, vexpr<UnaryDivisor<T>>,
+	typename std::enable_if<std::is_arithmetic<ValueType<A>>::value>::type> {
+	using type = by_reciprocal;
+};
+
+/* which kernel an expression was lowered to (handy for static_assert) */
+template <class Expr>
+struct kernel_of { using type = no_fusion; };
+template <class Op, class Lhs, class Rhs>
+struct kernel_of<vexpr<BinaryOp<Op, Lhs, Rhs>>> { using type = typename fusion<Op, Lhs, Rhs>::type; };
+template <class Expr>
+using Kernel = typename kernel_of<Expr>::type;
+
 /* type aliases to verify template arguments are actually valarrays */
 template<class VExpr>
 struct is_vexpr : std::false_type {};
@@ -197,17 +463,26 @@ template<class VExpr>
 struct is_vexpr<vexpr<VExpr>> : std::true_type {};
 template<typename T>
 struct is_vexpr<valarray<T>> : std::true_type {};
+template<typename T, size_t N>
+struct is_vexpr<valarray<T, N>> : std::true_type {};
 template<typename U>
 using is_easy_vexpr = typename std::enable_if<is_vexpr<U>::value, U>::type;
 
-/* type aliases to help determine return types (and verify we have a valarray) */
+/*
+ * type aliases to help determine return types (and verify we have a valarray)
+ * operators return whatever the rewrite layer turns the expression into
+ */
 template<template<class, class> class Op, class A, class B>
 using BinOp = typename std::enable_if<is_vexpr<A>::value && is_vexpr<B>::value,
-	vexpr<BinaryOp<Op<A, B>, A, B>>>::type;
+	rewrite<Op, A, B>>::type::type;
 template<template<class> class Op, class A>
-using UnOp = typename std::enable_if<is_vexpr<A>::value, vexpr<UnaryOp<Op<A>, A>>>::type;
+using UnOp = typename std::enable_if<is_vexpr<A>::value, rewrite_unary<Op, A>>::type::type;
 template <typename T>
 using UnVal = vexpr<UnaryVal<T>>;
+template <int N>
+using Const = vexpr<UnaryConst<N>>;
+template <typename T>
+using Divisor = vexpr<UnaryDivisor<T>>;
 template <template<class> class Op, typename A, typename U>
 using UnFun = typename std::enable_if<is_vexpr<A>::value, vexpr<UnaryFunction<Op, U, A>>>::type;
 
@@ -216,11 +491,12 @@ template<class VExpr>
 struct vexpr {
 	using value_type = typename VExpr::value_type;
 	Ref<VExpr> v;
-	vexpr(VExpr v) : v(v) {}
-	vexpr(valarray<VExpr> v) : v(v) {}
+	vexpr(const VExpr& v) : v(const_cast<VExpr&>(v)) {}
 	value_type operator[](size_t k) const { return v[k]; }
 	size_t len() const { return v.len(); }
 	size_t size() const { return this->len(); }
+	bool hazard(const void* lo, const void* hi, bool elementwise) const { return v.hazard(lo, hi, elementwise); }
+	bool same(const vexpr& that) const { return v.same(that.v); }
 
 	/* a silly little iterator to make vexpr iterable */
 	class iterator {
@@ -233,7 +509,7 @@ struct vexpr {
 		Ref<VExpr> v;
 		uint64_t k;
 
-		iterator(VExpr b, uint64_t n) : v(b), k(n) {}
+		iterator(const VExpr& b, uint64_t n) : v(const_cast<VExpr&>(b)), k(n) {}
 		iterator(const iterator& it) : v(it.v), k(it.k) {}
 		iterator& operator=(const iterator& it) { v = it.v; k = it.k; return *this; }
 		bool operator==(const iterator& it) const { return k == it.k; }
@@ -260,6 +536,13 @@ struct vexpr {
 	/* apply and accumulate template functions */
 	template <template <class> class Func, typename T>
 	auto accumulate(Func<T> f) -> typename decltype(f)::result_type {
+		/* a short one is not worth an evaluation, a scan in it folds its few elements */
+		if (this->len() < 64) { return this->fold(f); }
+		evaluation scope(*this);
+		return this->fold(f);
+	}
+	template <template <class> class Func, typename T>
+	auto fold(Func<T> f) -> typename decltype(f)::result_type {
 		typename decltype(f)::result_type acc(this->operator[](0));
 		for (int k = 1; k < this->len(); k++) {
 			acc = f(acc, this->operator[](k));
@@ -273,17 +556,160 @@ struct vexpr {
 	}
 	auto sqrt() -> decltype(this->apply(unary_sqrt<value_type>())) { return this->apply(unary_sqrt<value_type>()); }
 	auto sum() -> decltype(this->accumulate(std::plus<value_type>())) { return this->accumulate(std::plus<value_type>()); }
+
+	/* materialize this expression once, uses of the result just read the buffer */
+	vexpr<Cached<value_type>> cache() const { return vexpr<Cached<value_type>>(Cached<value_type>(*this)); }
+};
+
+/*
+ * scratch storage for temporaries, blocks are recycled per thread so that
+ * repeated assignments don't keep going back to operator new
+ */
+class scratch_pool {
+	struct alignas(std::max_align_t) block {
+		size_t bytes;
+		block* next;
+	};
+	block* head = nullptr;
+	size_t count = 0;
+	static const size_t max_blocks = 8;
+public:
+	~scratch_pool() {
+		while (head != nullptr) {
+			block* b = head;
+			head = b->next;
+			operator delete(b);
+		}
+	}
+	static scratch_pool& local() {
+		static thread_local scratch_pool pool;
+		return pool;
+	}
+	void* acquire(size_t bytes) {
+		for (block** p = &head; *p != nullptr; p = &(*p)->next) {
+			if ((*p)->bytes >= bytes) {
+				block* b = *p;
+				*p = b->next;
+				count -= 1;
+				return b + 1;
+			}
+		}
+		block* b = reinterpret_cast<block*>(operator new(sizeof(block) + bytes));
+		b->bytes = bytes;
+		return b + 1;
+	}
+	void release(void* p) {
+		block* b = reinterpret_cast<block*>(p) - 1;
+		if (count == max_blocks) {
+			operator delete(b);
+			return;
+		}
+		b->next = head;
+		head = b;
+		count += 1;
+	}
+};
+
+/* a fixed capacity temporary that lives in the scratch pool */
+template <typename T>
+struct buffer {
+	T* data;
+	size_t n;
+	explicit buffer(size_t capacity) : data(reinterpret_cast<T*>(scratch_pool::local().acquire(capacity * sizeof(T)))), n(0) {}
+	buffer(const buffer&) = delete;
+	buffer& operator=(const buffer&) = delete;
+	~buffer() {
+		for (size_t k = 0; k < n; k++) {
+			data[k].~T();
+		}
+		scratch_pool::local().release(data);
+	}
+	void push_back(const T& x) { new (data + n) T(x); ++n; }
+	const T& operator[](size_t k) const { return data[k]; }
+	size_t len() const { return n; }
+};
+
+/*
+ * a materialized sub-expression (see vexpr::cache). copies of the node share
+ * the one pooled buffer, which goes back to the pool with the last copy.
+ * it owns its storage so it can never alias an assignment's destination.
+ */
+template <typename T>
+struct Cached {
+	using value_type = T;
+	std::shared_ptr<buffer<T>> data;
+	template <class E>
+	explicit Cached(const E& e) : data(std::make_shared<buffer<T>>(e.len())) {
+		for (size_t k = 0; k < e.len(); k++) {
+			data->push_back(e[k]);
+		}
+	}
+	T operator[](size_t k) const { return (*data)[k]; }
+	size_t len() const { return data->len(); }
+	size_t size() const { return this->len(); }
+	bool hazard(const void* lo, const void* hi, bool elementwise) const { return false; }
+	bool same(const Cached& that) const { return data == that.data; }
 };
 
-/* Basic declaration of valarray (inherits everything from vector) */
+/*
+ * bulk evaluation: a node that can produce all of its elements at once
+ * (much faster than one operator[] at a time, e.g. a matrix product) has a
+ * materialize(value_type* out) member, assignment uses it when such a node
+ * is at the top of the expression
+ */
+template <class E, class = void>
+struct is_bulk : std::false_type {};
+template <class E>
+struct is_bulk<vexpr<E>, decltype(void(std::declval<const E&>().materialize(static_cast<ValueType<E>*>(nullptr))))> :
+	std::true_type {};
+
+/*
+ * padded evaluation: an expression that may be evaluated past its end, up
+ * to the end of the last aligned block, because every leaf is floating point
+ * valarray storage (its padding is allocated and initialized, see Vector.h)
+ * and every node is plain arithmetic with no side effects. The extra
+ * results are thrown away, what we save is the scalar remainder loop.
+ */
+template <class E>
+struct padded : std::false_type {};
+template <typename T>
+struct padded<valarray<T>> : std::is_floating_point<T> {};
+template <class E>
+struct padded<vexpr<E>> : padded<E> {};
+template <typename T>
+struct padded<UnaryVal<T>> : std::true_type {};
+template <int N>
+struct padded<UnaryConst<N>> : std::true_type {};
+template <typename T>
+struct padded<UnaryDivisor<T>> : std::true_type {};
+template <class Op, class Lhs>
+struct padded<UnaryOp<Op, Lhs>> : padded<Lhs> {};
+template <class Op, class Lhs, class Rhs>
+struct padded<BinaryOp<Op, Lhs, Rhs>> : std::integral_constant<bool, padded<Lhs>::value && padded<Rhs>::value> {};
+
+/* Basic declaration of valarray (inherits everything from vector, with aligned storage) */
 template <typename T>
-struct valarray : public vector<T> {
+struct valarray<T, dynamic_extent> : public valarray_storage<T> {
 	using value_type = T;
-	valarray() : vector<T>() {}
-	explicit valarray(size_t n) : vector<T>(n) {}
-	valarray(std::initializer_list<T> il) : vector<T>(il) {}
+	using storage = valarray_storage<T>;
+	valarray() : storage() {}
+	explicit valarray(size_t n) : storage(n) {}
+	valarray(std::initializer_list<T> il) : storage(il) {}
 	size_t len() const { return this->size(); }
 
+	/* same storage read at the same index is fine, any other overlap is not */
+	bool hazard(const void* lo, const void* hi, bool elementwise) const {
+		if (this->len() == 0) {
+			return false;
+		}
+		const void* b = &this->operator[](0);
+		const void* e = &this->operator[](0) + this->len();
+		std::less<const void*> before;
+		bool overlap = before(b, hi) && before(lo, e);
+		return overlap && !(elementwise && b == lo);
+	}
+	bool same(const valarray& that) const { return this == &that; }
+
 	/* create a valarray from a vexpr */
 	template <typename U, typename = is_easy_vexpr<U>>
 	valarray(U v) {
@@ -301,18 +727,79 @@ struct valarray : public vector<T> {
 		return *this;
 	}
 
-	/* create a valarray from a vexpr */
+	/*
+	 * create a valarray from a vexpr, in place unless the expression reads
+	 * our own storage out of step, then it goes through one pooled temporary
+	 */
 	template <typename U, typename = is_easy_vexpr<U>>
 	valarray& operator=(U v) {
-		for (int k = 0; k < this->len(); k++) {
-			this->operator[](k) = v[k];
+		evaluation scope(v);
+		size_t n = (v.len() == SIZE_MAX) ? this->len() : v.len();
+		bool hazard = this->len() != 0 && v.hazard(&this->operator[](0), &this->operator[](0) + this->len(), true);
+		return this->assign(v, n, hazard, is_bulk<U>());
+	}
+
+	/* one element at a time */
+	template <typename U>
+	valarray& assign(const U& v, size_t n, bool hazard, std::false_type) {
+		if (hazard) {
+			buffer<T> tmp(n);
+			for (size_t k = 0; k < n; k++) {
+				tmp.push_back(v[k]);
+			}
+			return this->assign(tmp, n);
+		}
+		return this->assign(v, n);
+	}
+
+	/* the top node knows how to fill all of our storage at once */
+	template <typename U>
+	valarray& assign(const U& v, size_t n, bool hazard, std::true_type) {
+		if (hazard) {
+			valarray tmp(n);
+			if (n != 0) { v.v.materialize(&tmp[0]); }
+			return *this = std::move(tmp);
+		}
+		while (this->len() < n) {
+			this->push_back(T());
 		}
-		for (int k = this->len(); k < v.len(); k++) {
-			this->push_back(v[k]);
+		if (n != 0) { v.v.materialize(&this->operator[](0)); }
+		return *this;
+	}
+
+	template <typename U>
+	valarray& assign(const U& v, size_t n) {
+		while (this->len() < n) {
+			this->push_back(T());
 		}
+		T* d = assume_aligned<valarray_alignment>(this->data());
+		using whole_blocks = std::integral_constant<bool, padded<U>::value && std::is_floating_point<T>::value>;
+		this->fill(d, v, n, whole_blocks());
 		return *this;
 	}
 
+	template <typename U>
+	void fill(T* d, const U& v, size_t n, std::false_type) {
+		for (size_t k = 0; k < n; k++) {
+			d[k] = v[k];
+		}
+	}
+
+	/* whole aligned blocks, the last one runs on into the padding (unless that would overwrite our own elements) */
+	template <typename U>
+	void fill(T* d, const U& v, size_t n, std::true_type) {
+		if (n != this->len()) {
+			return this->fill(d, v, n, std::false_type());
+		}
+		const size_t w = storage::lanes;
+		size_t end = (n + w - 1) / w * w;
+		for (size_t b = 0; b < end; b += w) {
+			for (size_t j = 0; j < w; j++) {
+				d[b + j] = v[b + j];
+			}
+		}
+	}
+
 	template <template <class> class Func, typename U>
 	auto accumulate(Func<U> f) -> typename decltype(f)::result_type {
 		using V = typename decltype(f)::result_type;
@@ -334,31 +821,328 @@ struct valarray : public vector<T> {
 	auto sum() -> decltype(this->accumulate(std::plus<T>())) { return this->accumulate(std::plus<T>()); }
 };
 
+/*
+ * f(Lo), f(Lo + 1), ..., f(Lo + Count - 1) written out, halving the range
+ * at every step so the template nesting is only log2(Count) deep
+ */
+template <size_t Lo, size_t Count>
+struct unrolled {
+	template <class F>
+	static void run(const F& f) {
+		unrolled<Lo, Count / 2>::run(f);
+		unrolled<Lo + Count / 2, Count - Count / 2>::run(f);
+	}
+};
+template <size_t Lo>
+struct unrolled<Lo, 1> {
+	template <class F>
+	static void run(const F& f) { f(Lo); }
+};
+template <size_t Lo>
+struct unrolled<Lo, 0> {
+	template <class F>
+	static void run(const F& f) {}
+};
+
+/* every index of a fixed valarray: written out up to 16, a loop with a constant trip count above */
+template <size_t N, bool = (N <= 16)>
+struct each_index {
+	template <class F>
+	static void run(const F& f) { unrolled<0, N>::run(f); }
+};
+template <size_t N>
+struct each_index<N, false> {
+	template <class F>
+	static void run(const F& f) {
+		for (size_t k = 0; k < N; k++) {
+			f(k);
+		}
+	}
+};
+
+template <class... U>
+struct all_math : std::true_type {};
+template <class U, class... R>
+struct all_math<U, R...> :
+	std::integral_constant<bool, (std::is_arithmetic<U>::value || is_complex<U>::value) && all_math<R...>::value> {};
+
+/*
+ * valarray<T, N>: N elements inline (no heap, copies copy the elements),
+ * an operand and an assignment target like any valarray
+ *
+ *     valarray<double, 3> p{1, 2, 3}, v{0.5, 0, -1};
+ *     valarray<double, 3> q = p + dt * v;          // no allocation, no loop
+ *     double r = std::sqrt((q * q).sum());
+ *
+ * Expressions are held by reference and evaluated with every index written
+ * out at compile time (each_index), so a small expression becomes N
+ * straight line evaluations the compiler keeps in registers. An expression
+ * longer than N is a std::length_error, a shorter one fills the front (like
+ * valarray_view). Element access is unchecked, the construction from N
+ * values and the reads are constexpr.
+ */
+template <typename T, size_t N>
+struct valarray {
+	static_assert(N != 0 && N != dynamic_extent, "a fixed valarray has between 1 and SIZE_MAX - 1 elements");
+	using value_type = T;
+	T v[N];
+
+	constexpr valarray() : v() {}
+	template <typename... U, typename = typename std::enable_if<sizeof...(U) == N && all_math<U...>::value>::type>
+	constexpr valarray(U... u) : v{static_cast<T>(u)...} {}
+	template <typename U, typename = is_easy_vexpr<U>>
+	valarray(const U& e) : v() { this->operator=(e); }
+
+	constexpr const T& operator[](size_t k) const { return v[k]; }
+	T& operator[](size_t k) { return v[k]; }
+	constexpr size_t len() const { return N; }
+	constexpr size_t size() const { return N; }
+	T* data() { return v; }
+	const T* data() const { return v; }
+	T* begin() { return v; }
+	T* end() { return v + N; }
+	const T* begin() const { return v; }
+	const T* end() const { return v + N; }
+
+	bool hazard(const void* lo, const void* hi, bool elementwise) const {
+		std::less<const void*> before;
+		bool overlap = before(v, hi) && before(lo, v + N);
+		return overlap && !(elementwise && v == lo);
+	}
+	bool same(const valarray& that) const { return this == &that; }
+
+	valarray& operator=(const valarray& that) = default;
+
+	valarray& operator=(const T& x) {
+		each_index<N>::run([&](size_t k) { this->v[k] = x; });
+		return *this;
+	}
+
+	template <typename U, typename = is_easy_vexpr<U>>
+	valarray& operator=(const U& e) {
+		size_t n = (e.len() == SIZE_MAX) ? N : e.len();
+		if (n > N) { throw std::length_error("expression longer than the fixed valarray assigned to"); }
+		return this->assign(e, n, e.hazard(v, v + N, true), is_bulk<U>());
+	}
+
+	template <template <class> class Func, typename U>
+	auto accumulate(Func<U> f) -> typename decltype(f)::result_type {
+		using V = typename decltype(f)::result_type;
+		V acc(v[0]);
+		for (size_t k = 1; k < N; k++) {
+			acc = f(acc, static_cast<V>(v[k]));
+		}
+		return acc;
+	}
+	template <template <class> class Func, typename U>
+	UnFun<Func, valarray, U> apply(Func<U> f) {
+		using Op = UnaryFunction<Func, U, valarray>;
+		return vexpr<Op>(Op(f, *this));
+	}
+	auto sqrt() -> decltype(this->apply(unary_sqrt<T>())) { return this->apply(unary_sqrt<T>()); }
+	auto sum() -> decltype(this->accumulate(std::plus<T>())) { return this->accumulate(std::plus<T>()); }
+
+private:
+	/* all N at compile time, or the first n of a shorter expression */
+	template <typename U>
+	valarray& assign(const U& e, size_t n, bool hazard, std::false_type) {
+		if (n != N) {
+			T tmp[N];
+			for (size_t k = 0; k < n; k++) { tmp[k] = e[k]; }
+			for (size_t k = 0; k < n; k++) { v[k] = tmp[k]; }
+			return *this;
+		}
+		if (hazard) {
+			T tmp[N];
+			each_index<N>::run([&](size_t k) { tmp[k] = e[k]; });
+			each_index<N>::run([&](size_t k) { this->v[k] = tmp[k]; });
+			return *this;
+		}
+		each_index<N>::run([&](size_t k) { this->v[k] = e[k]; });
+		return *this;
+	}
+	template <typename U>
+	valarray& assign(const U& e, size_t n, bool hazard, std::true_type) {
+		if (hazard || n != N) {
+			T tmp[N];
+			e.v.materialize(tmp);
+			for (size_t k = 0; k < n; k++) { v[k] = tmp[k]; }
+			return *this;
+		}
+		e.v.materialize(v);
+		return *this;
+	}
+};
+
+/* the element type of an expression, without the const */
+template <class E>
+using Element = typename std::remove_const<ValueType<E>>::type;
+
+/* for kernels that walk a whole range: valarrays through a plain pointer (their operator[] is range checked) */
+template <class E>
+const E& source(const E& e) { return e; }
+template <typename T>
+const T* source(const valarray<T>& e) { return assume_aligned<valarray_alignment>(e.data()); }
+
+/* a compile-time scalar to use in expressions, e.g. x * constant<1>() */
+template <int N>
+Const<N> constant() { return Const<N>(UnaryConst<N>()); }
+
+/*
+ * the rewrite layer: every operator goes through rewrite<Op, Lhs, Rhs>::apply
+ * and the specializations below simplify the expression before it is built.
+ * the primary templates just build the node as written.
+ */
+template <template <class, class> class Op, class Lhs, class Rhs, class>
+struct rewrite {
+	using type = vexpr<BinaryOp<Op<Lhs, Rhs>, Lhs, Rhs>>;
+	static type apply(const Lhs& x, const Rhs& y) {
+		using Node = BinaryOp<Op<Lhs, Rhs>, Lhs, Rhs>;
+		return type(Node(Op<Lhs, Rhs>(), x, y));
+	}
+};
+template <template <class> class Op, class Lhs, class>
+struct rewrite_unary {
+	using type = vexpr<UnaryOp<Op<Lhs>, Lhs>>;
+	static type apply(const Lhs& x) { return type(UnaryOp<Op<Lhs>, Lhs>(Op<Lhs>(), x)); }
+};
+
+/* an operand that has been simplified away, valarrays get a by-reference vexpr */
+template <class E>
+struct leaf { using type = vexpr<E>; };
+template <class E>
+struct leaf<vexpr<E>> { using type = vexpr<E>; };
+template <class E>
+using Leaf = typename leaf<E>::type;
+
+/* pattern traits used by the rewrites */
+template <class E, int N>
+using is_const = std::is_same<E, Const<N>>;
+template <class E>
+struct scalar_of : std::false_type {};
+template <class S>
+struct scalar_of<UnVal<S>> : std::true_type {
+	using type = S;
+	static S get(const UnVal<S>& e) { return e.v.v; }
+};
+
+/* x * s or s * x for a scalar s */
+template <class E>
+struct scaled : std::false_type {};
+template <class X, class S>
+struct scaled<Product<X, UnVal<S>>> : std::true_type {
+	using inner = X;
+	using factor = S;
+	static const X& expr(const Product<X, UnVal<S>>& e) { return e.v.lhs; }
+	static S get(const Product<X, UnVal<S>>& e) { return e.v.rhs.v.v; }
+};
+template <class S, class X>
+struct scaled<Product<UnVal<S>, X>> : std::true_type {
+	using inner = X;
+	using factor = S;
+	static const X& expr(const Product<UnVal<S>, X>& e) { return e.v.rhs; }
+	static S get(const Product<UnVal<S>, X>& e) { return e.v.lhs.v.v; }
+};
+
+template <bool B>
+using When = typename std::enable_if<B>::type;
+
+/* x * 1, 1 * x, x + 0, 0 + x, x - 0 */
+template <class Lhs>
+struct rewrite<multiplication, Lhs, Const<1>> {
+	using type = Leaf<Lhs>;
+	static type apply(const Lhs& x, const Const<1>&) { return type(x); }
+};
+template <class Rhs>
+struct rewrite<multiplication, Const<1>, Rhs, When<!is_const<Rhs, 1>::value>> {
+	using type = Leaf<Rhs>;
+	static type apply(const Const<1>&, const Rhs& y) { return type(y); }
+};
+template <class Lhs>
+struct rewrite<addition, Lhs, Const<0>> {
+	using type = Leaf<Lhs>;
+	static type apply(const Lhs& x, const Const<0>&) { return type(x); }
+};
+template <class Rhs>
+struct rewrite<addition, Const<0>, Rhs, When<!is_const<Rhs, 0>::value>> {
+	using type = Leaf<Rhs>;
+	static type apply(const Const<0>&, const Rhs& y) { return type(y); }
+};
+template <class Lhs>
+struct rewrite<subtraction, Lhs, Const<0>> {
+	using type = Leaf<Lhs>;
+	static type apply(const Lhs& x, const Const<0>&) { return type(x); }
+};
+
+/*
+ * (x * a) * b and b * (x * a) become x * (a * b), one multiply per element.
+ * only for integers: in floating point the product a * b rounds (or
+ * overflows, or underflows) on its own and the result changes
+ */
+template <class P, class S>
+using exact_chain = std::integral_constant<bool, std::is_integral<ValueType<P>>::value &&
+	std::is_integral<typename scaled<P>::factor>::value && std::is_integral<S>::value>;
+
+template <class Lhs, class Rhs>
+struct rewrite<multiplication, Lhs, Rhs, When<scaled<Lhs>::value && scalar_of<Rhs>::value &&
+	exact_chain<Lhs, typename scalar_of<Rhs>::type>::value>> {
+	using S = decltype(typename scaled<Lhs>::factor() * typename scalar_of<Rhs>::type());
+	using Fold = rewrite<multiplication, typename scaled<Lhs>::inner, UnVal<S>>;
+	using type = typename Fold::type;
+	static type apply(const Lhs& x, const Rhs& y) {
+		return Fold::apply(scaled<Lhs>::expr(x), UnVal<S>(UnaryVal<S>(scaled<Lhs>::get(x) * scalar_of<Rhs>::get(y))));
+	}
+};
+template <class Lhs, class Rhs>
+struct rewrite<multiplication, Lhs, Rhs, When<scalar_of<Lhs>::value && scaled<Rhs>::value &&
+	exact_chain<Rhs, typename scalar_of<Lhs>::type>::value>> {
+	using S = decltype(typename scalar_of<Lhs>::type() * typename scaled<Rhs>::factor());
+	using Fold = rewrite<multiplication, typename scaled<Rhs>::inner, UnVal<S>>;
+	using type = typename Fold::type;
+	static type apply(const Lhs& x, const Rhs& y) {
+		return Fold::apply(scaled<Rhs>::expr(y), UnVal<S>(UnaryVal<S>(scalar_of<Lhs>::get(x) * scaled<Rhs>::get(y))));
+	}
+};
+
+/* x / c for floating point c divides by a Divisor, which multiplies instead when that is exact */
+template <class Lhs, class Rhs>
+struct rewrite<division, Lhs, Rhs, When<scalar_of<Rhs>::value &&
+	std::is_floating_point<typename scalar_of<Rhs>::type>::value>> {
+	using S = typename scalar_of<Rhs>::type;
+	using Fold = rewrite<division, Lhs, Divisor<S>>;
+	using type = typename Fold::type;
+	static type apply(const Lhs& x, const Rhs& y) {
+		return Fold::apply(x, Divisor<S>(UnaryDivisor<S>(scalar_of<Rhs>::get(y))));
+	}
+};
+
+/* -(-x) is just x */
+template <class Lhs>
+struct rewrite_unary<unary_negate, vexpr<UnaryOp<unary_negate<Lhs>, Lhs>>> {
+	using type = Leaf<Lhs>;
+	static type apply(const vexpr<UnaryOp<unary_negate<Lhs>, Lhs>>& x) { return type(x.v.lhs); }
+};
+
 /* the actual operators between valarrays */
 template<class Expr1>
 UnOp<unary_negate, Expr1> operator-(const Expr1& x) {
-	using Op = UnaryOp<unary_negate<Expr1>, Expr1>;
-	return vexpr<Op>(Op(unary_negate<Expr1>(), x));
+	return rewrite_unary<unary_negate, Expr1>::apply(x);
 }
 template<class Expr1, class Expr2>
 BinOp<addition, Expr1, Expr2> operator+(const Expr1& x, const Expr2& y) {
-	using Op = BinaryOp<addition<Expr1, Expr2>, Expr1, Expr2>;
-	return vexpr<Op>(Op(addition<Expr1, Expr2>(), x, y));
+	return rewrite<addition, Expr1, Expr2>::apply(x, y);
 }
 template<class Expr1, class Expr2>
 BinOp<subtraction, Expr1, Expr2> operator-(const Expr1& x, const Expr2& y) {
-	using Op = BinaryOp<subtraction<Expr1, Expr2>, Expr1, Expr2>;
-	return vexpr<Op>(Op(subtraction<Expr1, Expr2>(), x, y));
+	return rewrite<subtraction, Expr1, Expr2>::apply(x, y);
 }
 template<class Expr1, class Expr2>
 BinOp<multiplication, Expr1, Expr2> operator*(const Expr1& x, const Expr2& y) {
-	using Op = BinaryOp<multiplication<Expr1, Expr2>, Expr1, Expr2>;
-	return vexpr<Op>(Op(multiplication<Expr1, Expr2>(), x, y));
+	return rewrite<multiplication, Expr1, Expr2>::apply(x, y);
 }
 template<class Expr1, class Expr2>
 BinOp<division, Expr1, Expr2> operator/(const Expr1& x, const Expr2& y) {
-	using Op = BinaryOp<division<Expr1, Expr2>, Expr1, Expr2>;
-	return vexpr<Op>(Op(division<Expr1, Expr2>(), x, y));
+	return rewrite<division, Expr1, Expr2>::apply(x, y);
 }
 
 /* handle operations between valarrays and math-y numbers */
@@ -382,6 +1166,7 @@ BinOp<division, UnVal<U>, T> operator/(const U& b, const T& a) { return UnVal<U>
 /* allow the user to print valarrays */
 template <typename T, typename = is_easy_vexpr<T>>
 std::ostream& operator<<(std::ostream& stream, const T& x) {
+	evaluation scope(x);
 	char sep = '[';
 	for (int i = 0; i < x.size(); i++) {
 		stream << sep;
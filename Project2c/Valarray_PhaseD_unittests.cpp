@@ -0,0 +1,2001 @@
+/*
+ * Valarray_PhaseD_unittests.cpp
+ * EPL - Spring 2015
+ */
+
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <cstdio>
+#include <future>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "Blas.h"
+#include "Chunked.h"
+#include "FFT.h"
+#include "Histogram.h"
+#include "Mask.h"
+#include "Matrix.h"
+#include "Pipeline.h"
+#include "Random.h"
+#include "Reduce.h"
+#include "Rolling.h"
+#include "Scan.h"
+#include "Sort.h"
+#include "Sparse.h"
+#include "SplitComplex.h"
+#include "Stencil.h"
+#include "Statistics.h"
+#include "Transcendental.h"
+#include "Valarray.h"
+#include "View.h"
+#include "gtest/gtest.h"
+
+using std::cout;
+using std::endl;
+using std::string;
+using std::complex;
+
+using namespace epl;
+
+template <typename X, typename Y>
+bool match(X x, Y y) {
+    double d = x - y;
+    if (d < 0) { d = -d; }
+    return d < 1.0e-9; // not really machine epsilon, but close enough
+}
+
+/*********************************************************************/
+// Phase D Tests
+/*********************************************************************/
+
+#if defined(PHASE_D0_0) | defined(PHASE_D)
+TEST(PhaseD0, FusedPatterns) {
+    valarray<double> a(4), b(4), c(4);
+    valarray<int> i(4);
+
+    static_assert(std::is_same<Kernel<decltype(a * b + c)>, mul_add>::value, "a*b + c");
+    static_assert(std::is_same<Kernel<decltype(c + a * b)>, add_mul>::value, "c + a*b");
+    static_assert(std::is_same<Kernel<decltype(a * b - c)>, mul_sub>::value, "a*b - c");
+    static_assert(std::is_same<Kernel<decltype(c - a * b)>, sub_mul>::value, "c - a*b");
+    static_assert(std::is_same<Kernel<decltype(2.0 * a + 1)>, mul_add>::value, "scalar axpy");
+    static_assert(std::is_same<Kernel<decltype(a * b + c * a)>, mul_add>::value, "two products");
+    static_assert(std::is_same<Kernel<decltype(i * i + i)>, no_fusion>::value, "integers");
+    static_assert(std::is_same<Kernel<decltype(a + c)>, no_fusion>::value, "no product");
+}
+#endif
+
+#if defined(PHASE_D0_1) | defined(PHASE_D)
+TEST(PhaseD0, FusedRounding) {
+    valarray<double> a{1.0 + std::ldexp(1.0, -30)};
+    valarray<double> b{1.0 - std::ldexp(1.0, -30)};
+    valarray<double> c{-1.0};
+
+    /* a*b rounds to exactly 1.0, only a single rounding keeps the tail */
+    valarray<double> r = a * b + c;
+#ifdef FP_FAST_FMA
+    EXPECT_EQ(-std::ldexp(1.0, -60), r[0]);
+    r = 1.0 - a * b;
+    EXPECT_EQ(std::ldexp(1.0, -60), r[0]);
+#else
+    /* no fma instruction: the kernel is the two-step a * b + c, not a libm call */
+    EXPECT_EQ(0.0, r[0]);
+    r = 1.0 - a * b;
+    EXPECT_EQ(0.0, r[0]);
+#endif
+
+    valarray<double> x{1.0, 2.0, 3.0}, y{4.0, 5.0, 6.0};
+    valarray<double> z = 2 * x + y;
+    EXPECT_EQ(6.0, z[0]);
+    EXPECT_EQ(12.0, z[2]);
+    z = x * y - 1;
+    EXPECT_EQ(3.0, z[0]);
+    EXPECT_EQ(17.0, z[2]);
+}
+#endif
+
+#if defined(PHASE_D1_0) | defined(PHASE_D)
+TEST(PhaseD1, Identities) {
+    valarray<double> x{1.0, 2.0, 3.0};
+
+    static_assert(std::is_same<decltype(-(-x)), vexpr<valarray<double>>>::value, "-(-x)");
+    static_assert(std::is_same<decltype(x * constant<1>()), vexpr<valarray<double>>>::value, "x*1");
+    static_assert(std::is_same<decltype(constant<1>() * x), vexpr<valarray<double>>>::value, "1*x");
+    static_assert(std::is_same<decltype(x + constant<0>()), vexpr<valarray<double>>>::value, "x+0");
+    static_assert(std::is_same<decltype(constant<0>() + (x + x)), decltype(x + x)>::value, "0+e");
+    static_assert(std::is_same<decltype(-(-(x + x))), decltype(x + x)>::value, "-(-e)");
+
+    valarray<double> y = -(-x) + x * constant<1>() - constant<0>();
+    EXPECT_EQ(2.0, y[0]);
+    EXPECT_EQ(6.0, y[2]);
+    y = x * constant<3>();
+    EXPECT_EQ(9.0, y[2]);
+}
+#endif
+
+#if defined(PHASE_D1_1) | defined(PHASE_D)
+TEST(PhaseD1, ScalarChains) {
+    valarray<int> x{1, 2, 3};
+
+    /* every integer chain below is a single multiply by a folded scalar */
+    static_assert(std::is_same<decltype((x * 2) * 3), decltype(x * 6)>::value, "(x*2)*3");
+    static_assert(std::is_same<decltype(2 * (3 * x)), decltype(x * 6)>::value, "2*(3*x)");
+
+    auto e = (x * 2) * 3;
+    EXPECT_EQ(6, e.v.rhs.v.v);
+    valarray<int> y = e;
+    EXPECT_EQ(18, y[2]);
+
+    /* integer division is not rewritten */
+    valarray<int> i{7, 8, 9};
+    valarray<int> j = i / 2;
+    EXPECT_EQ(3, j[0]);
+    EXPECT_EQ(4, j[2]);
+}
+#endif
+
+#if defined(PHASE_D1_2) | defined(PHASE_D)
+TEST(PhaseD1, FloatingPointIsNotReassociated) {
+    /* a * b on its own underflows or overflows, the chain does not */
+    valarray<double> big{1e300};
+    static_assert(!std::is_same<decltype((big * 2.0) * 3.0), decltype(big * 6.0)>::value, "no fp chains");
+    valarray<double> small = big * 1e-305 * 1e-305;
+    EXPECT_EQ(1e300 * 1e-305 * 1e-305, small[0]);
+    EXPECT_NE(0.0, small[0]);
+    valarray<double> huge = big * 1e200 * 1e-200;
+    EXPECT_TRUE(std::isinf(huge[0]));
+
+    /* x / c multiplies by 1 / c only when c is a power of two, where that is exact */
+    valarray<double> x{1e-300, 0.0};
+    static_assert(std::is_same<Kernel<decltype(x / 4.0)>, by_reciprocal>::value, "x/c");
+    valarray<double> q = x / 1e-310;
+    EXPECT_EQ(1e-300 / 1e-310, q[0]);
+    EXPECT_EQ(0.0, q[1]);
+    valarray<double> v(999);
+    for (int k = 0; k < 999; ++k) {
+        v[k] = 0.001 * (k + 1);
+    }
+    valarray<double> thirds = v / 3.0, quarters = v / 4.0, eighths = v / -0.125;
+    bool ok = true;
+    for (int k = 0; k < 999; ++k) {
+        ok = ok && thirds[k] == v[k] / 3.0 && quarters[k] == v[k] / 4.0 && eighths[k] == v[k] / -0.125;
+    }
+    EXPECT_TRUE(ok);
+    EXPECT_EQ(0.375, ((x + 1.5) / 4.0)[1]);
+
+    /* the smallest subnormal is a power of two, but its reciprocal is not finite */
+    const double d = std::numeric_limits<double>::denorm_min();
+    valarray<double> tiny = x / d;
+    EXPECT_EQ(1e-300 / d, tiny[0]);
+    EXPECT_EQ(0.0, tiny[1]);
+}
+#endif
+
+/* a permuted view for the aliasing tests, reads element len-1-k */
+template <typename T>
+struct Reversed {
+    using value_type = T;
+    const valarray<T>& x;
+    Reversed(const valarray<T>& x) : x(x) {}
+    T operator[](size_t k) const { return x[x.len() - 1 - k]; }
+    size_t len() const { return x.len(); }
+    size_t size() const { return this->len(); }
+    bool hazard(const void* lo, const void* hi, bool elementwise) const { return x.hazard(lo, hi, false); }
+    bool same(const Reversed& that) const { return x.same(that.x); }
+};
+
+#if defined(PHASE_D2_0) | defined(PHASE_D)
+TEST(PhaseD2, ElementwiseInPlace) {
+    valarray<int> v{1, 2, 3, 4};
+    const void* lo = &v[0];
+    const void* hi = &v[0] + v.size();
+
+    EXPECT_FALSE((v * v + v).hazard(lo, hi, true));
+    v = v * v + v;
+    EXPECT_EQ(2, v[0]);
+    EXPECT_EQ(20, v[3]);
+    EXPECT_EQ(lo, &v[0]);
+}
+#endif
+
+#if defined(PHASE_D2_1) | defined(PHASE_D)
+TEST(PhaseD2, PermutedAlias) {
+    valarray<int> v{1, 2, 3, 4};
+    valarray<int> w{1, 2, 3, 4};
+    auto r = vexpr<Reversed<int>>(Reversed<int>(v));
+    const void* lo = &v[0];
+    const void* hi = &v[0] + v.size();
+
+    EXPECT_TRUE((r + v).hazard(lo, hi, true));
+    EXPECT_FALSE((r + v).hazard(&w[0], &w[0] + w.size(), true));
+
+    v = r + v;
+    for (uint64_t i = 0; i < 4; i++) {
+        EXPECT_EQ(5, v[i]);
+    }
+    EXPECT_EQ(lo, &v[0]);
+
+    w = vexpr<Reversed<int>>(Reversed<int>(w)) * 10;
+    EXPECT_EQ(40, w[0]);
+    EXPECT_EQ(10, w[3]);
+}
+#endif
+
+/* an identity function that counts how often it was called */
+template <typename T>
+struct counted : std::unary_function<T, T> {
+    static int calls;
+    T operator()(const T& x) const { ++calls; return x; }
+};
+template <typename T>
+int counted<T>::calls = 0;
+
+#if defined(PHASE_D3_0) | defined(PHASE_D)
+TEST(PhaseD3, Cache) {
+    valarray<int> v{1, 2, 3, 4, 5};
+    counted<int>::calls = 0;
+
+    auto c = (v + 1).apply(counted<int>()).cache();
+    EXPECT_EQ(5, counted<int>::calls);
+    EXPECT_EQ(5, c.size());
+
+    valarray<int> r = c * c + c - c / 2;
+    EXPECT_EQ(5, counted<int>::calls);
+    EXPECT_EQ(4 + 2 - 1, r[0]);
+    EXPECT_EQ(36 + 6 - 3, r[4]);
+
+    /* a cached node owns its storage, so it is safe to assign over its source */
+    auto d = (v * 2).cache();
+    v = d + v;
+    EXPECT_EQ(3, v[0]);
+    EXPECT_EQ(15, v[4]);
+}
+#endif
+
+#if defined(PHASE_D3_1) | defined(PHASE_D)
+TEST(PhaseD3, CommonSubexpression) {
+    valarray<int> v{1, 2, 3, 4, 5};
+    valarray<int> w{1, 2, 3, 4, 5};
+    counted<int>::calls = 0;
+
+    /* same node type over the same operands, computed once per element */
+    valarray<int> r = v.apply(counted<int>()) * v.apply(counted<int>());
+    EXPECT_EQ(5, counted<int>::calls);
+    EXPECT_EQ(25, r[4]);
+
+    /* same type but different operands, both sides are computed */
+    counted<int>::calls = 0;
+    r = v.apply(counted<int>()) * w.apply(counted<int>());
+    EXPECT_EQ(10, counted<int>::calls);
+    EXPECT_EQ(25, r[4]);
+
+    EXPECT_TRUE((v + 1).same(v + 1));
+    EXPECT_FALSE((v + 1).same(v + 2));
+    EXPECT_FALSE((v + 1).same(w + 1));
+}
+#endif
+
+#if defined(PHASE_D4_0) | defined(PHASE_D)
+TEST(PhaseD4, PipelineBlocked) {
+    valarray<double> a(1000), b(1000);
+    for (int i = 0; i < 1000; ++i) {
+        a[i] = i;
+        b[i] = 2 * i;
+    }
+    valarray<double> t1, t2, out;
+
+    pipeline p(64); // tiny cache, lots of blocks
+    p.assign(t1, a * a).assign(t2, t1 + b).assign(out, t2 - a);
+    EXPECT_EQ(3, p.size());
+    EXPECT_EQ(1000, out.size());
+    EXPECT_EQ(0.0, out[999]); // nothing evaluated yet
+    EXPECT_TRUE(p.blocked());
+    EXPECT_EQ(64 / (3 * sizeof(double)), p.block());
+
+    p.run();
+    for (int i = 0; i < 1000; ++i) {
+        EXPECT_EQ(double(i) * i + i, out[i]);
+    }
+
+    /* stages can write over their own inputs, still elementwise */
+    p.clear();
+    p.assign(a, a + 1).assign(b, a * 2);
+    p.run();
+    EXPECT_EQ(2.0 * 1000, b[999]);
+
+    /* a shorter expression only writes its own length */
+    valarray<double> four{1, 2, 3, 4}, wide(100);
+    p.clear();
+    p.assign(wide, four * 2.0);
+    EXPECT_EQ(100, wide.size());
+    p.run();
+    EXPECT_EQ(8.0, wide[3]);
+    EXPECT_EQ(0.0, wide[4]);
+
+    /* a scan is computed once for the run and copied out a block at a time */
+    p.clear();
+    p.assign(t1, inclusive_scan(a)).assign(t2, t1 * 2.0);
+    EXPECT_TRUE(p.blocked());
+    p.run();
+    EXPECT_EQ(1001.0 * 1000 / 2, t1[999]);
+    EXPECT_EQ(1001.0 * 1000, t2[999]);
+    EXPECT_EQ(6.0, t2[1]);
+
+    /* a plain valarray operand is read when the pipeline runs, not copied when it is recorded */
+    valarray<double> c{0, 1, 2, 3}, u1, u2;
+    p.clear();
+    p.assign(u1, c * 2.0).assign(u2, u1);
+    p.run();
+    EXPECT_EQ(6.0, u1[3]);
+    EXPECT_EQ(6.0, u2[3]);
+}
+#endif
+
+#if defined(PHASE_D4_1) | defined(PHASE_D)
+TEST(PhaseD4, PipelineFallback) {
+    valarray<int> a{1, 2, 3, 4};
+    valarray<int> t;
+
+    /* the second stage reads t out of step, so stages run one at a time */
+    pipeline p(sizeof(int));
+    p.assign(t, a * 10).assign(a, vexpr<Reversed<int>>(Reversed<int>(t)) + a);
+    EXPECT_FALSE(p.blocked());
+    p.run();
+    EXPECT_EQ(41, a[0]);
+    EXPECT_EQ(14, a[3]);
+
+    /* and a stage reading its own destination out of step gets a temporary */
+    p.clear();
+    p.assign(a, vexpr<Reversed<int>>(Reversed<int>(a)));
+    p.run();
+    EXPECT_EQ(14, a[0]);
+    EXPECT_EQ(41, a[3]);
+}
+#endif
+
+#if defined(PHASE_D5_0) | defined(PHASE_D)
+TEST(PhaseD5, MatrixViews) {
+    matrix<int> a(3, 2);
+    matrix<int> b(2, 3, col_major);
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 2; ++j) {
+            a(i, j) = 10 * i + j;
+            b(j, i) = 100 * j + i;
+        }
+    }
+    EXPECT_EQ(1, a[1]);
+    EXPECT_EQ(2, b[2]); // logical order even though b is column major
+
+    matrix<int> c = a.transpose() + b;
+    EXPECT_EQ(2, c.rows());
+    EXPECT_EQ(3, c.cols());
+    for (int i = 0; i < 2; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            EXPECT_EQ(a(j, i) + b(i, j), c(i, j));
+        }
+    }
+
+    valarray<int> r = a.row(2) * 2;
+    EXPECT_EQ(2, r.size());
+    EXPECT_EQ(40, r[0]);
+    EXPECT_EQ(42, r[1]);
+    valarray<int> k = b.col(1);
+    EXPECT_EQ(1, k[0]);
+    EXPECT_EQ(101, k[1]);
+    EXPECT_EQ(10 + 11 + 20 + 21, a.block(1, 0, 2, 2).sum());
+    EXPECT_EQ(1 + 11 + 21, a.col(1).sum());
+    EXPECT_THROW(a.block(2, 0, 2, 1), std::out_of_range);
+
+    /* a shorter operand cannot fill the shape */
+    matrix<int> m(3, 3);
+    valarray<int> v{1, 2};
+    EXPECT_THROW(m = m + v, std::length_error);
+    EXPECT_THROW(matrix<int> bad(m * v), std::length_error);
+
+    /* the same number of elements in another shape */
+    matrix<int> w(2, 3);
+    w = a * 1;
+    EXPECT_EQ(3, w.rows());
+    EXPECT_EQ(2, w.cols());
+    EXPECT_EQ(21, w(2, 1));
+    EXPECT_EQ(10, w(1, 0));
+}
+#endif
+
+#if defined(PHASE_D5_1) | defined(PHASE_D)
+TEST(PhaseD5, MatrixTransposeInPlace) {
+    matrix<double> a(70, 45);
+    for (int i = 0; i < 70; ++i) {
+        for (int j = 0; j < 45; ++j) {
+            a(i, j) = i * 1000 + j;
+        }
+    }
+
+    /* reads itself out of step and changes shape, goes through a temporary */
+    a = a.transpose();
+    EXPECT_EQ(45, a.rows());
+    EXPECT_EQ(70, a.cols());
+    for (int i = 0; i < 45; ++i) {
+        for (int j = 0; j < 70; ++j) {
+            EXPECT_EQ(j * 1000 + i, a(i, j));
+        }
+    }
+
+    /* elementwise updates stay in place */
+    const double* p = a.storage();
+    a = a * 2 + 1;
+    EXPECT_EQ(p, a.storage());
+    EXPECT_EQ(2.0 * 1003 + 1, a(3, 1));
+
+    matrix<double> c(45, 70, col_major);
+    c = a + a;
+    EXPECT_EQ(2 * a(5, 7), c(5, 7));
+}
+#endif
+
+/* fill a matrix with something that isn't symmetric */
+template <typename T>
+void scribble(matrix<T>& m, int seed) {
+    for (uint64_t i = 0; i < m.rows(); ++i) {
+        for (uint64_t j = 0; j < m.cols(); ++j) {
+            m(i, j) = T((seed * 7 + i * 13 + j * 5) % 17) - T(8);
+        }
+    }
+}
+
+template <typename T>
+void check_product(const matrix<T>& c, const matrix<T>& a, const matrix<T>& b) {
+    ASSERT_EQ(a.rows(), c.rows());
+    ASSERT_EQ(b.cols(), c.cols());
+    for (uint64_t i = 0; i < c.rows(); ++i) {
+        for (uint64_t j = 0; j < c.cols(); ++j) {
+            T acc = T();
+            for (uint64_t p = 0; p < a.cols(); ++p) {
+                acc += a(i, p) * b(p, j);
+            }
+            EXPECT_EQ(acc, c(i, j));
+        }
+    }
+}
+
+#if defined(PHASE_D6_0) | defined(PHASE_D)
+TEST(PhaseD6, Gemm) {
+    /* odd sizes so every edge of the register blocking is hit */
+    matrix<double> a(37, 301), b(301, 29, col_major);
+    scribble(a, 1);
+    scribble(b, 2);
+
+    matrix<double> c = matmul(a, b);
+    check_product(c, a, b);
+
+    matrix<double> d(37, 29, col_major);
+    d = matmul(a, b);
+    check_product(d, a, b);
+
+    valarray<double> v = matmul(a, b);
+    EXPECT_EQ(37 * 29, v.size());
+    EXPECT_EQ(c(3, 4), v[3 * 29 + 4]);
+    EXPECT_EQ(c(36, 28), matmul(a, b)[36 * 29 + 28]);
+
+    matrix<float> f(20, 20), g(20, 20);
+    scribble(f, 3);
+    scribble(g, 4);
+    matrix<float> h = matmul(f, g);
+    check_product(h, f, g);
+
+    matrix<complex<double>> x(9, 5), y(5, 11);
+    scribble(x, 5);
+    scribble(y, 6);
+    for (int i = 0; i < 9; ++i) { x(i, 1) = complex<double>(1, i); }
+    matrix<complex<double>> z = matmul(x, y);
+    check_product(z, x, y);
+
+    EXPECT_THROW(matmul(a, a), std::invalid_argument);
+}
+#endif
+
+#if defined(PHASE_D6_1) | defined(PHASE_D)
+TEST(PhaseD6, GemmAliasing) {
+    matrix<int> a(6, 6), b(6, 6);
+    scribble(a, 7);
+    scribble(b, 8);
+    matrix<int> expect = matmul(a, b);
+
+    /* a is read all over the place while it is being written */
+    a = matmul(a, b);
+    for (int i = 0; i < 6; ++i) {
+        for (int j = 0; j < 6; ++j) {
+            EXPECT_EQ(expect(i, j), a(i, j));
+        }
+    }
+}
+#endif
+
+/* largest relative error of fast against libm over x */
+template <class F, class G>
+double worst(const valarray<double>& x, F fast, G exact) {
+    valarray<double> y = fast(x);
+    double most = 0;
+    for (uint64_t k = 0; k < x.size(); ++k) {
+        double e = exact(x[k]);
+        double d = std::fabs(y[k] - e) / ((std::fabs(e) < 1e-300) ? 1.0 : std::fabs(e));
+        if (d > most) { most = d; }
+    }
+    return most;
+}
+
+#if defined(PHASE_D7_0) | defined(PHASE_D)
+TEST(PhaseD7, FastAccuracy) {
+    valarray<double> x(4001), pos(4001);
+    for (int k = 0; k <= 4000; ++k) {
+        x[k] = (k - 2000) * 0.0173;
+        pos[k] = std::exp((k - 2000) * 0.3);
+    }
+    EXPECT_LT(worst(x, [](const valarray<double>& v) { return epl::exp<fast>(v); }, [](double t) { return std::exp(t); }), 1e-8);
+    EXPECT_LT(worst(pos, [](const valarray<double>& v) { return epl::log<fast>(v); }, [](double t) { return std::log(t); }), 1e-8);
+    EXPECT_LT(worst(x, [](const valarray<double>& v) { return epl::sin<fast>(v); }, [](double t) { return std::sin(t); }), 1e-8);
+    EXPECT_LT(worst(x, [](const valarray<double>& v) { return epl::cos<fast>(v); }, [](double t) { return std::cos(t); }), 1e-8);
+    EXPECT_LT(worst(x, [](const valarray<double>& v) { return epl::tanh<fast>(v); }, [](double t) { return std::tanh(t); }), 1e-8);
+    EXPECT_LT(worst(x, [](const valarray<double>& v) { return epl::pow<fast>(v * v + 0.5, 1.7); },
+        [](double t) { return std::pow(t * t + 0.5, 1.7); }), 1e-8);
+
+    /* the edges */
+    valarray<double> edge(8);
+    double inf = std::numeric_limits<double>::infinity();
+    edge[0] = 0; edge[1] = -1; edge[2] = inf; edge[3] = 1e-310;
+    edge[4] = 800; edge[5] = -800; edge[6] = -740; edge[7] = 3e5;
+    valarray<double> e = epl::exp<fast>(edge);
+    valarray<double> l = epl::log<fast>(edge);
+    valarray<double> s = epl::sin<fast>(edge);
+    EXPECT_EQ(1.0, e[0]);
+    EXPECT_EQ(inf, e[4]);
+    EXPECT_EQ(0.0, e[5]);
+    EXPECT_NEAR(1.0, e[6] / std::exp(-740.0), 1e-8); // subnormal
+    EXPECT_EQ(-inf, l[0]);
+    EXPECT_TRUE(std::isnan(l[1]));
+    EXPECT_EQ(inf, l[2]);
+    EXPECT_NEAR(std::log(1e-310), l[3], 1e-12);
+    EXPECT_EQ(std::sin(3e5), s[7]);
+
+    /* float goes through the double kernels */
+    valarray<float> f(3);
+    f[0] = 0.5f; f[1] = 1.5f; f[2] = -2.0f;
+    valarray<float> g = epl::exp<fast>(f);
+    EXPECT_FLOAT_EQ(std::exp(-2.0f), g[2]);
+}
+#endif
+
+#if defined(PHASE_D7_1) | defined(PHASE_D)
+TEST(PhaseD7, PreciseAndComplex) {
+    valarray<double> x(5);
+    for (int k = 0; k < 5; ++k) { x[k] = 0.25 * k + 0.1; }
+
+    /* precise is exactly libm, and the nodes compose like any other */
+    valarray<double> y = epl::exp(x) * epl::sin(2.0 * x) + epl::sqrt(x);
+    for (int k = 0; k < 5; ++k) {
+        EXPECT_EQ(std::exp(x[k]) * std::sin(2.0 * x[k]) + std::sqrt(x[k]), y[k]);
+    }
+    valarray<double> p = epl::pow(x, x + 1.0);
+    EXPECT_EQ(std::pow(x[3], x[3] + 1.0), p[3]);
+
+    /* ints are computed in double */
+    valarray<int> n(3);
+    n[0] = 1; n[1] = 2; n[2] = 3;
+    auto ln = epl::log(n);
+    static_assert(std::is_same<double, decltype(ln[0])>::value, "log(int) is double");
+    EXPECT_EQ(std::log(3.0), ln[2]);
+    valarray<double> cube = epl::pow<fast>(n, 3);
+    EXPECT_NEAR(27.0, cube[2], 1e-9);
+    valarray<double> neg = epl::pow<fast>(-1.0 * n, 3);
+    EXPECT_NEAR(-8.0, neg[1], 1e-9);
+
+    /* complex takes the std:: path in both tiers */
+    valarray<complex<double>> z(2);
+    z[0] = complex<double>(0.5, 1.0);
+    z[1] = complex<double>(-1.0, 0.25);
+    valarray<complex<double>> w = epl::exp<fast>(z) + epl::log(z) * epl::cos(z);
+    for (int k = 0; k < 2; ++k) {
+        complex<double> expect = std::exp(z[k]) + std::log(z[k]) * std::cos(z[k]);
+        EXPECT_EQ(expect, w[k]);
+    }
+    valarray<complex<double>> zz = epl::pow(z, 2.0);
+    EXPECT_TRUE(match(std::abs(zz[0] - z[0] * z[0]), 0.0));
+
+    /* written over its own argument */
+    x = epl::tanh<fast>(x);
+    EXPECT_NEAR(std::tanh(0.35), x[1], 1e-12);
+}
+#endif
+
+#if defined(PHASE_D8_0) | defined(PHASE_D)
+TEST(PhaseD8, SplitArithmetic) {
+    split_complex<double> z{{1, 2}, {-3, 0.5}, {0, -1}, {2.5, 4}};
+    split_complex<double> w{{0.5, -1}, {2, 2}, {-1, 3}, {1, 0}};
+    valarray<complex<double>> zi(4), wi(4);
+    valarray<double> r{2, -1, 0.5, 3};
+    for (int k = 0; k < 4; ++k) { zi[k] = z[k]; wi[k] = w[k]; }
+
+    split_complex<double> p = z * w + z / w - z;
+    split_complex<double> q = r * z + z / r + r / w;
+    for (int k = 0; k < 4; ++k) {
+        complex<double> expect = zi[k] * wi[k] + zi[k] / wi[k] - zi[k];
+        EXPECT_TRUE(match(std::abs(p[k] - expect), 0.0));
+        expect = r[k] * zi[k] + zi[k] / r[k] + r[k] / wi[k];
+        EXPECT_TRUE(match(std::abs(q[k] - expect), 0.0));
+    }
+
+    /* split and interleaved storage mix freely, and products use the split kernels */
+    valarray<complex<double>> m = z * wi + 1.0;
+    EXPECT_TRUE(match(std::abs(m[1] - (zi[1] * wi[1] + 1.0)), 0.0));
+    static_assert(std::is_same<Kernel<decltype(z * wi)>, split_mul>::value, "split product");
+    static_assert(std::is_same<Kernel<decltype(zi * wi)>, no_fusion>::value, "std::complex product");
+
+    /* CondComp promotions are unchanged, complex<float> * double is complex<double> */
+    split_complex<float> f{{1.5f, 2.0f}};
+    valarray<double> d{0.1};
+    auto fd = f * d;
+    static_assert(std::is_same<complex<double>, std::remove_const<decltype(fd[0])>::type>::value, "promotes");
+    EXPECT_TRUE(match(std::abs(fd[0] - complex<double>(1.5, 2.0) * 0.1), 0.0));
+
+    /* z * z is evaluated once per element and still in the split kernel */
+    split_complex<double> zz = z * z;
+    EXPECT_TRUE(match(std::abs(zz[3] - zi[3] * zi[3]), 0.0));
+}
+#endif
+
+#if defined(PHASE_D8_1) | defined(PHASE_D)
+TEST(PhaseD8, SplitFunctionsAndAliasing) {
+    split_complex<double> z{{3, 4}, {-1, 0}, {0, -2}, {1e200, 1e200}};
+    valarray<double> a = epl::abs(z);
+    valarray<double> t = epl::arg(z);
+    EXPECT_EQ(5.0, a[0]);
+    EXPECT_EQ(1.0, a[1]);
+    EXPECT_TRUE(match(a[3] / std::abs(complex<double>(1e200, 1e200)), 1.0)); // no overflow
+    EXPECT_TRUE(match(t[1], std::atan2(0.0, -1.0)));
+    EXPECT_TRUE(match(t[2], -std::atan2(1.0, 0.0)));
+
+    split_complex<double> c = epl::conj(z) * 2.0;
+    valarray<double> re = epl::real(c);
+    valarray<double> im = epl::imag(c);
+    EXPECT_EQ(6.0, re[0]);
+    EXPECT_EQ(-8.0, im[0]);
+
+    /* also for interleaved storage */
+    valarray<complex<double>> v{{0, 1}};
+    valarray<double> va = epl::abs(v);
+    EXPECT_EQ(1.0, va[0]);
+
+    /* an infinite part wins over a NaN in either order, like std::abs */
+    const double inf = std::numeric_limits<double>::infinity();
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    split_complex<double> odd{{nan, -inf}, {inf, nan}, {nan, 1.0}};
+    valarray<double> oa = epl::abs(odd);
+    EXPECT_EQ(inf, oa[0]);
+    EXPECT_EQ(inf, oa[1]);
+    EXPECT_TRUE(oa[2] != oa[2]);
+
+    /* in place is fine, both arrays are read before either is written */
+    split_complex<double> w{{1, 1}, {2, -1}, {0, 3}, {1, 0}};
+    complex<double> w1 = w[1] * z[1];
+    w = w * z;
+    EXPECT_EQ(w1, w[1]);
+    w = w * w;
+    EXPECT_EQ(w1 * w1, w[1]);
+
+    /* the parts of a split array are leaves of their own */
+    valarray<double> norm = z.real() * z.real() + z.imag() * z.imag();
+    EXPECT_EQ(25.0, norm[0]);
+    EXPECT_EQ(4u, z.size());
+    z = split_complex<double>(2);
+    EXPECT_EQ(2u, z.size());
+}
+#endif
+
+#if defined(PHASE_D9_0) | defined(PHASE_D)
+TEST(PhaseD9, Comparisons) {
+    valarray<double> a{-2, -1, 0, 1, 2, 3};
+    valarray<int> b{0, 0, 0, 1, 5, 1};
+
+    valarray<bool> lt = a < b;
+    valarray<bool> ge = a >= 1;
+    valarray<bool> eq = 0 == a;
+    EXPECT_TRUE(lt[0]);
+    EXPECT_FALSE(lt[3]);
+    EXPECT_TRUE(lt[4]);
+    EXPECT_EQ(3u, count(ge));
+    EXPECT_TRUE(eq[2]);
+    EXPECT_EQ(1u, count(eq));
+    EXPECT_EQ(4u, count(a != b));
+    EXPECT_EQ(2u, count(a <= -1));
+    EXPECT_EQ(3u, count(2 > a && a > -2));
+    EXPECT_EQ(4u, count(a < -1 || a > 0));
+    EXPECT_EQ(3u, count(!(a > 0)));
+    EXPECT_TRUE(any(a > 2));
+    EXPECT_FALSE(all(a > -2));
+    EXPECT_TRUE(all(a == a));
+
+    /* masks are expressions like any other */
+    EXPECT_EQ(3, (a > 0).accumulate(std::plus<int>()));
+    valarray<int> n = (a > 0) + (a > 1);
+    EXPECT_EQ(2, n[5]);
+
+    valarray<complex<double>> z{{1, 1}, {1, 0}};
+    EXPECT_EQ(1u, count(z == 1.0));
+}
+#endif
+
+#if defined(PHASE_D9_1) | defined(PHASE_D)
+TEST(PhaseD9, Select) {
+    valarray<double> a{-2, -1, 0, 1, 2, 3};
+    valarray<double> b{10, 20, 30, 40, 50, 60};
+
+    valarray<double> relu = select(a > 0, a, 0);
+    EXPECT_EQ(0.0, relu[0]);
+    EXPECT_EQ(3.0, relu[5]);
+
+    valarray<double> c = select(a < 0 || a > 2, b, -1.0) * 2;
+    EXPECT_EQ(20.0, c[0]);
+    EXPECT_EQ(-2.0, c[3]);
+    EXPECT_EQ(120.0, c[5]);
+
+    /* mixed types promote like arithmetic does */
+    valarray<int> i{1, 2, 3, 4, 5, 6};
+    auto s = select(a > 0, i, 0.5);
+    static_assert(std::is_same<double, std::remove_const<decltype(s[0])>::type>::value, "promotes");
+    EXPECT_EQ(0.5, s[1]);
+    EXPECT_EQ(6.0, s[5]);
+
+    /* clamp in place, elementwise so no temporary is needed */
+    const void* lo = &a[0];
+    EXPECT_FALSE(select(a > 1, 1.0, a).hazard(lo, &a[0] + a.size(), true));
+    a = select(a > 1, 1.0, select(a < -1, -1.0, a));
+    EXPECT_EQ(-1.0, a[0]);
+    EXPECT_EQ(0.0, a[2]);
+    EXPECT_EQ(1.0, a[5]);
+}
+#endif
+
+#if defined(PHASE_D10_0) | defined(PHASE_D)
+TEST(PhaseD10, Scans) {
+    valarray<int> v{3, 1, 4, 1, 5, 9, 2, 6};
+    valarray<int> in = inclusive_scan(v);
+    valarray<int> ex = exclusive_scan(v, 10);
+    int run = 0;
+    for (int k = 0; k < 8; ++k) {
+        EXPECT_EQ(10 + run, ex[k]);
+        run += v[k];
+        EXPECT_EQ(run, in[k]);
+    }
+    EXPECT_EQ(14, inclusive_scan(v)[4]);
+    EXPECT_EQ(10, exclusive_scan(v, 10)[0]);
+
+    /* any associative functor, over any expression */
+    valarray<int> most = inclusive_scan(v * 2, [](int a, int b) { return (a < b) ? b : a; });
+    EXPECT_EQ(8, most[3]);
+    EXPECT_EQ(18, most[7]);
+
+    /* in place goes through a temporary */
+    v = inclusive_scan(v);
+    EXPECT_EQ(31, v[7]);
+
+    valarray<int> empty;
+    valarray<int> none = inclusive_scan(empty);
+    EXPECT_EQ(0u, none.size());
+}
+#endif
+
+#if defined(PHASE_D10_1) | defined(PHASE_D)
+TEST(PhaseD10, LargeScan) {
+    /* big enough for several pieces (and several threads where there are any) */
+    const size_t n = 300001;
+    valarray<double> x(n);
+    valarray<int> mark(n);
+    for (size_t k = 0; k < n; ++k) {
+        x[k] = static_cast<double>(k % 7);
+        mark[k] = (k % 1000 == 0) ? static_cast<int>(k / 1000) : 0;
+    }
+    valarray<double> s = inclusive_scan(x + 1.0);
+    valarray<double> e = exclusive_scan(x, 0.5);
+    double run = 0;
+    bool ok = true;
+    for (size_t k = 0; k < n; ++k) {
+        ok = ok && (e[k] == run + 0.5);
+        run += x[k];
+        ok = ok && (s[k] == run + k + 1);
+    }
+    EXPECT_TRUE(ok);
+
+    /* as operands the scans are materialized once, not folded from the front for every element */
+    valarray<double> both = inclusive_scan(x + 1.0) * 1.5 - exclusive_scan(x, 0.5);
+    run = 0;
+    for (size_t k = 0; k < n; ++k) {
+        double prefix = run + 0.5;
+        run += x[k];
+        ok = ok && (both[k] == (run + k + 1) * 1.5 - prefix);
+    }
+    EXPECT_TRUE(ok);
+    EXPECT_EQ(4.5, (inclusive_scan(x + 1.0) * 1.5)[1]);
+
+    /* a stored expression sees its operand as it is when it is evaluated again */
+    valarray<double> small{1, 2, 3};
+    auto twice = inclusive_scan(small) * 2.0;
+    valarray<double> before = twice;
+    EXPECT_EQ(12.0, before[2]);
+    small[0] = 100;
+    valarray<double> after = twice;
+    EXPECT_EQ(210.0, after[2]);
+    EXPECT_EQ(210.0, std::get<0>(reduce(twice, reducers::max)));
+    EXPECT_EQ(204.0, twice[1]);
+
+    /* not commutative: the last nonzero value so far */
+    valarray<int> last = inclusive_scan(mark, [](int a, int b) { return (b != 0) ? b : a; });
+    EXPECT_EQ(0, last[999]);
+    EXPECT_EQ(1, last[1999]);
+    EXPECT_EQ(300, last[n - 1]);
+    EXPECT_EQ(299, last[299999]);
+}
+#endif
+
+#if defined(PHASE_D11_0) | defined(PHASE_D)
+/* with both namespaces brought in, std::min is still unambiguous */
+namespace both {
+using namespace std;
+using namespace epl;
+inline int smaller(int a, int b) { return min(a, b); }
+inline bool at_least(int a, int b) { return greater_equal<int>()(a, b); }
+inline bool neither(bool a, bool b) { return logical_not<bool>()(logical_or<bool>()(a, b)); }
+}
+
+TEST(PhaseD11, MultiReduce) {
+    EXPECT_EQ(1, both::smaller(2, 1));
+    EXPECT_TRUE(both::at_least(2, 2));
+    EXPECT_TRUE(both::neither(false, false));
+    valarray<double> a{3, -1, 4, 1, -5, 9, 2};
+    counted<double>::calls = 0;
+    double s, lo, hi, ss;
+    std::tie(s, lo, hi, ss) = reduce(a.apply(counted<double>()) * 2.0,
+        reducers::sum, reducers::min, reducers::max, reducers::sum_sq);
+    EXPECT_EQ(7, counted<double>::calls);
+    EXPECT_EQ(26.0, s);
+    EXPECT_EQ(-10.0, lo);
+    EXPECT_EQ(18.0, hi);
+    EXPECT_EQ(4.0 * (9 + 1 + 16 + 1 + 25 + 81 + 4), ss);
+
+    /* integers stay integers, the empty range gives the identities */
+    valarray<int> v{5, 7, 1};
+    EXPECT_EQ(13, std::get<0>(reduce(v, reducers::sum)));
+    EXPECT_EQ(1, std::get<1>(reduce(v, reducers::sum, reducers::min)));
+    valarray<double> empty;
+    auto r = reduce(empty, reducers::sum, reducers::min, reducers::max);
+    EXPECT_EQ(0.0, std::get<0>(r));
+    EXPECT_EQ(std::numeric_limits<double>::infinity(), std::get<1>(r));
+    EXPECT_EQ(-std::numeric_limits<double>::infinity(), std::get<2>(r));
+
+    /* NaNs are skipped by min and max */
+    valarray<double> nan{2, std::nan(""), -3};
+    EXPECT_EQ(-3.0, std::get<0>(reduce(nan, reducers::min)));
+    EXPECT_EQ(2.0, std::get<0>(reduce(nan, reducers::max)));
+
+    /* nodes that materialize are evaluated once, not per element */
+    valarray<int> run{1, 2, 3, 4};
+    EXPECT_EQ(20, std::get<0>(reduce(inclusive_scan(run), reducers::sum)));
+}
+#endif
+
+#if defined(PHASE_D11_1) | defined(PHASE_D)
+TEST(PhaseD11, CompensatedSums) {
+    /* 1 followed by many values too small to move it on their own */
+    const size_t n = 300001;
+    valarray<double> x(n);
+    x[0] = 1.0;
+    for (size_t k = 1; k < n; ++k) {
+        x[k] = 1.0e-16;
+    }
+    double exact = 1.0 + (n - 1) * 1.0e-16;
+    EXPECT_LT(std::fabs(std::get<0>(reduce(x, reducers::kahan_sum)) - exact), 1.0e-15);
+
+    /* many equal values: a running sum drifts, the pairwise and compensated ones do not */
+    valarray<double> y(n);
+    double naive = 0;
+    for (size_t k = 0; k < n; ++k) {
+        y[k] = 0.1;
+        naive += y[k];
+    }
+    long double want = static_cast<long double>(n) * 0.1;
+    double kahan, pairwise;
+    std::tie(kahan, pairwise) = reduce(y, reducers::kahan_sum, reducers::pairwise_sum);
+    EXPECT_GT(std::fabs((naive - want) / want), 1.0e-13);
+    EXPECT_LT(std::fabs((kahan - want) / want), 1.0e-14);
+    EXPECT_LT(std::fabs((pairwise - want) / want), 1.0e-14);
+
+    /* large ranges, split into blocks and pieces, agree with a serial loop */
+    valarray<int> k3(n);
+    long long total = 0;
+    int most = 0;
+    for (size_t k = 0; k < n; ++k) {
+        k3[k] = static_cast<int>((k * 7919) % 1000);
+        total += k3[k];
+        most = (k3[k] > most) ? k3[k] : most;
+    }
+    EXPECT_EQ(total, std::get<0>(reduce(k3 + 0LL, reducers::sum)));
+    EXPECT_EQ(most, std::get<0>(reduce(k3, reducers::max)));
+}
+#endif
+
+#if defined(PHASE_D12_0) | defined(PHASE_D)
+TEST(PhaseD12, Moments) {
+    valarray<int> v{2, 4, 4, 4, 5, 5, 7, 9};
+    double m, var, svar;
+    std::tie(m, var, svar) = reduce(v, reducers::mean, reducers::variance, reducers::sample_variance);
+    EXPECT_TRUE(match(5.0, m));
+    EXPECT_TRUE(match(4.0, var));
+    EXPECT_TRUE(match(32.0 / 7, svar));
+
+    /* mixes with the other accumulators, the expression is still evaluated once */
+    valarray<double> x{1, 2, 3, 10};
+    counted<double>::calls = 0;
+    auto r = reduce(x.apply(counted<double>()), reducers::sum, reducers::moments, reducers::max);
+    EXPECT_EQ(4, counted<double>::calls);
+    statistics<double> s = std::get<1>(r);
+    EXPECT_EQ(16.0, std::get<0>(r));
+    EXPECT_EQ(10.0, std::get<2>(r));
+    EXPECT_EQ(4.0, s.n);
+    EXPECT_TRUE(match(4.0, s.mean));
+    double m2 = 9 + 4 + 1 + 36, m3 = -27 - 8 - 1 + 216;
+    EXPECT_TRUE(match(m2 / 4, s.variance()));
+    EXPECT_TRUE(match(std::sqrt(4.0) * m3 / std::pow(m2, 1.5), s.skewness()));
+    EXPECT_TRUE(match(s.skewness(), std::get<0>(reduce(x, reducers::skewness))));
+
+    valarray<double> empty;
+    EXPECT_TRUE(std::isnan(std::get<0>(reduce(empty, reducers::mean))));
+    EXPECT_EQ(0.0, std::get<0>(reduce(x * 0.0 + 1.0, reducers::sample_variance)));
+}
+#endif
+
+#if defined(PHASE_D12_1) | defined(PHASE_D)
+TEST(PhaseD12, RobustAndCovariance) {
+    /* a large offset: E[x^2] - E[x]^2 loses everything, the central moments do not */
+    const size_t n = 300000;
+    valarray<double> x(n), y(n);
+    for (size_t k = 0; k < n; ++k) {
+        x[k] = 1.0e9 + static_cast<double>(k % 4);      // 0 1 2 3, variance 1.25
+        y[k] = 3.0 - 2.0 * static_cast<double>(k % 4);
+    }
+    double sum_x, sum_xx, var;
+    std::tie(sum_x, sum_xx, var) = reduce(x, reducers::sum, reducers::sum_sq, reducers::variance);
+    double naive = sum_xx / n - (sum_x / n) * (sum_x / n);
+    EXPECT_LT(std::fabs(var - 1.25), 1.0e-9);
+    EXPECT_GT(std::fabs(naive - 1.25), 1.0e-3);
+    EXPECT_LT(std::fabs(std::get<0>(reduce(x, reducers::mean)) - (1.0e9 + 1.5)), 1.0e-6);
+
+    /* y = 3 - 2 (x - 1e9) exactly, so the correlation is -1 */
+    co_statistics<double> c = co_statistics_of(x, y);
+    EXPECT_LT(std::fabs(c.covariance() - (-2.0 * 1.25)), 1.0e-9);
+    EXPECT_LT(std::fabs(covariance(x, y) - c.covariance()), 1.0e-12);
+    EXPECT_LT(std::fabs(correlation(x, y) + 1.0), 1.0e-9);
+    EXPECT_LT(std::fabs(correlation(x - 1.0e9, x * 2.0) - 1.0), 1.0e-9);
+}
+#endif
+
+/* the O(n^2) definition, to check the transforms against */
+template <typename T>
+valarray<complex<T>> slow_dft(const valarray<complex<T>>& x, double sign) {
+    const double pi = 3.14159265358979323846;
+    size_t n = x.size();
+    valarray<complex<T>> y(n);
+    for (size_t k = 0; k < n; ++k) {
+        complex<double> s = 0;
+        for (size_t j = 0; j < n; ++j) {
+            s += complex<double>(x[j]) * std::polar(1.0, sign * 2 * pi * static_cast<double>((j * k) % n) / n);
+        }
+        y[k] = complex<T>(s);
+    }
+    return y;
+}
+
+/* a copy without the copy constructor (which announces itself) */
+template <typename T>
+valarray<T> copy_of(const valarray<T>& x) {
+    valarray<T> y(x.size());
+    for (size_t k = 0; k < x.size(); ++k) { y[k] = x[k]; }
+    return y;
+}
+
+template <typename T>
+double spectrum_error(const valarray<complex<T>>& x, const valarray<complex<T>>& y) {
+    double err = 0, scale = 0;
+    for (size_t k = 0; k < x.size(); ++k) {
+        err = std::max(err, static_cast<double>(std::abs(x[k] - y[k])));
+        scale = std::max(scale, static_cast<double>(std::abs(y[k])));
+    }
+    return err / ((scale == 0) ? 1 : scale);
+}
+
+#if defined(PHASE_D13_0) | defined(PHASE_D)
+TEST(PhaseD13, FFTSizes) {
+    /* powers of two and four, mixed radix, odd and prime lengths */
+    for (size_t n : {1, 2, 3, 4, 5, 6, 7, 8, 12, 15, 16, 30, 49, 64, 97, 128, 210, 256, 1000}) {
+        valarray<complex<double>> x(n);
+        for (size_t k = 0; k < n; ++k) {
+            x[k] = complex<double>(std::sin(0.3 * k) + (k % 3), std::cos(1.7 * k));
+        }
+        valarray<complex<double>> want = slow_dft(x, -1);
+        valarray<complex<double>> y = copy_of(x);
+        fft(y);
+        EXPECT_LT(spectrum_error(y, want), 1.0e-12) << "n = " << n;
+        ifft(y);
+        EXPECT_LT(spectrum_error(y, x), 1.0e-13) << "n = " << n;
+    }
+
+    /* more sizes than the plan cache holds: the early ones are planned again */
+    for (size_t n = 100; n < 100 + 2 * epl::cached_plans; ++n) {
+        valarray<complex<double>> z(n);
+        fft(z);
+    }
+    valarray<complex<double>> x(7);
+    for (size_t k = 0; k < 7; ++k) { x[k] = complex<double>(k, 1.0); }
+    valarray<complex<double>> y = copy_of(x);
+    EXPECT_LT(spectrum_error(fft(y), slow_dft(x, -1)), 1.0e-12);
+
+    valarray<complex<float>> f(24);
+    for (size_t k = 0; k < 24; ++k) {
+        f[k] = complex<float>(static_cast<float>(k % 5), 1.0f);
+    }
+    valarray<complex<float>> g = copy_of(f);
+    EXPECT_LT(spectrum_error(fft(g), slow_dft(f, -1)), 1.0e-5);
+}
+#endif
+
+#if defined(PHASE_D13_1) | defined(PHASE_D)
+TEST(PhaseD13, FFTLargeAndReal) {
+    /* big enough to split every pass over threads, checked by a single tone and a round trip */
+    const size_t n = 3 * (1 << 15);
+    const double pi = 3.14159265358979323846;
+    valarray<complex<double>> x(n);
+    for (size_t k = 0; k < n; ++k) {
+        x[k] = std::polar(1.0, 2 * pi * static_cast<double>((5 * k) % n) / n);
+    }
+    valarray<complex<double>> y = copy_of(x);
+    fft(y);
+    double off = 0;
+    for (size_t k = 0; k < n; ++k) {
+        if (k != 5) { off = std::max(off, std::abs(y[k])); }
+    }
+    EXPECT_LT(std::abs(y[5] - complex<double>(n, 0)), 1.0e-7);
+    EXPECT_LT(off, 1.0e-7);
+    ifft(y);
+    EXPECT_LT(spectrum_error(y, x), 1.0e-12);
+
+    /* real input: the first half of the complex transform */
+    for (size_t m : {1, 2, 7, 10, 64, 4096 + 6}) {
+        valarray<double> r(m);
+        valarray<complex<double>> c(m);
+        for (size_t k = 0; k < m; ++k) {
+            r[k] = std::sin(0.7 * k) + 0.25 * (k % 4);
+            c[k] = r[k];
+        }
+        valarray<complex<double>> half = rfft(r);
+        fft(c);
+        EXPECT_EQ(m / 2 + 1, half.size());
+        valarray<complex<double>> first(m / 2 + 1);
+        for (size_t k = 0; k <= m / 2; ++k) { first[k] = c[k]; }
+        EXPECT_LT(spectrum_error(half, first), 1.0e-12) << "m = " << m;
+    }
+}
+#endif
+
+#if defined(PHASE_D14_0) | defined(PHASE_D)
+TEST(PhaseD14, SortAndSelect) {
+    /* small and large, ints (radix), doubles with signs and zeros (radix), a comparator (merge) */
+    for (size_t n : {0, 1, 5, 300, 300001}) {
+        valarray<int> v(n);
+        valarray<double> d(n);
+        for (size_t k = 0; k < n; ++k) {
+            v[k] = static_cast<int>((k * 7919) % 1001) - 500;
+            d[k] = (static_cast<double>((k * 104729) % 2003) - 1000.0) / 7.0;
+        }
+        sort(v);
+        sort(d);
+        bool ok = true;
+        for (size_t k = 1; k < n; ++k) {
+            ok = ok && v[k - 1] <= v[k] && d[k - 1] <= d[k];
+        }
+        EXPECT_TRUE(ok) << "n = " << n;
+        sort(v, [](int a, int b) { return a > b; });
+        for (size_t k = 1; k < n; ++k) {
+            ok = ok && v[k - 1] >= v[k];
+        }
+        EXPECT_TRUE(ok) << "n = " << n;
+    }
+
+    valarray<double> inf{2.5, -0.0, std::numeric_limits<double>::infinity(), -1e300, 0.0, -3.0,
+        -std::numeric_limits<double>::infinity(), 1e-300};
+    sort(inf);
+    EXPECT_EQ(-std::numeric_limits<double>::infinity(), inf[0]);
+    EXPECT_EQ(-1e300, inf[1]);
+    EXPECT_EQ(-3.0, inf[2]);
+    EXPECT_TRUE(std::signbit(inf[3]));
+    EXPECT_EQ(1e-300, inf[5]);
+    EXPECT_EQ(std::numeric_limits<double>::infinity(), inf[7]);
+
+    valarray<int> x{9, 1, 8, 2, 7, 3, 6, 4, 5};
+    EXPECT_EQ(5, nth_element(x, 4));
+    for (size_t k = 0; k < 4; ++k) { EXPECT_LT(x[k], 5); }
+    partial_sort(x, 3);
+    EXPECT_EQ(1, x[0]);
+    EXPECT_EQ(2, x[1]);
+    EXPECT_EQ(3, x[2]);
+    EXPECT_THROW(nth_element(x, 9), std::out_of_range);
+}
+#endif
+
+#if defined(PHASE_D14_1) | defined(PHASE_D)
+TEST(PhaseD14, ArgsortAndGather) {
+    valarray<double> a{3.0, 1.0, 2.0, 1.0, -4.0};
+    valarray<size_t> order = argsort(a);
+    size_t want[] = {4, 1, 3, 2, 0};   /* stable: the first 1.0 before the second */
+    for (size_t k = 0; k < 5; ++k) { EXPECT_EQ(want[k], order[k]); }
+
+    valarray<double> y = gather(a, order) * 2.0;
+    EXPECT_EQ(-8.0, y[0]);
+    EXPECT_EQ(6.0, y[4]);
+
+    /* over an expression, with a comparator */
+    valarray<size_t> down = argsort(a * a, [](double p, double q) { return p > q; });
+    EXPECT_EQ(4u, down[0]);
+    EXPECT_EQ(0u, down[1]);
+    EXPECT_EQ(1u, down[3]);
+
+    /* gathering from the destination goes through a temporary */
+    valarray<size_t> rev{4, 3, 2, 1, 0};
+    a = gather(a, rev);
+    EXPECT_EQ(-4.0, a[0]);
+    EXPECT_EQ(3.0, a[4]);
+
+    /* indexes outside e are refused when the gather is built */
+    valarray<size_t> past{0, 5};
+    valarray<int> below{1, -1};
+    EXPECT_THROW(gather(a, past), std::out_of_range);
+    EXPECT_THROW(gather(a, below), std::out_of_range);
+    EXPECT_THROW(gather(a + a, rev + 1), std::out_of_range);
+
+    /* large: stable among equal keys, for the radix and the merge paths */
+    const size_t n = 200003;
+    valarray<int> keys(n);
+    for (size_t k = 0; k < n; ++k) { keys[k] = static_cast<int>((k * 31) % 97); }
+    valarray<size_t> by_radix = argsort(keys);
+    valarray<size_t> by_merge = argsort(keys, [](int p, int q) { return p < q; });
+    bool ok = true;
+    for (size_t k = 1; k < n; ++k) {
+        size_t i = by_radix[k - 1], j = by_radix[k];
+        ok = ok && (keys[i] < keys[j] || (keys[i] == keys[j] && i < j)) && by_merge[k] == j;
+    }
+    EXPECT_TRUE(ok);
+}
+#endif
+
+#if defined(PHASE_D15_0) | defined(PHASE_D)
+TEST(PhaseD15, Histogram) {
+    valarray<double> x{0.0, 0.1, 0.25, 0.5, 0.99, 1.0, -0.1, 1.5, std::nan("")};
+    valarray<size_t> h = histogram(x, 4, 0.0, 1.0);
+    EXPECT_EQ(4u, h.size());
+    EXPECT_EQ(2u, h[0]);    /* 0, 0.1 */
+    EXPECT_EQ(1u, h[1]);    /* 0.25 */
+    EXPECT_EQ(1u, h[2]);    /* 0.5 */
+    EXPECT_EQ(2u, h[3]);    /* 0.99 and hi itself */
+
+    /* of an expression, large enough for several pieces */
+    const size_t n = 300001;
+    valarray<int> v(n);
+    for (size_t k = 0; k < n; ++k) { v[k] = static_cast<int>(k % 10); }
+    valarray<size_t> g = histogram(v * 0.5, 5, 0.0, 5.0);
+    size_t each = n / 10;
+    EXPECT_EQ(2 * each + 1, g[0]);   /* 0 and 0.5, and the extra k % 10 == 0 */
+    EXPECT_EQ(2 * each, g[4]);
+    EXPECT_THROW(histogram(v, 5, 1.0, 1.0), std::domain_error);
+}
+#endif
+
+#if defined(PHASE_D15_1) | defined(PHASE_D)
+TEST(PhaseD15, Bincount) {
+    valarray<int> v{3, 1, 3, 0, 3, 7};
+    valarray<size_t> c = bincount(v);
+    EXPECT_EQ(8u, c.size());
+    EXPECT_EQ(1u, c[0]);
+    EXPECT_EQ(1u, c[1]);
+    EXPECT_EQ(0u, c[2]);
+    EXPECT_EQ(3u, c[3]);
+    EXPECT_EQ(1u, c[7]);
+
+    valarray<int> empty;
+    EXPECT_EQ(0u, bincount(empty).size());
+    EXPECT_THROW(bincount(v - 2), std::domain_error);
+
+    const size_t n = 300001;
+    valarray<int> w(n);
+    for (size_t k = 0; k < n; ++k) { w[k] = static_cast<int>((k * k) % 1000); }
+    valarray<size_t> d = bincount(w + 1);
+    size_t total = 0, want = 0;
+    for (size_t k = 0; k < d.size(); ++k) { total += d[k]; }
+    for (size_t k = 0; k < n; ++k) { want += (w[k] == 0) ? 1 : 0; }
+    EXPECT_EQ(n, total);
+    EXPECT_EQ(0u, d[0]);
+    EXPECT_EQ(want, d[1]);
+
+    /* one large value, and a negative one far from the front */
+    valarray<long> far{2, 1000000, 2};
+    valarray<size_t> f = bincount(far);
+    EXPECT_EQ(1000001u, f.size());
+    EXPECT_EQ(2u, f[2]);
+    EXPECT_EQ(1u, f[1000000]);
+    w[n - 3] = -1;
+    EXPECT_THROW(bincount(w), std::domain_error);
+}
+#endif
+
+#if defined(PHASE_D16_0) | defined(PHASE_D)
+bool on_cache_line(const void* p) { return reinterpret_cast<uintptr_t>(p) % 64 == 0; }
+
+TEST(PhaseD16, AlignedStorage) {
+    valarray<double> e;
+    EXPECT_TRUE(on_cache_line(e.data()));
+    valarray<char> c(3);
+    EXPECT_TRUE(on_cache_line(&c[0]));
+    EXPECT_EQ(64u, valarray<char>::lanes);
+    EXPECT_EQ(8u, valarray<double>::lanes);
+
+    /* growing at the back reallocates, the data stays at the start of a line */
+    valarray<double> x;
+    for (int k = 0; k < 1000; ++k) {
+        x.push_back(k);
+        ASSERT_TRUE(on_cache_line(&x[0]));
+    }
+    /* so does growing and shrinking at the front, at the cost of a shift */
+    x.push_front(-1.0);
+    x.push_front(x[5]);
+    EXPECT_TRUE(on_cache_line(&x[0]));
+    EXPECT_EQ(1002u, x.size());
+    EXPECT_EQ(4.0, x[0]);
+    EXPECT_EQ(-1.0, x[1]);
+    EXPECT_EQ(999.0, x[1001]);
+    x.pop_front();
+    x.pop_front();
+    EXPECT_TRUE(on_cache_line(&x[0]));
+    EXPECT_EQ(0.0, x[0]);
+    EXPECT_EQ(999.0, x[999]);
+
+    valarray<double> y = x * 2.0;
+    valarray<double> z{1, 2, 3};
+    EXPECT_TRUE(on_cache_line(&y[0]));
+    EXPECT_TRUE(on_cache_line(&z[0]));
+
+    /* plain vectors keep their room at the front */
+    vector<int> v;
+    v.push_back(1);
+    v.push_front(0);
+    EXPECT_EQ(0, v[0]);
+    EXPECT_EQ(1, v[1]);
+}
+#endif
+
+#if defined(PHASE_D16_1) | defined(PHASE_D)
+TEST(PhaseD16, PaddedEvaluation) {
+    /* every length around a block boundary, evaluated through the padding */
+    for (size_t n = 0; n < 40; ++n) {
+        valarray<double> a(n), b(n);
+        for (size_t k = 0; k < n; ++k) { a[k] = k + 1.0; b[k] = 2.0 * k; }
+        valarray<double> c = a * b + 1.0;
+        ASSERT_EQ(n, c.size());
+        for (size_t k = 0; k < n; ++k) { ASSERT_EQ((k + 1.0) * (2.0 * k) + 1.0, c[k]); }
+        c = (c / a).sqrt();
+        for (size_t k = 0; k < n; ++k) { ASSERT_DOUBLE_EQ(std::sqrt(2.0 * k + 1.0 / (k + 1.0)), c[k]); }
+    }
+
+    /* a shorter expression leaves the rest of the destination alone */
+    valarray<double> d{1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+    valarray<double> s{1, 1, 1};
+    d = s * 0.5;
+    EXPECT_EQ(10u, d.size());
+    EXPECT_EQ(0.5, d[2]);
+    EXPECT_EQ(4.0, d[3]);
+    EXPECT_EQ(10.0, d[9]);
+
+    /* integer leaves are never read past their end */
+    valarray<int> i{1, 2, 3};
+    valarray<double> r = i * 1.5;
+    EXPECT_EQ(4.5, r[2]);
+}
+#endif
+
+#if defined(PHASE_D17_0) | defined(PHASE_D)
+TEST(PhaseD17, ViewsAsLeaves) {
+    std::vector<double> frame{1, 2, 3, 4, 5};
+    const std::vector<double>& in = frame;
+    valarray_view<double> v(frame.data(), frame.size());
+    valarray_view<const double> c = view(in);
+    static_assert(std::is_same<decltype(c)::value_type, double>::value, "elements of a const view");
+
+    valarray<double> y = v * 2.0 + c;
+    EXPECT_EQ(5u, y.size());
+    EXPECT_EQ(3.0, y[0]);
+    EXPECT_EQ(15.0, y[4]);
+
+    /* mixed with valarrays, the shorter operand wins as usual */
+    valarray<double> w{10, 20, 30};
+    valarray<double> z = w - view(frame);
+    EXPECT_EQ(3u, z.size());
+    EXPECT_EQ(27.0, z[2]);
+
+    /* kernels over whole ranges */
+    double total, largest;
+    std::tie(total, largest) = reduce(c, reducers::sum, reducers::max);
+    EXPECT_EQ(15.0, total);
+    EXPECT_EQ(5.0, largest);
+    valarray<double> s = inclusive_scan(view(frame.data() + 1, 3));
+    EXPECT_EQ(9.0, s[2]);
+
+    /* no copy: the view sees later writes to the buffer */
+    frame[0] = 100.0;
+    EXPECT_EQ(100.0, c[0]);
+    EXPECT_EQ(0u, view(frame.data(), 0).len());
+}
+#endif
+
+#if defined(PHASE_D17_1) | defined(PHASE_D)
+TEST(PhaseD17, ViewsAsTargets) {
+    std::vector<double> buf(8, 1.0);
+    valarray_view<double> v = view(buf);
+    valarray<double> a{1, 2, 3, 4, 5, 6, 7, 8};
+    v = a * a;
+    EXPECT_EQ(64.0, buf[7]);
+    v = v + 1.0;
+    EXPECT_EQ(2.0, buf[0]);
+    v = 0.5;
+    EXPECT_EQ(0.5, buf[3]);
+
+    /* a shorter expression writes a prefix, a longer one is an error */
+    valarray<double> b{9, 9};
+    v = b;
+    EXPECT_EQ(9.0, buf[1]);
+    EXPECT_EQ(0.5, buf[2]);
+    valarray<double> big(9);
+    EXPECT_THROW(v = big, std::length_error);
+
+    /* overlapping views out of step go through a temporary */
+    for (size_t k = 0; k < 8; ++k) { buf[k] = static_cast<double>(k); }
+    valarray_view<double> head(buf.data(), 7), tail(buf.data() + 1, 7);
+    tail = head * 10.0;
+    EXPECT_EQ(0.0, buf[0]);
+    EXPECT_EQ(0.0, buf[1]);
+    EXPECT_EQ(60.0, buf[7]);
+    head = tail;
+    EXPECT_EQ(0.0, buf[0]);
+    EXPECT_EQ(10.0, buf[1]);
+    EXPECT_EQ(20.0, buf[2]);
+    EXPECT_EQ(60.0, buf[7]);
+
+    /* bulk nodes write straight into the view */
+    valarray<int> ones{1, 1, 1, 1};
+    std::vector<int> out(4);
+    view(out) = inclusive_scan(ones);
+    EXPECT_EQ(4, out[3]);
+
+    /* and a valarray's own storage can be viewed */
+    valarray_view<double> inner = view(a.data() + 2, 4);
+    inner = inner * -1.0;
+    EXPECT_EQ(2.0, a[1]);
+    EXPECT_EQ(-3.0, a[2]);
+    EXPECT_EQ(-6.0, a[5]);
+    EXPECT_EQ(7.0, a[6]);
+}
+#endif
+
+#if defined(PHASE_D18_0) | defined(PHASE_D)
+template <class T>
+struct larger {
+    using result_type = T;
+    T operator()(const T& x, const T& y) const { return (x < y) ? y : x; }
+};
+
+TEST(PhaseD18, ChunkedStreaming) {
+    const size_t n = 10007;
+    chunk_options small;
+    small.chunk = 1000;
+    small.resident = 3;
+    {
+        chunked_valarray<double> a("chunked_a.bin", n, small), b("chunked_b.bin", n, small);
+        EXPECT_EQ(11u, a.chunks());
+        valarray<double> x(n);
+        for (size_t k = 0; k < n; ++k) { x[k] = static_cast<double>(k); }
+        a = x * 1.0;
+        b = a * 2.0 + 1.0;
+        EXPECT_EQ(3.0, b[1]);
+        EXPECT_EQ(2.0 * (n - 1) + 1.0, b[n - 1]);
+
+        /* in place, and reading both arrays at once through a three chunk cache */
+        b = b - a;
+        double s = (a + b).accumulate(std::plus<double>());
+        EXPECT_EQ(2.0 * (n - 1) * n / 2 + n, s);
+        EXPECT_EQ(static_cast<double>(n), (b - a).accumulate(std::plus<double>()));
+
+        valarray<double> back = b * 1.0;
+        EXPECT_EQ(n, back.size());
+        EXPECT_EQ(101.0, back[100]);
+
+        a.set(5, -1.0);
+        EXPECT_EQ(-1.0, a[5]);
+        EXPECT_THROW(a[n], std::out_of_range);
+        valarray<double> big(n + 1);
+        EXPECT_THROW(a = big, std::length_error);
+    }
+
+    /* everything made it to the file */
+    {
+        chunked_valarray<double> a("chunked_a.bin", small);
+        EXPECT_EQ(n, a.len());
+        EXPECT_EQ(-1.0, a[5]);
+        EXPECT_EQ(9999.0, a[9999]);
+        EXPECT_EQ(static_cast<double>(n - 1), a.accumulate(larger<double>()));
+    }
+    std::remove("chunked_a.bin");
+    std::remove("chunked_b.bin");
+}
+#endif
+
+#if defined(PHASE_D18_1) | defined(PHASE_D)
+TEST(PhaseD18, ChunkedPartialAndAliasing) {
+    chunk_options small;
+    small.chunk = 64;
+    small.resident = 2;
+    small.prefetch = 3;
+    chunked_valarray<int> c("chunked_c.bin", 200, small);
+    c = 7;
+    /* a shorter expression only rewrites the front, the partly written chunk is read first */
+    valarray<int> ones(100);
+    ones = ones + 1;
+    c = ones;
+    EXPECT_EQ(1, c[99]);
+    EXPECT_EQ(7, c[100]);
+    EXPECT_EQ(7, c[199]);
+    EXPECT_EQ(100 + 7 * 100, c.accumulate(std::plus<int>()));
+
+    /* reading itself out of step is refused */
+    valarray<size_t> idx{1, 0};
+    EXPECT_THROW(c = gather(c, idx), std::logic_error);
+    std::remove("chunked_c.bin");
+}
+#endif
+
+#if defined(PHASE_D18_2) | defined(PHASE_D)
+TEST(PhaseD18, ChunkedSelfAssignmentAndThreads) {
+    chunk_options small;
+    small.chunk = 100;
+    small.resident = 2;
+    small.prefetch = 1;
+    const size_t n = 1000;
+    valarray<double> x(n);
+    for (size_t k = 0; k < n; k++) {
+        x[k] = static_cast<double>(k);
+    }
+    {
+        /* fewer chunks resident than there are: every chunk has to come back from the disk */
+        chunked_valarray<double> a("chunked_d.bin", n, small);
+        a = x * 1.0;
+        a.flush();
+        EXPECT_EQ(999.0, a[999]);
+        EXPECT_EQ(500.0, a[500]);
+        a = a * 2.0;
+        EXPECT_EQ(0.0, a[0]);
+        EXPECT_EQ(2.0, a[1]);
+        EXPECT_EQ(100.0, a[50]);
+        EXPECT_EQ(1998.0, a[999]);
+        EXPECT_EQ(static_cast<double>(n * (n - 1)), a.accumulate(std::plus<double>()));
+
+        /* the parallel kernels stay on the calling thread */
+        EXPECT_EQ(static_cast<double>(n * (n - 1)), std::get<0>(reduce(a, reducers::sum)));
+        valarray<double> in = inclusive_scan(a);
+        EXPECT_EQ(static_cast<double>(n * (n - 1)), in[n - 1]);
+
+        /* and any other thread is refused */
+        auto e = a + 0.0;
+        auto other = std::async(std::launch::async, [&]() { return std::get<0>(reduce(e, reducers::sum)); });
+        EXPECT_THROW(other.get(), std::logic_error);
+    }
+    std::remove("chunked_d.bin");
+}
+#endif
+
+#if defined(PHASE_D18_3) | defined(PHASE_D)
+TEST(PhaseD18, ChunkedPinsOnlyItsEvaluations) {
+    chunk_options small;
+    small.chunk = 10000;
+    const size_t n = 200000;
+    chunked_valarray<double> a("chunked_e.bin", n, small);
+    valarray<double> x(n);
+    for (size_t k = 0; k < n; k++) {
+        x[k] = static_cast<double>(k);
+    }
+    a = x * 1.0;
+
+    /* a stored expression does not keep its thread pinned */
+    auto e = a * 2.0;
+    EXPECT_EQ(0u, thread_pinned());
+    const size_t m = 300000;
+    valarray<double> y(m);
+    for (size_t k = 0; k < m; k++) {
+        y[k] = static_cast<double>((k * 7919) % m);
+    }
+    sort(y);
+    for (size_t k = 0; k < m; k++) {
+        ASSERT_EQ(static_cast<double>(k), y[k]);
+    }
+
+    /* reading it runs every piece on this thread, and unpins afterwards */
+    EXPECT_EQ(static_cast<double>(n) * (n - 1), std::get<0>(reduce(e, reducers::sum)));
+    valarray<double> in = inclusive_scan(e);
+    EXPECT_EQ(static_cast<double>(n) * (n - 1), in[n - 1]);
+    EXPECT_EQ(0u, thread_pinned());
+    std::remove("chunked_e.bin");
+}
+#endif
+
+#if defined(PHASE_D19_0) | defined(PHASE_D)
+TEST(PhaseD19, SparseExpressions) {
+    valarray<double> dense_x{0, 1, 0, 0, 2, 0, 3, 0};
+    sparse_valarray<double> x(dense_x), y(8);
+    EXPECT_EQ(3u, x.nnz());
+    y.set(6, 10.0);
+    y.set(1, 5.0);
+    y.set(7, -1.0);
+    y.set(1, 4.0);
+    EXPECT_EQ(3u, y.nnz());
+    EXPECT_EQ(4.0, y[1]);
+    EXPECT_EQ(0.0, y[2]);
+
+    sparse_valarray<double> u = 2.0 * x + y;
+    EXPECT_EQ(4u, u.nnz());     /* 1, 4, 6, 7 */
+    EXPECT_EQ(6.0, u[1]);
+    EXPECT_EQ(4.0, u[4]);
+    EXPECT_EQ(16.0, u[6]);
+    EXPECT_EQ(-1.0, u[7]);
+
+    sparse_valarray<double> w = x * y;
+    EXPECT_EQ(2u, w.nnz());     /* 1 and 6 */
+    EXPECT_EQ(4.0, w[1]);
+    EXPECT_EQ(30.0, w[6]);
+    EXPECT_EQ(34.0, dot(x, y));
+
+    /* x - x keeps the pattern until pruned, and may read the array it is assigned to */
+    sparse_valarray<double> z = x;
+    z = z - x;
+    EXPECT_EQ(3u, z.nnz());
+    z.prune();
+    EXPECT_EQ(0u, z.nnz());
+    z = -x / 2.0;
+    EXPECT_EQ(-1.5, z[6]);
+
+    /* with dense operands, only read at the nonzeros */
+    valarray<double> a{1, 2, 3, 4, 5, 6, 7, 8};
+    sparse_valarray<double> g = x * (a + 1.0);
+    EXPECT_EQ(3u, g.nnz());
+    EXPECT_EQ(3.0, g[1]);
+    EXPECT_EQ(24.0, g[6]);
+    EXPECT_EQ(1.0 * 2 + 2.0 * 5 + 3.0 * 7, dot(x, a));
+    EXPECT_EQ(dot(x, a), dot(a, x));
+
+    valarray<double> full = u.dense();
+    EXPECT_EQ(8u, full.size());
+    EXPECT_EQ(0.0, full[0]);
+    EXPECT_EQ(16.0, full[6]);
+
+    sparse_valarray<double> shorter(7);
+    EXPECT_THROW(x + shorter, std::length_error);
+}
+#endif
+
+#if defined(PHASE_D19_1) | defined(PHASE_D)
+TEST(PhaseD19, SparseAxpyAndScale) {
+    /* a million long, a thousand nonzeros: nothing here may touch every index */
+    const size_t n = 1000000;
+    sparse_valarray<double> x(n), y(n);
+    for (size_t k = 0; k < 1000; ++k) {
+        x.set(k * 997, 1.0 + k);
+        y.set(k * 1000, 2.0);
+    }
+    valarray<double> d(n);
+    axpy(0.5, x, d);
+    EXPECT_EQ(0.5, d[0]);
+    EXPECT_EQ(0.5 * 2.0, d[997]);
+    EXPECT_EQ(0.0, d[998]);
+
+    axpy(2, x, y);
+    EXPECT_EQ(1999u, y.nnz());     /* only 0 is in both */
+    EXPECT_EQ(2.0 + 2.0, y[0]);
+    EXPECT_EQ(2.0 * 2.0, y[997]);
+    EXPECT_EQ(2.0, y[1000]);
+    EXPECT_EQ(2.0 * 1000.0, y[999 * 997]);
+
+    double want = 0;
+    for (size_t k = 0; k < 1000; ++k) { want += (1.0 + k) * y[k * 997]; }
+    EXPECT_EQ(want, dot(x, y));
+}
+#endif
+
+#if defined(PHASE_D20_0) | defined(PHASE_D)
+TEST(PhaseD20, PhiloxAndUniform) {
+    /* known answers for Philox4x32-10 (Random123) */
+    philox_block b = philox4x32(0, 0, 0, 0, 0, 0);
+    EXPECT_EQ(0x6627e8d5u, b.w[0]);
+    EXPECT_EQ(0xe169c58du, b.w[1]);
+    EXPECT_EQ(0xbc57ac4cu, b.w[2]);
+    EXPECT_EQ(0x9b00dbd8u, b.w[3]);
+    b = philox4x32(0x243f6a88u, 0x85a308d3u, 0x13198a2eu, 0x03707344u, 0xa4093822u, 0x299f31d0u);
+    EXPECT_EQ(0xd16cfe09u, b.w[0]);
+    EXPECT_EQ(0x94fdccebu, b.w[1]);
+    EXPECT_EQ(0x5001e420u, b.w[2]);
+    EXPECT_EQ(0x24126ea1u, b.w[3]);
+
+    /* filled across threads or read one at a time, the numbers are the same */
+    const size_t n = 1000003;
+    valarray<double> u = uniform(n, 42);
+    auto lazy = uniform(n, 42);
+    for (size_t k = 0; k < n; k += 9973) { ASSERT_EQ(lazy[k], u[k]); }
+    EXPECT_EQ(u[n - 1], lazy[n - 1]);
+
+    double m, v, lo, hi;
+    std::tie(m, v, lo, hi) = reduce(u, reducers::mean, reducers::variance, reducers::min, reducers::max);
+    EXPECT_NEAR(0.5, m, 2e-3);
+    EXPECT_NEAR(1.0 / 12, v, 2e-3);
+    EXPECT_LE(0.0, lo);
+    EXPECT_GT(1.0, hi);
+
+    /* streams and seeds are different sequences, and mix into expressions */
+    valarray<double> other = uniform(n, 42, 1) - u;
+    EXPECT_NE(0.0, other[0]);
+    EXPECT_NEAR(0.0, std::get<0>(reduce(other, reducers::mean)), 4e-3);
+    valarray<double> x = 2.0 * uniform(8, 7) - 1.0;
+    EXPECT_EQ(2.0 * uniform(8, 7)[3] - 1.0, x[3]);
+    valarray<float> f = uniform<float>(1000, 7);
+    EXPECT_LE(0.0f, std::get<0>(reduce(f, reducers::min)));
+    EXPECT_GT(1.0f, std::get<0>(reduce(f, reducers::max)));
+
+    /* long double has no draw, uniform<long double> is not a candidate */
+    static_assert(random_real<float>::value && !random_real<long double>::value, "float and double only");
+}
+#endif
+
+#if defined(PHASE_D20_1) | defined(PHASE_D)
+TEST(PhaseD20, Normal) {
+    const size_t n = 1 << 20;
+    valarray<double> z = normal(n, 2024, 3);
+    statistics<double> s = std::get<0>(reduce(z, reducers::moments));
+    EXPECT_NEAR(0.0, s.mean, 5e-3);
+    EXPECT_NEAR(1.0, s.variance(), 5e-3);
+    EXPECT_NEAR(0.0, s.skewness(), 1e-2);
+    EXPECT_TRUE(std::isfinite(std::get<0>(reduce(z, reducers::min))));
+
+    /* u - u of the same draw is exactly zero, the node is deterministic */
+    valarray<double> zero = normal(n, 2024, 3) - normal(n, 2024, 3);
+    EXPECT_EQ(0.0, std::get<0>(reduce(zero, reducers::max)));
+    valarray<float> g = 1.0f + 2.0f * normal<float>(4096, 1);
+    EXPECT_NEAR(1.0, std::get<0>(reduce(g, reducers::mean)), 0.1);
+}
+#endif
+
+#if defined(PHASE_D21_0) | defined(PHASE_D)
+TEST(PhaseD21, DotAndNrm2) {
+    /* small integers, so every order of summation gives the same answer */
+    const size_t n = 300007;
+    valarray<double> x(n), y(n);
+    double expect = 0;
+    for (size_t k = 0; k < n; k++) {
+        x[k] = k % 7;
+        y[k] = 3.0 - k % 5;
+        expect += x[k] * y[k];
+    }
+    EXPECT_EQ(expect, dot(x, y));
+    EXPECT_EQ((x * y).sum(), dot(x, y));
+    EXPECT_EQ(2 * expect, dot(2.0 * x, y));
+    EXPECT_EQ(dot(x, x + y), dot(x, x) + dot(x, y));
+
+    /* the shorter length, views, mixed types and nodes that compute everything at once */
+    valarray<double> a{1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+    valarray<float> b{1, 1, 1, 1, 1, 1, 1, 1, 1};
+    EXPECT_EQ(45.0, dot(a, b));
+    EXPECT_EQ(2.0 * 1 + 3 * 2 + 4 * 3, dot(view(a.data() + 1, 3), a));
+    EXPECT_EQ(1.0 + 3 + 6 + 10, dot(inclusive_scan(a), valarray<double>{1, 1, 1, 1}));
+    EXPECT_EQ(0.0, dot(valarray<double>(), a));
+    valarray<complex<double>> c{complex<double>(1, 1), complex<double>(2, -1)};
+    EXPECT_EQ(complex<double>(3, -2), dot(c, c));
+
+    /* the sparse overloads still win for sparse operands */
+    sparse_valarray<double> s(n);
+    s.set(10, 2.0);
+    s.set(12, 3.0);
+    EXPECT_EQ(2.0 * x[10] + 3.0 * x[12], dot(s, x));
+
+    valarray<double> v{3, 4};
+    EXPECT_EQ(5.0, nrm2(v));
+    EXPECT_NEAR(std::sqrt(dot(x, x)), nrm2(x), 1e-9);
+    EXPECT_EQ(0.0, nrm2(0.0 * v));
+    EXPECT_EQ(0.0, nrm2(valarray<double>()));
+
+    /* the squares over- or underflow, the norm does not */
+    EXPECT_NEAR(5e200, nrm2(1e200 * v), 1e188);
+    EXPECT_NEAR(5e-200, nrm2(1e-200 * v), 1e-212);
+    valarray<double> mixed{1e300, 1e-300, 1e300};
+    EXPECT_NEAR(std::sqrt(2.0) * 1e300, nrm2(mixed), 1e288);
+    valarray<float> f{3e30f, 4e30f};
+    EXPECT_NEAR(5e30f, nrm2(f), 1e24f);
+
+    double inf = std::numeric_limits<double>::infinity();
+    mixed[1] = inf;
+    EXPECT_EQ(inf, nrm2(mixed));
+    mixed[2] = std::nan("");
+    EXPECT_TRUE(std::isnan(nrm2(mixed)));
+}
+#endif
+
+#if defined(PHASE_D21_1) | defined(PHASE_D)
+TEST(PhaseD21, AxpyAndScal) {
+    const size_t n = 200003;
+    valarray<double> x(n), y(n);
+    for (size_t k = 0; k < n; k++) {
+        x[k] = k % 11;
+        y[k] = 1.0;
+    }
+    axpy(2.0, x, y);
+    for (size_t k = 0; k < n; k += 997) { ASSERT_EQ(1.0 + 2.0 * (k % 11), y[k]); }
+    EXPECT_EQ(1.0 + 2.0 * ((n - 1) % 11), y[n - 1]);
+
+    /* y += a y reads y in step, x from a later part of y does not */
+    axpy(-0.5, y, y);
+    EXPECT_EQ(0.5 + 1.0 * (5 % 11), y[5]);
+    valarray<double> z{1, 2, 3, 4, 5};
+    axpy(1.0, view(z.data() + 1, 4), z);
+    EXPECT_EQ((valarray<double>{3, 5, 7, 9, 5}[3]), z[3]);
+    EXPECT_EQ(3.0, z[0]);
+    EXPECT_EQ(5.0, z[4]);
+
+    /* expressions, a view as the target, a shorter x and a shorter y */
+    valarray<double> w{1, 1, 1, 1};
+    axpy(1.0, valarray<double>{1, 2} * 3.0, w);
+    EXPECT_EQ(4.0, w[0]);
+    EXPECT_EQ(7.0, w[1]);
+    EXPECT_EQ(1.0, w[2]);
+    axpy(2.0, valarray<int>{1, 1}, view(w.data() + 2, 2));
+    EXPECT_EQ(3.0, w[3]);
+    EXPECT_THROW(axpy(1.0, x, w), std::length_error);
+
+    scal(0.5, x);
+    EXPECT_EQ(5.0, x[10]);
+    scal(4, view(x.data(), 2));
+    EXPECT_EQ(4.0 * 0.5, x[1]);
+    EXPECT_EQ(0.5 * 2, x[2]);
+    valarray<float> g{1, 2};
+    scal(1.5, g);
+    EXPECT_EQ(3.0f, g[1]);
+}
+#endif
+
+#if defined(PHASE_D22_0) | defined(PHASE_D)
+TEST(PhaseD22, Shifts) {
+    valarray<int> x{1, 2, 3, 4, 5};
+    valarray<int> s = shift(x, 2);
+    EXPECT_EQ(3, s[0]);
+    EXPECT_EQ(5, s[2]);
+    EXPECT_EQ(0, s[3]);
+    valarray<int> r = cshift(x, -1);
+    EXPECT_EQ(5, r[0]);
+    EXPECT_EQ(4, r[4]);
+    EXPECT_EQ(2, cshift(x, 11)[0]);
+    EXPECT_EQ(1, shift(x, -3, boundary::clamp)[2]);
+    EXPECT_EQ(5, shift(x, 7, boundary::clamp)[0]);
+
+    /* differences of neighbours inside a larger expression */
+    valarray<double> u{0, 1, 4, 9, 16};
+    valarray<double> d = shift(u, 1) - u;
+    EXPECT_EQ(7.0, d[3]);
+    EXPECT_EQ(-16.0, d[4]);
+
+    /* shifting in place reads ahead of the writes, so it goes through a temporary */
+    x = shift(x, -1);
+    EXPECT_EQ(0, x[0]);
+    EXPECT_EQ(1, x[1]);
+    EXPECT_EQ(4, x[4]);
+    valarray<int> y{1, 2, 3, 4, 5};
+    y = y + shift(y, 1);
+    EXPECT_EQ(3, y[0]);
+    EXPECT_EQ(5, y[4]);
+}
+#endif
+
+#if defined(PHASE_D22_1) | defined(PHASE_D)
+TEST(PhaseD22, StencilAndConvolve) {
+    const size_t n = 200003;
+    valarray<double> u(n);
+    for (size_t k = 0; k < n; k++) { u[k] = double(k % 13) * double(k % 13); }
+
+    /* bulk evaluation agrees with the lazy elements, and with shifts, for every policy */
+    valarray<double> d2 = stencil<1, -2, 1>(u);
+    valarray<double> check = shift(u, -1) - 2.0 * u + shift(u, 1);
+    for (size_t k = 0; k < n; k += 331) { ASSERT_EQ(check[k], d2[k]); }
+    EXPECT_EQ(check[0], d2[0]);
+    EXPECT_EQ(check[n - 1], d2[n - 1]);
+    EXPECT_EQ((stencil<1, -2, 1>(u)[n - 1]), d2[n - 1]);
+
+    valarray<double> w = stencil<1, -2, 1>(u, boundary::wrap);
+    EXPECT_EQ(u[n - 1] - 2 * u[0] + u[1], w[0]);
+    EXPECT_EQ(u[n - 2] - 2 * u[n - 1] + u[0], w[n - 1]);
+    valarray<double> c = stencil<1, -2, 1>(u, boundary::clamp);
+    EXPECT_EQ(u[1] - u[0], c[0]);
+    EXPECT_EQ(u[n - 2] - u[n - 1], c[n - 1]);
+
+    /* even widths lean forward, operands are evaluated once, short inputs are all boundary */
+    valarray<double> f = stencil<-1, 1>(2.0 * u);
+    EXPECT_EQ(2 * (u[6] - u[5]), f[5]);
+    EXPECT_EQ(-2 * u[n - 1], f[n - 1]);
+    valarray<double> tiny{1, 2};
+    valarray<double> t = stencil<1, 1, 1, 1, 1>(tiny);
+    EXPECT_EQ(3.0, t[0]);
+    EXPECT_EQ(3.0, t[1]);
+    valarray<double> empty = stencil<1, 2, 1>(valarray<double>());
+    EXPECT_EQ(0, empty.size());
+
+    /* convolution flips the weights, and matches the stencil with the weights reversed */
+    valarray<double> h{0.5, 0.25, 0.125, 0.0625};
+    valarray<double> y = convolve(u, h);
+    EXPECT_EQ(0.5 * u[11] + 0.25 * u[10] + 0.125 * u[9] + 0.0625 * u[8], y[10]);
+    EXPECT_EQ(convolve(u, h)[n - 1], y[n - 1]);
+    EXPECT_EQ(convolve(u, h)[0], y[0]);
+    EXPECT_EQ(0.25 * u[0] + 0.125 * u[0] + 0.0625 * u[0] + 0.5 * u[1], convolve(u, h, boundary::clamp)[0]);
+    valarray<double> s = convolve(u, valarray<double>{1, 2, 3}, boundary::wrap);
+    valarray<double> r = stencil<3, 2, 1>(u, boundary::wrap);
+    for (size_t k = 0; k < n; k += 997) { ASSERT_EQ(r[k], s[k]); }
+    EXPECT_EQ(r[0], s[0]);
+    EXPECT_EQ(r[n - 1], s[n - 1]);
+
+    /* in place */
+    valarray<double> v{1, 2, 3, 4};
+    v = stencil<1, 1>(v);
+    EXPECT_EQ(3.0, v[0]);
+    EXPECT_EQ(7.0, v[2]);
+    EXPECT_EQ(4.0, v[3]);
+}
+#endif
+
+#if defined(PHASE_D23_0) | defined(PHASE_D)
+TEST(PhaseD23, RollingSumAndMean) {
+    valarray<int> x{1, 2, 3, 4, 5, 6};
+    valarray<int> s = rolling_sum(x, 3);
+    EXPECT_EQ(4, s.size());
+    EXPECT_EQ(6, s[0]);
+    EXPECT_EQ(15, s[3]);
+    EXPECT_EQ(9, rolling_sum(x, 3)[1]);
+    valarray<double> m = rolling_mean(x, 4);
+    EXPECT_EQ(3, m.size());
+    EXPECT_EQ(2.5, m[0]);
+    EXPECT_EQ(4.5, m[2]);
+    EXPECT_EQ(1, rolling_sum(x, 6).size());
+    EXPECT_EQ(0, rolling_sum(x, 7).size());
+    EXPECT_THROW(rolling_mean(x, 0), std::domain_error);
+
+    /* long enough to be split over threads, the sliding sum stays close to the direct one */
+    const size_t n = 500009, w = 1000;
+    valarray<double> u(n);
+    for (size_t k = 0; k < n; k++) { u[k] = 1e6 + double(k % 101) * 0.1 - (k % 7 == 0 ? 1e6 : 0.0); }
+    valarray<double> r = rolling_mean(2.0 * u, w);
+    EXPECT_EQ(n - w + 1, r.size());
+    for (size_t k = 0; k < r.size(); k += 4999) {
+        ASSERT_NEAR((rolling_mean(2.0 * u, w)[k]), r[k], 1e-9) << k;
+    }
+    EXPECT_NEAR((rolling_mean(2.0 * u, w)[n - w]), r[n - w], 1e-9);
+
+    /* a NaN only spoils the windows it is in */
+    valarray<double> v{1, 2, std::nan(""), 4, 5, 6};
+    valarray<double> t = rolling_sum(v, 2);
+    EXPECT_EQ(3.0, t[0]);
+    EXPECT_TRUE(std::isnan(t[1]));
+    EXPECT_TRUE(std::isnan(t[2]));
+    EXPECT_EQ(9.0, t[3]);
+    EXPECT_EQ(11.0, t[4]);
+}
+#endif
+
+#if defined(PHASE_D23_1) | defined(PHASE_D)
+TEST(PhaseD23, RollingMinAndMax) {
+    valarray<int> x{5, 3, 4, 1, 2, 8, 7, 6};
+    valarray<int> lo = rolling_min(x, 3), hi = rolling_max(x, 3);
+    int lows[] = {3, 1, 1, 1, 2, 6};
+    int highs[] = {5, 4, 4, 8, 8, 8};
+    for (size_t k = 0; k < 6; k++) {
+        EXPECT_EQ(lows[k], lo[k]);
+        EXPECT_EQ(highs[k], hi[k]);
+        EXPECT_EQ(lows[k], rolling_min(x, 3)[k]);
+    }
+    valarray<int> same = rolling_max(x, 1);
+    EXPECT_EQ(7, same[6]);
+
+    /* against the direct minimum, across thread pieces, with runs of ties and a falling stretch */
+    const size_t n = 300007, w = 777;
+    valarray<double> u(n);
+    for (size_t k = 0; k < n; k++) { u[k] = (k % 5000 < 2000) ? -double(k % 5000) : double((k * 7919) % 1009 / 10); }
+    valarray<double> m = rolling_min(u, w), M = rolling_max(u, w);
+    for (size_t k = 0; k < m.size(); k += 1013) {
+        double a = u[k], b = u[k];
+        for (size_t j = k; j < k + w; j++) {
+            a = (u[j] < a) ? u[j] : a;
+            b = (b < u[j]) ? u[j] : b;
+        }
+        ASSERT_EQ(a, m[k]) << k;
+        ASSERT_EQ(b, M[k]) << k;
+    }
+
+    /* NaNs are skipped, a window of nothing else is +inf / -inf */
+    double nan = std::nan("");
+    valarray<double> v{nan, nan, 3, nan, 1};
+    valarray<double> vl = rolling_min(v, 2), vh = rolling_max(v, 2);
+    EXPECT_EQ(std::numeric_limits<double>::infinity(), vl[0]);
+    EXPECT_EQ(-std::numeric_limits<double>::infinity(), vh[0]);
+    EXPECT_EQ(3.0, vl[1]);
+    EXPECT_EQ(3.0, vh[2]);
+    EXPECT_EQ(1.0, vl[3]);
+    EXPECT_EQ(1.0, (rolling_max(v, 2)[3]));
+}
+#endif
+
+#if defined(PHASE_D24_0) | defined(PHASE_D)
+TEST(PhaseD24, FixedExtent) {
+    constexpr valarray<double, 3> c{1, 2, 3};
+    static_assert(c[2] == 3.0 && c.size() == 3, "construction and reads are constexpr");
+    static_assert(sizeof(valarray<float, 4>) == 4 * sizeof(float), "elements are stored inline");
+
+    valarray<double, 3> p{1, 2, 3}, v{0.5, 0, -1};
+    valarray<double, 3> q = p + 2.0 * v;
+    EXPECT_EQ(2.0, q[0]);
+    EXPECT_EQ(1.0, q[2]);
+    EXPECT_EQ(9.0, (q * q).sum());
+    valarray<double, 3> z;
+    EXPECT_EQ(0.0, z[1]);
+
+    /* copies copy the elements, in place updates are fine, out of step reads go through a temporary */
+    valarray<double, 3> r = q;
+    r[0] = 7;
+    EXPECT_EQ(2.0, q[0]);
+    q = q * q - 1.0;
+    EXPECT_EQ(3.0, q[0]);
+    EXPECT_EQ(0.0, q[2]);
+    valarray<int, 4> x{1, 2, 3, 4};
+    x = valarray<int, 4>(x.sqrt() * 0 + 1) + x;
+    EXPECT_EQ(5, x[3]);
+    x = 6;
+    EXPECT_EQ(6, x[0]);
+
+    /* mixed with dynamic valarrays and views: the shorter length */
+    valarray<double> d{10, 20, 30, 40};
+    valarray<double> e = d + p;
+    EXPECT_EQ(3, e.size());
+    EXPECT_EQ(33.0, e[2]);
+    valarray<double, 3> f = d * 2.0 - 1.0 + 0.0 * view(d.data() + 1, 3);
+    EXPECT_EQ(39.0, f[1]);
+    EXPECT_THROW((valarray<double, 3>(d)), std::length_error);
+    valarray<double, 4> g = p;
+    EXPECT_EQ(3.0, g[2]);
+    EXPECT_EQ(0.0, g[3]);
+
+    /* past the written out sizes it loops, with the same results */
+    valarray<double, 40> big;
+    for (size_t k = 0; k < big.size(); k++) { big[k] = double(k); }
+    valarray<double, 40> twice = big + big;
+    EXPECT_EQ(78.0, twice[39]);
+    EXPECT_EQ(1560.0, twice.sum());
+    valarray<complex<double>, 2> w{complex<double>(1, 1), 2.0};
+    valarray<complex<double>, 2> w2 = w * w;
+    EXPECT_EQ(complex<double>(0, 2), w2[0]);
+}
+#endif
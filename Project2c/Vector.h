@@ -11,15 +11,51 @@
 #define VECTOR_HPP_
 
 #include <cstdint>
+#include <cstring>
 #include <iterator>
+#include <new>
 #include <stdexcept>
+#include <type_traits>
 #include <utility>
 
 #include "InstanceCounter.h"
 
 namespace epl {
 
-template <typename T>
+/*
+ * where a vector keeps its elements
+ *
+ * plain_layout is what vector has always done: the data floats in the middle
+ * of the storage, so there is room at both ends and push_front is O(1).
+ *
+ * aligned_layout<A> starts the storage on an A byte boundary, rounds the
+ * capacity up to a whole number of blocks of lanes = A / sizeof(T) elements
+ * and keeps element 0 at the start of the storage. So &v[0] is always
+ * aligned, and reading on from the last element to the end of its block is
+ * always inside the allocation. When T is trivial that spare room is zeroed
+ * when it is allocated, so it never holds uninitialized memory. The price is
+ * that push_front and pop_front shift all the elements, O(n).
+ */
+struct plain_layout {
+	static const size_t alignment = 0;
+};
+template <size_t A>
+struct aligned_layout {
+	static_assert((A & (A - 1)) == 0 && A >= sizeof(void*), "alignment must be a power of two, at least a pointer");
+	static const size_t alignment = A;
+};
+
+/* p, with a promise to the compiler that it is A byte aligned */
+template <size_t A, typename T>
+T* assume_aligned(T* p) {
+#if defined(__GNUC__)
+	return static_cast<T*>(__builtin_assume_aligned(p, A));
+#else
+	return p;
+#endif
+}
+
+template <typename T, class Layout = plain_layout>
 class vector {
 private:
 	/*
@@ -39,11 +75,17 @@ private:
 	T* dend; // end of data
 	
 	const uint64_t minimum_capacity = 8;
+
+	static const size_t alignment = Layout::alignment;
+	static const bool anchored = alignment != 0;
 public:
 	using value_type=T;
+	/* elements per aligned block (1 for plain_layout), the capacity is a multiple of this */
+	static const uint64_t lanes = (anchored && sizeof(T) < alignment) ? alignment / sizeof(T) : 1;
+
 	vector(void) {
 		uint64_t capacity = minimum_capacity;
-		sbegin = reinterpret_cast<T*>(operator new(capacity * sizeof(T)));
+		sbegin = allocate(capacity, 0);
 		send = sbegin + capacity;
 		dbegin = dend = sbegin;
 
@@ -53,7 +95,7 @@ public:
 	explicit vector(uint64_t sz) {
 		uint64_t capacity = sz;
 		if (sz == 0) { capacity = minimum_capacity; }
-		sbegin = reinterpret_cast<T*>(operator new(capacity * sizeof(T)));
+		sbegin = allocate(capacity, sz);
 		send = sbegin + capacity;
 		dbegin = dend = sbegin;
 		for (uint64_t k = 0; k < sz; k += 1) {
@@ -64,21 +106,21 @@ public:
         InstanceCounter();
 	}
 
-	vector(const vector<T>& that) {
+	vector(const vector& that) {
         std::cout << "epl::vector copy constructor" << std::endl;
         copy(that);
 
         InstanceCounter();
     }
 
-	template <typename AltType>
-	vector(const vector<AltType>& that) {
+	template <typename AltType, class AltLayout>
+	vector(const vector<AltType, AltLayout>& that) {
 		uint64_t capacity = that.size();
 		if (capacity == 0) { capacity = minimum_capacity; }
-		sbegin = reinterpret_cast<T*>(operator new(capacity * sizeof(T)));
+		sbegin = allocate(capacity, that.size());
 		send = sbegin + capacity;
 		dbegin = dend = sbegin;
-		for (uint64_t k = 0; k < capacity; k += 1) {
+		for (uint64_t k = 0; k < that.size(); k += 1) {
 			new (dend) T(that[k]);
 			++dend;
 		}
@@ -97,7 +139,7 @@ public:
         vector(il.begin(), il.end()) {
 	}
 
-	vector(vector<T>&& that) {
+	vector(vector&& that) {
         move(std::move(that)); 
 
         InstanceCounter();
@@ -105,7 +147,7 @@ public:
 	
     ~vector(void) { destroy(); }
 
-    vector<T>& operator=(const vector<T>& that) {
+    vector& operator=(const vector& that) {
 		if (this != &that) {
 			destroy();
 			copy(that);
@@ -113,7 +155,7 @@ public:
         return *this;
 	}
 
-	vector<T>& operator=(vector<T>&& that) {
+	vector& operator=(vector&& that) {
 		destroy();
 		move(std::move(that));
 		return *this;
@@ -121,6 +163,10 @@ public:
 
 	uint64_t size(void) const { return dend - dbegin; }
 
+	/* the elements, unchecked (with aligned_layout, aligned) */
+	T* data(void) { return dbegin; }
+	const T* data(void) const { return dbegin; }
+
 	T& operator[](uint64_t k) {
 		T* p = dbegin + k;
 		if (p >= dend) { throw std::out_of_range("subscript out of range"); }
@@ -154,12 +200,14 @@ public:
 	}
 
 	void push_front(const T& that) {
+		if (anchored) { shift_in_front(T(that)); return; }
 		ensure_front_capacity(1);
 		--dbegin;
 		new (dbegin) T(that);
 	}
 
 	void push_front(T&& that) {
+		if (anchored) { shift_in_front(T(std::move(that))); return; }
 		ensure_front_capacity(1);
 		--dbegin;
 		new (dbegin) T(std::move(that));
@@ -167,6 +215,7 @@ public:
 
 	template <typename... Args>
 	void emplace_front(Args... args) {
+		if (anchored) { shift_in_front(T(args...)); return; }
 		ensure_front_capacity(1);
 		--dbegin;
 		new (dbegin) T(args...);
@@ -180,6 +229,12 @@ public:
 
 	void pop_front(void) {
 		if (dbegin == dend) { throw std::out_of_range("pop back from empty Vector"); }
+		if (anchored) {
+			for (T* p = dbegin; p + 1 != dend; ++p) { *p = std::move(p[1]); }
+			--dend;
+			dend->~T();
+			return;
+		}
 		dbegin->~T();
 		++dbegin;
 	}
@@ -206,7 +261,7 @@ public:
 
   class iterator;
 	class const_iterator : public std::iterator<std::random_access_iterator_tag, T> {
-		const vector<T>* parent;
+		const vector* parent;
 		uint64_t index;
 		const T* ptr;
 
@@ -266,11 +321,11 @@ public:
 			return ! (*this == that);
 		}
 
-		friend vector<T>;
-        friend vector<T>::iterator;
+		friend vector;
+        friend typename vector::iterator;
 
 	private:
-		const_iterator(const vector<T>* parent, const T* ptr) {
+		const_iterator(const vector* parent, const T* ptr) {
 			this->parent = parent;
 			this->ptr = ptr;
 			this->index = ptr - parent->dbegin;
@@ -297,8 +352,8 @@ public:
 		Same& operator--(void) { Base::operator--(); return *this; }
 		Same operator--(int) { Same t(*this); operator--(); return t; }
 	private:
-		friend vector<T>;
-		iterator(const vector<T>* parent, const T* ptr) : const_iterator(parent, ptr) { }
+		friend vector;
+		iterator(const vector* parent, const T* ptr) : const_iterator(parent, ptr) { }
 	};
 
 	const_iterator begin(void) const { return const_iterator(this, dbegin); }
@@ -308,17 +363,53 @@ public:
 	iterator end(void) { return iterator(this, dend); }
 
 private:
+	/*
+	 * storage for capacity elements (which the aligned layout rounds up), the
+	 * aligned block remembers where operator new put it just in front of itself.
+	 * Everything after the first used elements is zeroed for trivial T.
+	 */
+	static T* allocate(uint64_t& capacity, uint64_t used) {
+		if (!anchored) { return reinterpret_cast<T*>(operator new(capacity * sizeof(T))); }
+		capacity = (capacity + lanes - 1) / lanes * lanes;
+		char* raw = reinterpret_cast<char*>(operator new(capacity * sizeof(T) + alignment + sizeof(void*)));
+		uintptr_t at = (reinterpret_cast<uintptr_t>(raw) + sizeof(void*) + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1);
+		T* storage = reinterpret_cast<T*>(at);
+		reinterpret_cast<void**>(storage)[-1] = raw;
+		if (std::is_trivial<T>::value && used < capacity) {
+			std::memset(static_cast<void*>(storage + used), 0, (capacity - used) * sizeof(T));
+		}
+		return storage;
+	}
+
+	static void release(T* storage) {
+		if (!anchored) { operator delete(storage); return; }
+		operator delete(reinterpret_cast<void**>(storage)[-1]);
+	}
+
+	/* push_front for the aligned layout, element 0 stays where it is */
+	void shift_in_front(T&& that) {
+		ensure_back_capacity(1);
+		if (dbegin != dend) {
+			new (dend) T(std::move(dend[-1]));
+			for (T* p = dend - 1; p != dbegin; --p) { *p = std::move(p[-1]); }
+			*dbegin = std::move(that);
+		} else {
+			new (dend) T(std::move(that));
+		}
+		++dend;
+	}
+
 	void destroy(void) {
 		if (sbegin != nullptr) {
 			while (dbegin != dend) {
 				dbegin->~T();
 				++dbegin;
 			}
-			operator delete(sbegin);
+			release(sbegin);
 		}
 	}
 
-	void copy(const vector<T>& that) {
+	void copy(const vector& that) {
 		/* there is nothing preventing me from using the "private" parts of that
 		 * as I implement this function (since this and that are the same type)
 		 * However... someday I might want to have a member template where that
@@ -328,7 +419,8 @@ private:
 		 */
 		uint64_t capacity = that.size();
 		if (capacity < minimum_capacity) { capacity = minimum_capacity; }
-		sbegin = reinterpret_cast<T*>(operator new(capacity * sizeof(T)));
+		sbegin = allocate(capacity, that.size());
+		send = sbegin + capacity;
 		dbegin = dend = sbegin;
 		for (uint64_t k = 0; k < that.size(); k += 1) {
 			new (dend) T(that[k]);
@@ -336,7 +428,7 @@ private:
 		}
 	}
 
-	void move(vector<T>&& that) {
+	void move(vector&& that) {
 		sbegin = that.sbegin;
 		send = that.send;
 		dbegin = that.dbegin;
@@ -348,7 +440,8 @@ private:
 	void constructFromIterator(Iterator b, Iterator e, std::random_access_iterator_tag) {
 		uint64_t capacity = (uint64_t) (e - b);
 		if (capacity < minimum_capacity) { capacity = minimum_capacity; }
-		sbegin = reinterpret_cast<T*>(operator new(capacity * sizeof(T)));
+		sbegin = allocate(capacity, (uint64_t) (e - b));
+		send = sbegin + capacity;
 		dbegin = dend = sbegin;
 		while (b != e) {
 			new (dend) T(*b);
@@ -360,7 +453,8 @@ private:
 	template <typename Iterator>
 	void constructFromIterator(Iterator b, Iterator e, std::forward_iterator_tag) {
 		uint64_t capacity = minimum_capacity;
-		sbegin = reinterpret_cast<T*>(operator new(capacity * sizeof(T)));
+		sbegin = allocate(capacity, 0);
+		send = sbegin + capacity;
 		dbegin = dend = sbegin;
 		while (b != e) {
 			push_back(*b);
@@ -386,8 +480,8 @@ private:
 		uint64_t excess_capacity = capacity - size();
 		if (back_capacity < excess_capacity / 2) { back_capacity = excess_capacity / 2; }
 
-		T* new_storage = reinterpret_cast<T*>(operator new(sizeof(T) * capacity));
-		T* new_data = new_storage + capacity - back_capacity - size();
+		T* new_storage = allocate(capacity, size());
+		T* new_data = anchored ? new_storage : new_storage + capacity - back_capacity - size();
 		T* new_data_end = new_data;
 
 		/* move the elements (and deconstruct the originals) */
@@ -397,7 +491,7 @@ private:
 			++dbegin;
 			++new_data_end;
 		}
-		operator delete(sbegin);
+		release(sbegin);
 
 		sbegin = new_storage;
 		send = sbegin + capacity;
@@ -423,7 +517,7 @@ private:
 		uint64_t excess_capacity = capacity - size();
 		if (front_capacity < excess_capacity / 2) { front_capacity = excess_capacity / 2; }
 
-		T* new_storage = reinterpret_cast<T*>(operator new(sizeof(T) * capacity));
+		T* new_storage = allocate(capacity, size());
 		T* new_data = new_storage + front_capacity;
 		T* new_data_end = new_data;
 
@@ -434,7 +528,7 @@ private:
 			++dbegin;
 			++new_data_end;
 		}
-		operator delete(sbegin);
+		release(sbegin);
 
 		sbegin = new_storage;
 		send = sbegin + capacity;
@@ -444,6 +538,13 @@ private:
 
 };
 
+template <typename T, class Layout>
+const size_t vector<T, Layout>::alignment;
+template <typename T, class Layout>
+const bool vector<T, Layout>::anchored;
+template <typename T, class Layout>
+const uint64_t vector<T, Layout>::lanes;
+
 } //epl namespace
 
 #endif /* VECTOR_HPP_ */
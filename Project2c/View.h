@@ -0,0 +1,144 @@
+// View.h
+
+/*
+ * valarrays over memory somebody else owns
+ *
+ *     std::vector<double> frame = ...;
+ *     valarray_view<double> v(frame.data(), frame.size());
+ *     v = v * gain + offset;                              // in place, no copy
+ *     valarray<double> y = exp(view(frame) - 1.0);        // a leaf like any valarray
+ *     valarray_view<const float> in(mapped, n);           // read only
+ *
+ * A view is a pointer and a length, nothing else. It is copied into the
+ * expressions that use it (like any other node, unlike a valarray which is
+ * held by reference), reads are unchecked plain loads and kernels that walk
+ * a whole range (reduce, scans, sorts of expressions) get the raw pointer.
+ * The memory has to outlive the view and every expression holding it.
+ *
+ * valarray_view<T> is also an assignment target: assigning an expression
+ * writes the first len() elements of the view (a view never grows, a longer
+ * expression is a std::length_error, a shorter one leaves the rest alone)
+ * and goes through a temporary only when the expression reads the same
+ * memory out of step, exactly like valarray. valarray_view<const T> can only
+ * be read. Assigning one view to another copies the elements, use the
+ * constructor to point a view somewhere else.
+ */
+
+#ifndef _View_h
+#define _View_h
+
+#include <cstddef>
+#include <functional>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "Parallel.h"
+#include "Valarray.h"
+
+namespace epl {
+
+template <typename T>
+struct valarray_view {
+	using value_type = typename std::remove_const<T>::type;
+	T* p;
+	size_t n;
+
+	valarray_view(T* p, size_t n) : p(p), n(n) {}
+
+	T& operator[](size_t k) const { return p[k]; }
+	size_t len() const { return n; }
+	size_t size() const { return n; }
+	T* data() const { return p; }
+	T* begin() const { return p; }
+	T* end() const { return p + n; }
+
+	/* the same test as valarray: same memory read at the same index is fine */
+	bool hazard(const void* lo, const void* hi, bool elementwise) const {
+		if (n == 0) {
+			return false;
+		}
+		std::less<const void*> before;
+		bool overlap = before(p, hi) && before(lo, p + n);
+		return overlap && !(elementwise && p == lo);
+	}
+	bool same(const valarray_view& that) const { return p == that.p && n == that.n; }
+
+	valarray_view& operator=(const valarray_view& that) { return this->operator=<valarray_view>(that); }
+
+	valarray_view& operator=(const value_type& x) {
+		for (size_t k = 0; k < n; k++) {
+			p[k] = x;
+		}
+		return *this;
+	}
+
+	template <typename U, typename = is_easy_vexpr<U>>
+	valarray_view& operator=(const U& v) {
+		static_assert(!std::is_const<T>::value, "a valarray_view of const elements cannot be assigned to");
+		size_t m = (v.len() == SIZE_MAX) ? n : v.len();
+		if (m > n) { throw std::length_error("expression longer than the view assigned to"); }
+		evaluation scope(v);
+		bool hazard = m != 0 && v.hazard(p, p + n, true);
+		return this->assign(v, m, hazard, is_bulk<U>());
+	}
+
+private:
+	template <typename U>
+	valarray_view& assign(const U& v, size_t m, bool hazard, std::false_type) {
+		if (hazard) {
+			buffer<value_type> tmp(m);
+			for (size_t k = 0; k < m; k++) {
+				tmp.push_back(v[k]);
+			}
+			return this->fill(tmp, m);
+		}
+		return this->fill(v, m);
+	}
+
+	template <typename U>
+	valarray_view& assign(const U& v, size_t m, bool hazard, std::true_type) {
+		if (hazard) {
+			valarray<value_type> tmp(m);
+			v.v.materialize(tmp.data());
+			return this->fill(tmp, m);
+		}
+		if (m != 0) { v.v.materialize(p); }
+		return *this;
+	}
+
+	template <typename U>
+	valarray_view& fill(const U& v, size_t m) {
+		for (size_t k = 0; k < m; k++) {
+			p[k] = v[k];
+		}
+		return *this;
+	}
+};
+
+template <typename T>
+struct is_vexpr<valarray_view<T>> : std::true_type {};
+
+/* kernels over the whole range read the pointer */
+template <typename T>
+T* source(const valarray_view<T>& e) { return e.data(); }
+
+/* what can be read in place, kernels that read every element several times evaluate anything else once first */
+template <class E>
+struct direct : std::false_type {};
+template <typename T>
+struct direct<valarray<T>> : std::true_type {};
+template <typename T>
+struct direct<valarray_view<T>> : std::true_type {};
+
+/* views of a std::vector (or anything else with data() and size()) */
+template <class C>
+auto view(C& c) -> valarray_view<typename std::remove_pointer<decltype(c.data())>::type> {
+	return valarray_view<typename std::remove_pointer<decltype(c.data())>::type>(c.data(), c.size());
+}
+template <typename T>
+valarray_view<T> view(T* p, size_t n) { return valarray_view<T>(p, n); }
+
+}
+
+#endif /* _View_h */
@@ -0,0 +1,53 @@
+/*
+ * aligned_bench.cpp
+ * d = a * b + c on lengths that are not a multiple of the vector width:
+ * a hand written loop over std::vector against epl::valarray, whose storage
+ * is cache line aligned and padded so its loop has no remainder, build with make bench
+ */
+
+#include <chrono>
+#include <complex>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "../Valarray.h"
+
+int InstanceCounter::counter = 0;
+
+/* best of a few runs, in nanoseconds per element */
+template <class F>
+double time_per_element(size_t n, size_t reps, F f) {
+    double best = 1e30;
+    for (int rep = 0; rep < 5; ++rep) {
+        auto t0 = std::chrono::steady_clock::now();
+        for (size_t r = 0; r < reps; ++r) { f(); }
+        auto t1 = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / (n * reps);
+        if (ns < best) { best = ns; }
+    }
+    return best;
+}
+
+int main() {
+    std::cout << "n\tstd::vector loop\tepl::valarray\t(ns/element, double)\n";
+    for (size_t n : {13, 61, 250, 1021, 4093, 65531, 1048573}) {
+        size_t reps = (1 << 24) / n;
+        epl::valarray<double> a(n), b(n), c(n), d(n);
+        std::vector<double> va(n), vb(n), vc(n), vd(n);
+        for (size_t k = 0; k < n; ++k) {
+            a[k] = va[k] = static_cast<double>(k % 13);
+            b[k] = vb[k] = static_cast<double>(k % 5) - 2.0;
+            c[k] = vc[k] = 0.5;
+        }
+        double loop = time_per_element(n, reps, [&]() {
+            for (size_t k = 0; k < n; ++k) { vd[k] = va[k] * vb[k] + vc[k]; }
+        });
+        double epl = time_per_element(n, reps, [&]() { d = a * b + c; });
+        for (size_t k = 0; k < n; ++k) {
+            if (d[k] != vd[k]) { std::cout << "mismatch at n = " << n << "\n"; return 1; }
+        }
+        std::cout << n << "\t" << loop << "\t" << epl << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,58 @@
+/*
+ * blas_bench.cpp
+ * the solver kernels: (x * y).sum() against dot, sqrt of the sum of squares
+ * against nrm2, and assignments against axpy and scal, build with make bench
+ */
+
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <iostream>
+
+#include "../Blas.h"
+
+int InstanceCounter::counter = 0;
+
+/* best of a few runs, in nanoseconds per element */
+template <class F>
+double per_element(size_t n, F f) {
+    double best = 1e30;
+    for (int rep = 0; rep < 7; ++rep) {
+        auto t0 = std::chrono::steady_clock::now();
+        f();
+        auto t1 = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / n;
+        if (ns < best) { best = ns; }
+    }
+    return best;
+}
+
+int main() {
+    std::cout << "threads " << epl::hardware_threads() << "\n";
+    std::cout << "n\tsum()\tdot\tsqrt(sum)\tnrm2\ty = y + a x\taxpy\ty = a y\tscal\t(ns/element)\n";
+    for (size_t n : {size_t(4096), size_t(131072), size_t(4194304)}) {
+        epl::valarray<double> x(n), y(n), y2(n);
+        for (size_t k = 0; k < n; ++k) {
+            x[k] = 1.0 + k % 5;
+            y[k] = 2.0 - k % 3;
+            y2[k] = y[k];
+        }
+        double d0 = 0, d1 = 0, r0 = 0, r1 = 0;
+        double sum = per_element(n, [&]() { d0 = (x * y).sum(); });
+        double dot = per_element(n, [&]() { d1 = epl::dot(x, y); });
+        double naive_norm = per_element(n, [&]() { r0 = std::sqrt((x * x).sum()); });
+        double norm = per_element(n, [&]() { r1 = epl::nrm2(x); });
+        double assign = per_element(n, [&]() { y = y + 0.5 * x; });
+        double axpy = per_element(n, [&]() { epl::axpy(0.5, x, y2); });
+        double scale = per_element(n, [&]() { y = 0.999 * y; });
+        double scal = per_element(n, [&]() { epl::scal(0.999, y2); });
+        for (size_t k = 0; k < n; ++k) {
+            if (y[k] != y2[k]) { std::cout << "mismatch at " << k << "\n"; return 1; }
+        }
+        if (d0 != d1 || std::fabs(r0 - r1) > 1e-12 * r0) { std::cout << "dot or nrm2 mismatch\n"; return 1; }
+        std::cout << n << "\t" << sum << "\t" << dot << "\t" << naive_norm << "\t" << norm << "\t"
+            << assign << "\t" << axpy << "\t" << scale << "\t" << scal << "\n";
+    }
+    return 0;
+}
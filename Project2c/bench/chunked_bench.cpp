@@ -0,0 +1,53 @@
+/*
+ * chunked_bench.cpp
+ * b = a * 2.0 + 1.0 and a sum over a file backed chunked_valarray, against
+ * the same on an in-memory valarray, in MB/s of data read, build with make bench
+ */
+
+#include <chrono>
+#include <complex>
+#include <cstdio>
+#include <iostream>
+
+#include "../Chunked.h"
+
+int InstanceCounter::counter = 0;
+
+/* best of a few runs, in seconds */
+template <class F>
+double seconds(F f) {
+    double best = 1e30;
+    for (int rep = 0; rep < 3; ++rep) {
+        auto t0 = std::chrono::steady_clock::now();
+        f();
+        auto t1 = std::chrono::steady_clock::now();
+        double s = std::chrono::duration<double>(t1 - t0).count();
+        if (s < best) { best = s; }
+    }
+    return best;
+}
+
+int main() {
+    const size_t n = 1 << 23;
+    const double mb = n * sizeof(double) / 1e6;
+    epl::valarray<double> a(n), b(n);
+    for (size_t k = 0; k < n; ++k) { a[k] = static_cast<double>(k % 1000); }
+    epl::chunked_valarray<double> ca("bench_a.bin", n), cb("bench_b.bin", n);
+    ca = a;
+    ca.flush();
+
+    double h0 = 0, h1 = 0;
+    double mem_assign = seconds([&]() { b = a * 2.0 + 1.0; });
+    double mem_sum = seconds([&]() { h0 = b.accumulate(std::plus<double>()); });
+    double file_assign = seconds([&]() { cb = ca * 2.0 + 1.0; cb.flush(); });
+    double file_sum = seconds([&]() { h1 = cb.accumulate(std::plus<double>()); });
+    if (h0 != h1) { std::cout << "mismatch\n"; return 1; }
+
+    std::cout << "n = " << n << " doubles, chunks of " << ca.chunk_size() << "\n";
+    std::cout << "\tvalarray\tchunked_valarray\t(MB/s)\n";
+    std::cout << "assign\t" << mb / mem_assign << "\t" << mb / file_assign << "\n";
+    std::cout << "sum\t" << mb / mem_sum << "\t" << mb / file_sum << "\n";
+    std::remove("bench_a.bin");
+    std::remove("bench_b.bin");
+    return 0;
+}
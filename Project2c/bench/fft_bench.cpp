@@ -0,0 +1,72 @@
+/*
+ * fft_bench.cpp
+ * epl::fft against a textbook iterative radix 2 fft on std::complex, for
+ * n = 2^8 .. 2^24, build with make bench
+ */
+
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "../FFT.h"
+
+int InstanceCounter::counter = 0;
+
+/* best of a few runs, in nanoseconds per call */
+template <class F>
+double best_time(F f) {
+    double best = 1e30;
+    for (int rep = 0; rep < 5; ++rep) {
+        auto t0 = std::chrono::steady_clock::now();
+        f();
+        auto t1 = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+        if (ns < best) { best = ns; }
+    }
+    return best;
+}
+
+/* bit reversal, then log2 n passes of radix 2 butterflies */
+void textbook_fft(std::vector<std::complex<double>>& a) {
+    const double pi = 3.14159265358979323846;
+    size_t n = a.size();
+    for (size_t i = 1, j = 0; i < n; ++i) {
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1) { j ^= bit; }
+        j ^= bit;
+        if (i < j) { std::swap(a[i], a[j]); }
+    }
+    for (size_t len = 2; len <= n; len <<= 1) {
+        std::complex<double> wl = std::polar(1.0, -2 * pi / len);
+        for (size_t i = 0; i < n; i += len) {
+            std::complex<double> w = 1;
+            for (size_t k = 0; k < len / 2; ++k) {
+                std::complex<double> u = a[i + k], v = a[i + k + len / 2] * w;
+                a[i + k] = u + v;
+                a[i + k + len / 2] = u - v;
+                w *= wl;
+            }
+        }
+    }
+}
+
+int main() {
+    std::cout << "threads " << epl::hardware_threads() << "\n";
+    std::cout << "n\ttextbook\tepl::fft\t(GFlop/s as 5 n log2 n, complex<double>)\n";
+    for (int lg = 8; lg <= 24; lg += 2) {
+        size_t n = size_t(1) << lg;
+        std::vector<std::complex<double>> a(n);
+        epl::valarray<std::complex<double>> x(n);
+        for (size_t k = 0; k < n; ++k) { a[k] = x[k] = std::complex<double>(std::sin(0.1 * k), 0.5); }
+        epl::fft(x);    /* the plan is cached after the first call */
+        for (size_t k = 0; k < n; ++k) { x[k] = a[k]; }
+        double t = best_time([&]() { textbook_fft(a); });
+        double e = best_time([&]() { epl::fft(x); });
+        double flops = 5.0 * n * lg;
+        std::cout << n << "\t" << flops / t << "\t" << flops / e << "\n";
+    }
+    return 0;
+}
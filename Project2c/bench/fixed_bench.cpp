@@ -0,0 +1,85 @@
+/*
+ * fixed_bench.cpp
+ * many small 3-d updates p = p + dt * v and distances |p - q|^2: heap
+ * allocated valarray<double> against valarray<double, 3> and a plain
+ * struct, build with make bench
+ */
+
+#include <chrono>
+#include <complex>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "../Valarray.h"
+
+int InstanceCounter::counter = 0;
+
+struct plain3 { double x, y, z; };
+
+/* best of a few runs, in nanoseconds per particle */
+template <class F>
+double per_particle(size_t n, F f) {
+    double best = 1e30;
+    for (int rep = 0; rep < 5; ++rep) {
+        auto t0 = std::chrono::steady_clock::now();
+        f();
+        auto t1 = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / n;
+        if (ns < best) { best = ns; }
+    }
+    return best;
+}
+
+int main() {
+    const size_t n = 100000;
+    const double dt = 0.01;
+    std::vector<epl::valarray<double>> dp, dv;
+    std::vector<epl::valarray<double, 3>> fp, fv;
+    std::vector<plain3> sp, sv;
+    for (size_t k = 0; k < n; ++k) {
+        double a = double(k % 13), b = double(k % 7), c = double(k % 5);
+        dp.push_back(epl::valarray<double>{a, b, c});
+        dv.push_back(epl::valarray<double>{c, a, b});
+        fp.push_back(epl::valarray<double, 3>{a, b, c});
+        fv.push_back(epl::valarray<double, 3>{c, a, b});
+        sp.push_back(plain3{a, b, c});
+        sv.push_back(plain3{c, a, b});
+    }
+    double s0 = 0, s1 = 0, s2 = 0;
+    double dynamic = per_particle(n, [&]() {
+        s0 = 0;
+        for (size_t k = 0; k < n; ++k) {
+            dp[k] = dp[k] + dt * dv[k];
+            epl::valarray<double> d = dp[k] - dp[(k + 1) % n];
+            s0 += (d * d).sum();
+        }
+    });
+    double fixed = per_particle(n, [&]() {
+        s1 = 0;
+        for (size_t k = 0; k < n; ++k) {
+            fp[k] = fp[k] + dt * fv[k];
+            epl::valarray<double, 3> d = fp[k] - fp[(k + 1) % n];
+            s1 += (d * d).sum();
+        }
+    });
+    double plain = per_particle(n, [&]() {
+        s2 = 0;
+        for (size_t k = 0; k < n; ++k) {
+            plain3& p = sp[k];
+            const plain3& q = sp[(k + 1) % n];
+            p.x += dt * sv[k].x;
+            p.y += dt * sv[k].y;
+            p.z += dt * sv[k].z;
+            double dx = p.x - q.x, dy = p.y - q.y, dz = p.z - q.z;
+            s2 += dx * dx + dy * dy + dz * dz;
+        }
+    });
+    for (size_t k = 0; k < n; ++k) {
+        if (dp[k][2] != fp[k][2] || fp[k][2] != sp[k].z) { std::cout << "mismatch at " << k << "\n"; return 1; }
+    }
+    std::cout << "n = " << n << " (sums " << s0 << " " << s1 << " " << s2 << ")\n";
+    std::cout << "valarray<double>\tvalarray<double, 3>\tstruct\t(ns/particle)\n";
+    std::cout << dynamic << "\t" << fixed << "\t" << plain << "\n";
+    return 0;
+}
@@ -0,0 +1,67 @@
+/*
+ * histogram_bench.cpp
+ * epl::histogram against the plain loop (one array of counts), 256 bins,
+ * input throughput in GB/s, build with make bench
+ */
+
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "../Histogram.h"
+
+int InstanceCounter::counter = 0;
+
+/* best of a few runs, in seconds */
+template <class F>
+double best_time(F f) {
+    double best = 1e30;
+    for (int rep = 0; rep < 5; ++rep) {
+        auto t0 = std::chrono::steady_clock::now();
+        f();
+        auto t1 = std::chrono::steady_clock::now();
+        double s = std::chrono::duration<double>(t1 - t0).count();
+        if (s < best) { best = s; }
+    }
+    return best;
+}
+
+int main() {
+    const size_t bins = 256;
+    std::cout << "threads " << epl::hardware_threads() << "\n";
+    std::cout << "n\tinput\tloop\tepl::histogram\t(GB/s of doubles in)\n";
+    for (size_t n = 1 << 12; n <= (1 << 24); n <<= 4) {
+        epl::valarray<double> x(n);
+        std::vector<double> v(n);
+        uint64_t s = 88172645463325252ull;
+        for (int kind = 0; kind < 2; ++kind) {
+            /* uniform over the bins, then runs of equal values (the worst case for one array) */
+            for (size_t k = 0; k < n; ++k) {
+                s ^= s << 13; s ^= s >> 7; s ^= s << 17;
+                x[k] = v[k] = (kind == 0) ? static_cast<double>(s % 1000000) / 1000000.0 : static_cast<double>((k / 64) % 7) / 7.0;
+            }
+            std::vector<size_t> h(bins);
+            double loop = best_time([&]() {
+                for (size_t b = 0; b < bins; ++b) { h[b] = 0; }
+                for (size_t k = 0; k < n; ++k) {
+                    double t = v[k];
+                    if (t >= 0.0 && t <= 1.0) {
+                        size_t b = static_cast<size_t>(std::floor(t * bins));
+                        h[(b == bins) ? bins - 1 : b] += 1;
+                    }
+                }
+            });
+            epl::valarray<size_t> g;
+            double e = best_time([&]() { g = epl::histogram(x, bins, 0.0, 1.0); });
+            for (size_t b = 0; b < bins; ++b) {
+                if (g[b] != h[b]) { std::cout << "mismatch at n = " << n << "\n"; return 1; }
+            }
+            double gb = 8.0 * n / 1e9;
+            std::cout << n << "\t" << ((kind == 0) ? "uniform" : "runs") << "\t" << gb / loop << "\t" << gb / e << "\n";
+        }
+    }
+    return 0;
+}
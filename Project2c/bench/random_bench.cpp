@@ -0,0 +1,57 @@
+/*
+ * random_bench.cpp
+ * filling a valarray with uniform and normal doubles: std::mt19937_64 with
+ * the std distributions in a scalar loop against epl::uniform / epl::normal,
+ * build with make bench
+ */
+
+#include <chrono>
+#include <complex>
+#include <cstdint>
+#include <iostream>
+#include <random>
+
+#include "../Random.h"
+
+int InstanceCounter::counter = 0;
+
+/* best of a few runs, in nanoseconds per element */
+template <class F>
+double time_per_element(size_t n, F f) {
+    double best = 1e30;
+    for (int rep = 0; rep < 5; ++rep) {
+        auto t0 = std::chrono::steady_clock::now();
+        f();
+        auto t1 = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / n;
+        if (ns < best) { best = ns; }
+    }
+    return best;
+}
+
+int main() {
+    std::cout << "threads " << epl::hardware_threads() << "\n";
+    std::cout << "n\tstd uniform\tepl::uniform\tstd normal\tepl::normal\t(ns/element)\n";
+    for (size_t n = 1 << 12; n <= (1 << 22); n <<= 5) {
+        epl::valarray<double> a(n), b(n), c(n), d(n);
+        double* pa = a.data();
+        double* pc = c.data();
+        double std_uniform = time_per_element(n, [&]() {
+            std::mt19937_64 g(42);
+            std::uniform_real_distribution<double> dist;
+            for (size_t k = 0; k < n; ++k) { pa[k] = dist(g); }
+        });
+        double epl_uniform = time_per_element(n, [&]() { b = epl::uniform(n, 42); });
+        double std_normal = time_per_element(n, [&]() {
+            std::mt19937_64 g(42);
+            std::normal_distribution<double> dist;
+            for (size_t k = 0; k < n; ++k) { pc[k] = dist(g); }
+        });
+        double epl_normal = time_per_element(n, [&]() { d = epl::normal(n, 42); });
+        double s0 = 0, s1 = 0;
+        for (size_t k = 0; k < n; ++k) { s0 += a[k] - b[k]; s1 += c[k] - d[k]; }
+        if (!(s0 * s0 < 1e-2 * n * n && s1 * s1 < 1e-2 * n * n)) { std::cout << "suspicious sums at n = " << n << "\n"; return 1; }
+        std::cout << n << "\t" << std_uniform << "\t" << epl_uniform << "\t" << std_normal << "\t" << epl_normal << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,82 @@
+/*
+ * reduce_bench.cpp
+ * sum, min, max and sum of squares of a * b + c: one epl::reduce against
+ * four accumulate() calls and against one hand written loop, build with make bench
+ */
+
+#include <chrono>
+#include <complex>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "../Reduce.h"
+
+int InstanceCounter::counter = 0;
+
+/* best of a few runs, in nanoseconds per element */
+template <class F>
+double time_per_element(size_t n, F f) {
+    double best = 1e30;
+    for (int rep = 0; rep < 5; ++rep) {
+        auto t0 = std::chrono::steady_clock::now();
+        f();
+        auto t1 = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / n;
+        if (ns < best) { best = ns; }
+    }
+    return best;
+}
+
+template <class T>
+struct lesser {
+    using result_type = T;
+    T operator()(const T& x, const T& y) const { return (y < x) ? y : x; }
+};
+template <class T>
+struct greater {
+    using result_type = T;
+    T operator()(const T& x, const T& y) const { return (x < y) ? y : x; }
+};
+
+int main() {
+    std::cout << "threads " << epl::hardware_threads() << "\n";
+    std::cout << "n\tloop\taccumulate x4\tepl::reduce\t(ns/element, double)\n";
+    for (size_t n = 1 << 10; n <= (1 << 24); n <<= 2) {
+        epl::valarray<double> a(n), b(n), c(n);
+        std::vector<double> va(n), vb(n), vc(n);
+        for (size_t k = 0; k < n; ++k) {
+            a[k] = va[k] = static_cast<double>(k % 13);
+            b[k] = vb[k] = static_cast<double>(k % 5) - 2.0;
+            c[k] = vc[k] = 0.5;
+        }
+        double h0 = 0, h1 = 0, h2 = 0, h3 = 0;
+        double loop = time_per_element(n, [&]() {
+            double s = 0, lo = 1e300, hi = -1e300, ss = 0;
+            for (size_t k = 0; k < n; ++k) {
+                double x = va[k] * vb[k] + vc[k];
+                s += x;
+                lo = (x < lo) ? x : lo;
+                hi = (hi < x) ? x : hi;
+                ss += x * x;
+            }
+            h0 = s; h1 = lo; h2 = hi; h3 = ss;
+        });
+        double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+        double four = time_per_element(n, [&]() {
+            auto e = a * b + c;
+            s0 = e.accumulate(std::plus<double>());
+            s1 = e.accumulate(lesser<double>());
+            s2 = e.accumulate(greater<double>());
+            s3 = (e * e).accumulate(std::plus<double>());
+        });
+        double r0 = 0, r1 = 0, r2 = 0, r3 = 0;
+        double one = time_per_element(n, [&]() {
+            using namespace epl::reducers;
+            std::tie(r0, r1, r2, r3) = epl::reduce(a * b + c, sum, min, max, sum_sq);
+        });
+        if (r1 != s1 || r2 != s2 || r1 != h1 || r2 != h2 || r0 != s0 || r0 != h0 || r3 != s3 || r3 != h3) { std::cout << "mismatch at n = " << n << "\n"; return 1; }
+        std::cout << n << "\t" << loop << "\t" << four << "\t" << one << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * rolling_bench.cpp
+ * moving mean and moving maximum: the O(n w) loops against rolling_mean and
+ * rolling_max, build with make bench
+ */
+
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <iostream>
+
+#include "../Rolling.h"
+
+int InstanceCounter::counter = 0;
+
+/* best of a few runs, in milliseconds */
+template <class F>
+double milliseconds(F f) {
+    double best = 1e30;
+    for (int rep = 0; rep < 3; ++rep) {
+        auto t0 = std::chrono::steady_clock::now();
+        f();
+        auto t1 = std::chrono::steady_clock::now();
+        double ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+        if (ms < best) { best = ms; }
+    }
+    return best;
+}
+
+int main() {
+    const size_t n = 1 << 20;
+    epl::valarray<double> x(n);
+    for (size_t k = 0; k < n; ++k) { x[k] = std::sin(0.001 * k) + 0.01 * double(k % 37); }
+    const double* px = x.data();
+    std::cout << "n = " << n << ", threads " << epl::hardware_threads() << "\n";
+    std::cout << "w\tloop mean\trolling_mean\tloop max\trolling_max\t(ms)\n";
+    for (size_t w : {size_t(8), size_t(64), size_t(512)}) {
+        size_t m = n - w + 1;
+        epl::valarray<double> a(m), b(m), c(m), d(m);
+        double* pa = a.data();
+        double* pc = c.data();
+        double loop_mean = milliseconds([&]() {
+            for (size_t i = 0; i < m; ++i) {
+                double s = 0;
+                for (size_t j = i; j < i + w; ++j) { s += px[j]; }
+                pa[i] = s / w;
+            }
+        });
+        double mean = milliseconds([&]() { b = epl::rolling_mean(x, w); });
+        double loop_max = milliseconds([&]() {
+            for (size_t i = 0; i < m; ++i) {
+                double s = px[i];
+                for (size_t j = i; j < i + w; ++j) { s = (s < px[j]) ? px[j] : s; }
+                pc[i] = s;
+            }
+        });
+        double max = milliseconds([&]() { d = epl::rolling_max(x, w); });
+        for (size_t k = 0; k < m; ++k) {
+            if (std::fabs(a[k] - b[k]) > 1e-12 || c[k] != d[k]) { std::cout << "mismatch at " << k << "\n"; return 1; }
+        }
+        std::cout << w << "\t" << loop_mean << "\t" << mean << "\t" << loop_max << "\t" << max << "\n";
+    }
+    return 0;
+}
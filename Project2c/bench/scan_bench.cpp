@@ -0,0 +1,44 @@
+/*
+ * scan_bench.cpp
+ * epl::inclusive_scan against std::partial_sum, build with make bench
+ */
+
+#include <chrono>
+#include <complex>
+#include <cstdint>
+#include <iostream>
+#include <numeric>
+#include <vector>
+
+#include "../Scan.h"
+
+int InstanceCounter::counter = 0;
+
+/* best of a few runs, in nanoseconds per element */
+template <class F>
+double time_per_element(size_t n, F f) {
+    double best = 1e30;
+    for (int rep = 0; rep < 5; ++rep) {
+        auto t0 = std::chrono::steady_clock::now();
+        f();
+        auto t1 = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / n;
+        if (ns < best) { best = ns; }
+    }
+    return best;
+}
+
+int main() {
+    std::cout << "threads " << epl::hardware_threads() << "\n";
+    std::cout << "n\tstd::partial_sum\tepl::inclusive_scan\t(ns/element, double)\n";
+    for (size_t n = 1 << 10; n <= (1 << 24); n <<= 2) {
+        epl::valarray<double> x(n), y(n);
+        std::vector<double> a(n), b(n);
+        for (size_t k = 0; k < n; ++k) { x[k] = a[k] = static_cast<double>(k % 13); }
+        double s = time_per_element(n, [&]() { std::partial_sum(a.begin(), a.end(), b.begin()); });
+        double e = time_per_element(n, [&]() { y = epl::inclusive_scan(x); });
+        if (b[n - 1] != y[n - 1]) { std::cout << "mismatch at n = " << n << "\n"; return 1; }
+        std::cout << n << "\t" << s << "\t" << e << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,53 @@
+/*
+ * sort_bench.cpp
+ * epl::sort (radix) against std::sort over a std::vector (the epl iterators
+ * are not usable with std::sort at all), build with make bench
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <complex>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "../Sort.h"
+
+int InstanceCounter::counter = 0;
+
+/* best of a few runs on fresh copies of the input, in nanoseconds per element */
+template <class F, class R>
+double time_per_element(size_t n, R reset, F f) {
+    double best = 1e30;
+    for (int rep = 0; rep < 3; ++rep) {
+        reset();
+        auto t0 = std::chrono::steady_clock::now();
+        f();
+        auto t1 = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / n;
+        if (ns < best) { best = ns; }
+    }
+    return best;
+}
+
+int main() {
+    std::cout << "threads " << epl::hardware_threads() << "\n";
+    std::cout << "n\tstd::sort\tepl::sort\t(ns/element, double)\n";
+    for (size_t n = 1 << 10; n <= (1 << 24); n <<= 2) {
+        std::vector<double> src(n), v(n);
+        uint64_t s = 88172645463325252ull;
+        for (size_t k = 0; k < n; ++k) {
+            s ^= s << 13; s ^= s >> 7; s ^= s << 17;
+            src[k] = static_cast<double>(s % 1000000007) - 5.0e8;
+        }
+        epl::valarray<double> x(n);
+        auto fill = [&]() { for (size_t k = 0; k < n; ++k) { x[k] = src[k]; } };
+        double sv = time_per_element(n, [&]() { v = src; }, [&]() { std::sort(v.begin(), v.end()); });
+        double ep = time_per_element(n, fill, [&]() { epl::sort(x); });
+        for (size_t k = 0; k < n; ++k) {
+            if (x[k] != v[k]) { std::cout << "mismatch at n = " << n << "\n"; return 1; }
+        }
+        std::cout << n << "\t" << sv << "\t" << ep << "\n";
+    }
+    return 0;
+}
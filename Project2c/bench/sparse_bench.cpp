@@ -0,0 +1,59 @@
+/*
+ * sparse_bench.cpp
+ * z = 2 x + y and dot(x, y) on vectors with few nonzeros: dense valarrays
+ * against sparse_valarray, build with make bench
+ */
+
+#include <chrono>
+#include <complex>
+#include <cstdint>
+#include <iostream>
+
+#include "../Sparse.h"
+
+int InstanceCounter::counter = 0;
+
+/* best of a few runs, in milliseconds */
+template <class F>
+double milliseconds(F f) {
+    double best = 1e30;
+    for (int rep = 0; rep < 5; ++rep) {
+        auto t0 = std::chrono::steady_clock::now();
+        f();
+        auto t1 = std::chrono::steady_clock::now();
+        double ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+        if (ms < best) { best = ms; }
+    }
+    return best;
+}
+
+int main() {
+    const size_t n = 1 << 23;
+    std::cout << "n = " << n << "\n";
+    std::cout << "density\tdense z\tsparse z\tdense dot\tsparse dot\t(ms)\n";
+    for (size_t every : {10, 100, 1000}) {
+        epl::valarray<double> dx(n), dy(n), dz(n);
+        epl::sparse_valarray<double> x(n), y(n);
+        for (size_t k = 0; k < n; k += every) {
+            dx[k] = 1.0 + k % 7;
+            x.set(k, 1.0 + k % 7);
+        }
+        for (size_t k = every / 2; k < n; k += every) {
+            dy[k] = 2.0;
+            y.set(k, 2.0);
+        }
+        epl::sparse_valarray<double> z(n);
+        double d0 = 0, d1 = 0;
+        double dense_z = milliseconds([&]() { dz = 2.0 * dx + dy; });
+        double sparse_z = milliseconds([&]() { z = 2.0 * x + y; });
+        double dense_dot = milliseconds([&]() { d0 = (dx * dy).accumulate(std::plus<double>()); });
+        double sparse_dot = milliseconds([&]() { d1 = epl::dot(x, y); });
+        epl::valarray<double> back = z.dense();
+        for (size_t k = 0; k < n; ++k) {
+            if (back[k] != dz[k]) { std::cout << "mismatch at " << k << "\n"; return 1; }
+        }
+        if (d0 != d1) { std::cout << "dot mismatch\n"; return 1; }
+        std::cout << "1/" << every << "\t" << dense_z << "\t" << sparse_z << "\t" << dense_dot << "\t" << sparse_dot << "\n";
+    }
+    return 0;
+}
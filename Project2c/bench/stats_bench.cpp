@@ -0,0 +1,55 @@
+/*
+ * stats_bench.cpp
+ * mean and variance of exp(x) * y: one pass reduce(e, mean, variance)
+ * against the two pass formula, build with make bench
+ */
+
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <iostream>
+
+#include "../Statistics.h"
+#include "../Transcendental.h"
+
+int InstanceCounter::counter = 0;
+
+/* best of a few runs, in nanoseconds per element */
+template <class F>
+double time_per_element(size_t n, F f) {
+    double best = 1e30;
+    for (int rep = 0; rep < 5; ++rep) {
+        auto t0 = std::chrono::steady_clock::now();
+        f();
+        auto t1 = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / n;
+        if (ns < best) { best = ns; }
+    }
+    return best;
+}
+
+int main() {
+    std::cout << "threads " << epl::hardware_threads() << "\n";
+    std::cout << "n\ttwo pass\tone pass\t(ns/element, double)\n";
+    for (size_t n = 1 << 10; n <= (1 << 24); n <<= 2) {
+        epl::valarray<double> x(n), y(n);
+        for (size_t k = 0; k < n; ++k) {
+            x[k] = static_cast<double>(k % 17) * 0.25;
+            y[k] = 1.0 + static_cast<double>(k % 3);
+        }
+        double m2 = 0, v2 = 0;
+        double two = time_per_element(n, [&]() {
+            auto e = epl::exp(x) * y;
+            m2 = std::get<0>(epl::reduce(e, epl::reducers::sum)) / n;
+            v2 = std::get<0>(epl::reduce(e - m2, epl::reducers::sum_sq)) / n;
+        });
+        double m1 = 0, v1 = 0;
+        double one = time_per_element(n, [&]() {
+            std::tie(m1, v1) = epl::reduce(epl::exp(x) * y, epl::reducers::mean, epl::reducers::variance);
+        });
+        if (std::fabs(m1 - m2) > 1e-9 * m2 || std::fabs(v1 - v2) > 1e-9 * v2) { std::cout << "mismatch at n = " << n << "\n"; return 1; }
+        std::cout << n << "\t" << two << "\t" << one << "\n";
+    }
+    return 0;
+}
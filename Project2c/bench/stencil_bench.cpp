@@ -0,0 +1,63 @@
+/*
+ * stencil_bench.cpp
+ * a three point second difference and a 16 tap FIR filter: explicit index
+ * loops against shift expressions, stencil and convolve, build with make bench
+ */
+
+#include <chrono>
+#include <complex>
+#include <cstdint>
+#include <iostream>
+
+#include "../Stencil.h"
+
+int InstanceCounter::counter = 0;
+
+/* best of a few runs, in nanoseconds per element */
+template <class F>
+double per_element(size_t n, F f) {
+    double best = 1e30;
+    for (int rep = 0; rep < 7; ++rep) {
+        auto t0 = std::chrono::steady_clock::now();
+        f();
+        auto t1 = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / n;
+        if (ns < best) { best = ns; }
+    }
+    return best;
+}
+
+int main() {
+    const size_t taps = 16;
+    std::cout << "threads " << epl::hardware_threads() << "\n";
+    std::cout << "n\tloop d2\tshifts d2\tstencil d2\tloop fir\tconvolve fir\t(ns/element)\n";
+    for (size_t n : {size_t(4096), size_t(131072), size_t(4194304)}) {
+        epl::valarray<double> u(n), a(n), b(n), c(n), h(taps), y0(n), y1(n);
+        for (size_t k = 0; k < n; ++k) { u[k] = double(k % 17) * 0.25; }
+        for (size_t j = 0; j < taps; ++j) { h[j] = 1.0 / (j + 1); }
+        const size_t ctr = (taps - 1) / 2;
+        double loop = per_element(n, [&]() {
+            a[0] = u[1] - 2 * u[0];
+            for (size_t k = 1; k + 1 < n; ++k) { a[k] = u[k - 1] - 2 * u[k] + u[k + 1]; }
+            a[n - 1] = u[n - 2] - 2 * u[n - 1];
+        });
+        double shifts = per_element(n, [&]() { b = epl::shift(u, -1) - 2.0 * u + epl::shift(u, 1); });
+        double stencil = per_element(n, [&]() { c = epl::stencil<1, -2, 1>(u); });
+        double fir_loop = per_element(n, [&]() {
+            for (size_t i = 0; i < n; ++i) {
+                double acc = 0;
+                for (size_t j = 0; j < taps; ++j) {
+                    size_t k = i + ctr - j;
+                    if (i + ctr >= j && k < n) { acc = acc + h[j] * u[k]; }
+                }
+                y0[i] = acc;
+            }
+        });
+        double fir = per_element(n, [&]() { y1 = epl::convolve(u, h); });
+        for (size_t k = 0; k < n; ++k) {
+            if (a[k] != b[k] || a[k] != c[k] || y0[k] != y1[k]) { std::cout << "mismatch at " << k << "\n"; return 1; }
+        }
+        std::cout << n << "\t" << loop << "\t" << shifts << "\t" << stencil << "\t" << fir_loop << "\t" << fir << "\n";
+    }
+    return 0;
+}